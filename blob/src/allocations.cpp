@@ -0,0 +1,59 @@
+#include <cstdlib>
+#include <new>
+using namespace std;
+
+#include "allocations.h"
+
+// C++11 dropped the dynamic exception specifications, C++17 rejects them
+#if __cplusplus >= 201103L
+#define ALLOCATIONS_THROW
+#define ALLOCATIONS_NOTHROW noexcept
+#else
+#define ALLOCATIONS_THROW throw(std::bad_alloc)
+#define ALLOCATIONS_NOTHROW throw()
+#endif
+
+// Allocations of each thread, nothing shared
+static __thread unsigned long long threadAllocations = 0;
+
+void *operator new(size_t size) ALLOCATIONS_THROW
+{
+    threadAllocations++;
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size) ALLOCATIONS_THROW
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) ALLOCATIONS_NOTHROW
+{
+    free(p);
+}
+
+void operator delete[](void *p) ALLOCATIONS_NOTHROW
+{
+    free(p);
+}
+
+// C++14 sized deallocation, the size is not needed
+#ifdef __cpp_sized_deallocation
+void operator delete(void *p, size_t) ALLOCATIONS_NOTHROW
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) ALLOCATIONS_NOTHROW
+{
+    free(p);
+}
+#endif
+
+unsigned long long heapAllocations()
+{
+    return threadAllocations;
+}
@@ -0,0 +1,15 @@
+/// \file allocations.h
+/// \brief Heap allocation counter.
+///
+/// Linking allocations.cpp replaces the global operator new and delete with
+/// malloc and free, counting the calls to operator new of every thread. The
+/// difference over a frame gives its allocations, see METRICS_ALLOCATIONS
+/// and the benchmark.
+
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+
+/// \brief Heap allocations (operator new) made so far by the calling thread.
+unsigned long long heapAllocations();
+
+#endif
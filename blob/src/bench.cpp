@@ -0,0 +1,356 @@
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+using namespace std;
+
+// Blob manager lib
+#include "cvblob.h"
+using namespace cvb;
+
+// Heap allocations, counted by operator new
+#include "allocations.h"
+
+// cvBlob kernels microbenchmark.
+//
+// Every kernel of the stylus path is timed over synthetic binary images
+// (resolution, blob count, blob size, noise density, holes) and the
+// results are printed as JSON on stdout:
+//   { "runs": [ { <image parameters>, "kernels": { "<kernel>": {
+//       "ns_per_pixel", "allocs_per_frame", "p50_ns", "p90_ns", "p99_ns",
+//       "max_ns" }, ... } }, ... ] }
+// ns_per_pixel is the median frame time over the image size. Allocations
+// are operator new calls, i.e. cvBlob's own (OpenCV's internal buffers are
+// not counted), see allocations.h.
+//
+// Options:
+//  --width <w> --height <h>  image size
+//  --blobs <n>               number of blobs (laid out on a grid)
+//  --size <s>                blob diameter in pixels
+//  --noise <d>               fraction of isolated noise pixels
+//  --holes                   blobs are rings (internal contours)
+//  --iterations <n>          timed frames per run, 200 by default
+// Without any image parameter a default sweep is run.
+
+static unsigned long long now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct BenchConfig
+{
+    int width;
+    int height;
+    int blobs;
+    int size;
+    double noise;
+    bool holes;
+};
+
+// Time and allocations of one kernel, one sample per frame
+class KernelSamples
+{
+public:
+    KernelSamples(const char *name, unsigned int iterations) : name(name), allocs(0), t0(0), a0(0)
+    {
+        // Recording a sample must not count as an allocation
+        ns.reserve(iterations);
+    }
+
+    void start()
+    {
+        a0 = heapAllocations();
+        t0 = now();
+    }
+
+    void stop()
+    {
+        unsigned long long t1 = now();
+        ns.push_back(t1 - t0);
+        allocs += heapAllocations() - a0;
+    }
+
+    void print(unsigned long long pixels, bool last)
+    {
+        sort(ns.begin(), ns.end());
+        unsigned long long p50 = percentile(.50);
+
+        printf("        \"%s\": { \"ns_per_pixel\": %.4f, \"allocs_per_frame\": %.2f, "
+               "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu }%s\n",
+               name, (double)p50 / pixels, (double)allocs / ns.size(),
+               p50, percentile(.90), percentile(.99), ns.back(), last ? "" : ",");
+    }
+
+private:
+    unsigned long long percentile(double p) const
+    {
+        return ns[(size_t)(p * (ns.size() - 1) + .5)];
+    }
+
+    const char *name;
+    vector<unsigned long long> ns;
+    unsigned long long allocs;
+    unsigned long long t0;
+    unsigned long long a0;
+};
+
+// Discs (or rings) on a grid, plus isolated noise pixels
+static void drawScene(IplImage *img, BenchConfig const &c)
+{
+    cvZero(img);
+
+    int cols = (int)ceil(sqrt((double)c.blobs * c.width / c.height));
+    if (cols < 1)
+        cols = 1;
+    int rows = (c.blobs + cols - 1) / cols;
+    if (rows < 1)
+        rows = 1;
+    int cellW = c.width / cols;
+    int cellH = c.height / rows;
+
+    // Keep a gap between neighbours so that blobs never merge
+    int r = c.size / 2;
+    if (r > cellW / 2 - 2)
+        r = cellW / 2 - 2;
+    if (r > cellH / 2 - 2)
+        r = cellH / 2 - 2;
+    int hole = c.holes ? r / 3 : -1;
+
+    for (int i = 0; i < c.blobs; i++)
+    {
+        int cx = (i % cols) * cellW + cellW / 2;
+        int cy = (i / cols) * cellH + cellH / 2;
+        for (int y = -r; y <= r; y++)
+        {
+            unsigned char *row = (unsigned char *)img->imageData + (cy + y) * img->widthStep;
+            for (int x = -r; x <= r; x++)
+            {
+                int d2 = x * x + y * y;
+                if ((d2 <= r * r) && (d2 > hole * hole))
+                    row[cx + x] = 0xff;
+            }
+        }
+    }
+
+    unsigned int state = 12345;
+    unsigned int nNoise = (unsigned int)(c.noise * c.width * c.height);
+    for (unsigned int i = 0; i < nNoise; i++)
+    {
+        state = state * 1103515245u + 12345u;
+        unsigned int x = (state >> 8) % c.width;
+        state = state * 1103515245u + 12345u;
+        unsigned int y = (state >> 8) % c.height;
+        img->imageData[y * img->widthStep + x] = (char)0xff;
+    }
+}
+
+static void run(BenchConfig const &c, unsigned int iterations, bool last)
+{
+    CvSize size = cvSize(c.width, c.height);
+    IplImage *img = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    IplImage *colour = cvCreateImage(size, IPL_DEPTH_8U, 3);
+    IplImage *render = cvCreateImage(size, IPL_DEPTH_8U, 3);
+    IplImage *labelImg = cvCreateImage(size, IPL_DEPTH_LABEL, 1);
+    IplImage *filtered = cvCreateImage(size, IPL_DEPTH_8U, 1);
+
+    drawScene(img, c);
+    cvMerge(img, img, img, NULL, colour);
+
+    // Noise specks are filtered out, blobs are kept
+    unsigned int minArea = 4;
+    unsigned int maxArea = c.width * c.height;
+
+    KernelSamples label("cvLabel", iterations);
+    KernelSamples filterByArea("cvFilterByArea", iterations);
+    KernelSamples labelFiltered("cvLabel_filtered", iterations);
+    KernelSamples labelStats("cvLabelStats", iterations);
+    KernelSamples filterLabels("cvFilterLabels", iterations);
+    KernelSamples meanColor("cvBlobMeanColor", iterations);
+    KernelSamples toPolygon("cvConvertChainCodesToPolygon", iterations);
+    KernelSamples chainPerimeter("cvContourChainCodePerimeter", iterations);
+    KernelSamples polygonArea("cvContourPolygonArea", iterations);
+    KernelSamples simplify("cvSimplifyPolygon", iterations);
+    KernelSamples hull("cvPolygonContourConvexHull", iterations);
+    KernelSamples updateTracks("cvUpdateTracks", iterations);
+    KernelSamples renderBlobs("cvRenderBlobs", iterations);
+
+    CvBlobs blobs;
+    CvBlobs fused;
+    CvLabelStatsBuffers statsBuffers;
+    CvTracks tracks;
+    vector<CvContourPolygon *> polygons;
+    vector<CvContourPolygon *> derived;
+    double sink = 0.;
+    unsigned int nBlobs = 0;
+
+    // The first frames warm the caches and the allocator up
+    const unsigned int warmup = 3;
+    for (unsigned int it = 0; it < iterations + warmup; it++)
+    {
+        bool timed = (it >= warmup);
+
+        // Labeling and area filter fused, to compare with the two below
+        if (timed) labelFiltered.start();
+        cvLabelFiltered(img, labelImg, fused, cvLabelFilter(minArea, maxArea));
+        if (timed) labelFiltered.stop();
+
+        // Same blobs, without contours nor label image
+        if (timed) labelStats.start();
+        cvLabelStats(img, fused, cvLabelFilter(minArea, maxArea), NULL, &statsBuffers);
+        if (timed) labelStats.stop();
+
+        if (timed) label.start();
+        cvLabel(img, labelImg, blobs);
+        if (timed) label.stop();
+
+        if (timed) filterByArea.start();
+        cvFilterByArea(blobs, minArea, maxArea);
+        if (timed) filterByArea.stop();
+        nBlobs = blobs.size();
+
+        if (timed) filterLabels.start();
+        cvFilterLabels(labelImg, filtered, blobs);
+        if (timed) filterLabels.stop();
+
+        if (timed) meanColor.start();
+        for (CvBlobs::const_iterator b = blobs.begin(); b != blobs.end(); ++b)
+            sink += cvBlobMeanColor(b->second, labelImg, colour).val[0];
+        if (timed) meanColor.stop();
+
+        if (timed) toPolygon.start();
+        for (CvBlobs::const_iterator b = blobs.begin(); b != blobs.end(); ++b)
+            polygons.push_back(cvConvertChainCodesToPolygon(&b->second->contour));
+        if (timed) toPolygon.stop();
+
+        if (timed) chainPerimeter.start();
+        for (CvBlobs::const_iterator b = blobs.begin(); b != blobs.end(); ++b)
+            sink += cvContourChainCodePerimeter(&b->second->contour);
+        if (timed) chainPerimeter.stop();
+
+        if (timed) polygonArea.start();
+        for (unsigned int i = 0; i < polygons.size(); i++)
+            sink += cvContourPolygonArea(polygons[i]);
+        if (timed) polygonArea.stop();
+
+        if (timed) simplify.start();
+        for (unsigned int i = 0; i < polygons.size(); i++)
+            derived.push_back(cvSimplifyPolygon(polygons[i], 1.));
+        if (timed) simplify.stop();
+
+        if (timed) hull.start();
+        for (unsigned int i = 0; i < polygons.size(); i++)
+            derived.push_back(cvPolygonContourConvexHull(polygons[i]));
+        if (timed) hull.stop();
+
+        for (unsigned int i = 0; i < polygons.size(); i++)
+            delete polygons[i];
+        for (unsigned int i = 0; i < derived.size(); i++)
+            delete derived[i];
+        polygons.clear();
+        derived.clear();
+
+        if (timed) updateTracks.start();
+        cvUpdateTracks(blobs, tracks, 5., 10);
+        if (timed) updateTracks.stop();
+
+        cvCopy(colour, render);
+        if (timed) renderBlobs.start();
+        cvRenderBlobs(labelImg, blobs, render, render, CV_BLOB_RENDER_COLOR|CV_BLOB_RENDER_CENTROID|CV_BLOB_RENDER_BOUNDING_BOX|CV_BLOB_RENDER_ANGLE);
+        if (timed) renderBlobs.stop();
+    }
+
+    unsigned long long pixels = (unsigned long long)c.width * c.height;
+
+    printf("    { \"width\": %d, \"height\": %d, \"blobs\": %d, \"size\": %d, \"noise\": %g, \"holes\": %s,\n",
+           c.width, c.height, c.blobs, c.size, c.noise, c.holes ? "true" : "false");
+    printf("      \"iterations\": %u, \"labeled_blobs\": %u, \"checksum\": %g,\n", iterations, nBlobs, sink);
+    printf("      \"kernels\": {\n");
+    label.print(pixels, false);
+    filterByArea.print(pixels, false);
+    labelFiltered.print(pixels, false);
+    labelStats.print(pixels, false);
+    filterLabels.print(pixels, false);
+    meanColor.print(pixels, false);
+    toPolygon.print(pixels, false);
+    chainPerimeter.print(pixels, false);
+    polygonArea.print(pixels, false);
+    simplify.print(pixels, false);
+    hull.print(pixels, false);
+    updateTracks.print(pixels, false);
+    renderBlobs.print(pixels, true);
+    printf("      }\n");
+    printf("    }%s\n", last ? "" : ",");
+
+    cvReleaseTracks(tracks);
+    cvReleaseBlobs(blobs);
+    cvReleaseBlobs(fused);
+    cvReleaseImage(&filtered);
+    cvReleaseImage(&labelImg);
+    cvReleaseImage(&render);
+    cvReleaseImage(&colour);
+    cvReleaseImage(&img);
+}
+
+int main(int argc, char *argv[])
+{
+    BenchConfig single = { 640, 480, 16, 30, 0., false };
+    bool custom = false;
+    unsigned int iterations = 200;
+
+    for (int i = 1; i < argc; i++)
+    {
+        // Any image parameter replaces the sweep by a single run
+        if (strcmp(argv[i], "--iterations"))
+            custom = true;
+
+        if (!strcmp(argv[i], "--holes"))
+            single.holes = true;
+        else if (i + 1 >= argc)
+            break;
+        else if (!strcmp(argv[i], "--width"))
+            single.width = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--height"))
+            single.height = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--blobs"))
+            single.blobs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--size"))
+            single.size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--noise"))
+            single.noise = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--iterations"))
+            iterations = atoi(argv[++i]);
+    }
+    if (iterations < 1)
+        iterations = 1;
+
+    // Stylus sized spots, from a single pen to a crowded or noisy frame
+    static const BenchConfig sweep[] = {
+        {  320, 240,   1, 30, 0.,    false },
+        {  640, 480,   1, 30, 0.,    false },
+        {  640, 480,  16, 30, 0.,    false },
+        {  640, 480,  16, 30, 0.,    true  },
+        {  640, 480,  16, 30, 0.001, false },
+        {  640, 480,  16, 30, 0.01,  false },
+        {  640, 480, 256,  8, 0.,    false },
+        { 1280, 720,  16, 30, 0.001, false },
+    };
+
+    printf("{\n  \"runs\": [\n");
+    if (custom)
+        run(single, iterations, true);
+    else
+    {
+        unsigned int n = sizeof(sweep) / sizeof(sweep[0]);
+        for (unsigned int i = 0; i < n; i++)
+            run(sweep[i], iterations, i + 1 == n);
+    }
+    printf("  ]\n}\n");
+
+    return 0;
+}
@@ -0,0 +1,30 @@
+#-------------------------------------------------
+#
+# cvBlob kernels microbenchmark: times labeling,
+# filtering, contours, tracking and rendering
+# over synthetic images, prints JSON (see
+# bench.cpp).
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = bench
+TEMPLATE = app
+CONFIG += console
+
+DEFINES += HEADLESS
+
+SOURCES += bench.cpp\
+        allocations.cpp\
+        cvaux.cpp\
+        cvblob.cpp\
+        cvcolor.cpp\
+        cvcontour.cpp\
+        cvlabel.cpp\
+        cvtrack.cpp
+
+HEADERS  += allocations.h\
+        cvblob.h
+
+LIBS += -lopencv_core
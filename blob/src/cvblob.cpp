@@ -26,8 +26,10 @@ using namespace std;
 #include <opencv2\highgui\highgui_c.h>
 #else
 #include <opencv/cv.h>
+#ifndef HEADLESS
 #include <opencv/highgui.h>
 #endif
+#endif
 
 #include "cvblob.h"
 
@@ -133,61 +135,70 @@ namespace cvb
     __CV_END__;
   }*/
 
+  template <typename L>
+  static void cvRenderBlobColor(const IplImage *imgLabel, CvBlob *blob, IplImage *imgSource, IplImage *imgDest, CvScalar const &color, double alpha)
+  {
+    int stepLbl = imgLabel->widthStep/(imgLabel->depth/8);
+    int stepSrc = imgSource->widthStep/(imgSource->depth/8);
+    int stepDst = imgDest->widthStep/(imgDest->depth/8);
+    int imgLabel_width = imgLabel->width;
+    int imgLabel_height = imgLabel->height;
+    int imgLabel_offset = 0;
+    int imgSource_width = imgSource->width;
+    int imgSource_height = imgSource->height;
+    int imgSource_offset = 0;
+    int imgDest_width = imgDest->width;
+    int imgDest_height = imgDest->height;
+    int imgDest_offset = 0;
+    if(imgLabel->roi)
+    {
+      imgLabel_width = imgLabel->roi->width;
+      imgLabel_height = imgLabel->roi->height;
+      imgLabel_offset = (imgLabel->nChannels * imgLabel->roi->xOffset) + (imgLabel->roi->yOffset * stepLbl);
+    }
+    if(imgSource->roi)
+    {
+      imgSource_width = imgSource->roi->width;
+      imgSource_height = imgSource->roi->height;
+      imgSource_offset = (imgSource->nChannels * imgSource->roi->xOffset) + (imgSource->roi->yOffset * stepSrc);
+    }
+    if(imgDest->roi)
+    {
+      imgDest_width = imgDest->roi->width;
+      imgDest_height = imgDest->roi->height;
+      imgDest_offset = (imgDest->nChannels * imgDest->roi->xOffset) + (imgDest->roi->yOffset * stepDst);
+    }
+
+    L *labels = (L *)imgLabel->imageData + imgLabel_offset + (blob->miny * stepLbl);
+    unsigned char *source = (unsigned char *)imgSource->imageData + imgSource_offset + (blob->miny * stepSrc);
+    unsigned char *imgData = (unsigned char *)imgDest->imageData + imgDest_offset + (blob->miny * stepDst);
+
+    for (unsigned int r=blob->miny; r<blob->maxy; r++, labels+=stepLbl, source+=stepSrc, imgData+=stepDst)
+      for (unsigned int c=blob->minx; c<blob->maxx; c++)
+      {
+	if (labels[c]==blob->label)
+	{
+	  imgData[imgDest->nChannels*c+0] = (unsigned char)((1.-alpha)*source[imgSource->nChannels*c+0]+alpha*color.val[0]);
+	  imgData[imgDest->nChannels*c+1] = (unsigned char)((1.-alpha)*source[imgSource->nChannels*c+1]+alpha*color.val[1]);
+	  imgData[imgDest->nChannels*c+2] = (unsigned char)((1.-alpha)*source[imgSource->nChannels*c+2]+alpha*color.val[2]);
+	}
+      }
+  }
+
   void cvRenderBlob(const IplImage *imgLabel, CvBlob *blob, IplImage *imgSource, IplImage *imgDest, unsigned short mode, CvScalar const &color, double alpha)
   {
     CV_FUNCNAME("cvRenderBlob");
     __CV_BEGIN__;
 
-    CV_ASSERT(imgLabel&&(imgLabel->depth==IPL_DEPTH_LABEL)&&(imgLabel->nChannels==1));
+    CV_ASSERT(CV_IS_LABEL_IMAGE(imgLabel));
     CV_ASSERT(imgDest&&(imgDest->depth==IPL_DEPTH_8U)&&(imgDest->nChannels==3));
 
     if (mode&CV_BLOB_RENDER_COLOR)
     {
-      int stepLbl = imgLabel->widthStep/(imgLabel->depth/8);
-      int stepSrc = imgSource->widthStep/(imgSource->depth/8);
-      int stepDst = imgDest->widthStep/(imgDest->depth/8);
-      int imgLabel_width = imgLabel->width;
-      int imgLabel_height = imgLabel->height;
-      int imgLabel_offset = 0;
-      int imgSource_width = imgSource->width;
-      int imgSource_height = imgSource->height;
-      int imgSource_offset = 0;
-      int imgDest_width = imgDest->width;
-      int imgDest_height = imgDest->height;
-      int imgDest_offset = 0;
-      if(imgLabel->roi)
-      {
-	imgLabel_width = imgLabel->roi->width;
-	imgLabel_height = imgLabel->roi->height;
-	imgLabel_offset = (imgLabel->nChannels * imgLabel->roi->xOffset) + (imgLabel->roi->yOffset * stepLbl);
-      }
-      if(imgSource->roi)
-      {
-	imgSource_width = imgSource->roi->width;
-	imgSource_height = imgSource->roi->height;
-	imgSource_offset = (imgSource->nChannels * imgSource->roi->xOffset) + (imgSource->roi->yOffset * stepSrc);
-      }
-      if(imgDest->roi)
-      {
-	imgDest_width = imgDest->roi->width;
-	imgDest_height = imgDest->roi->height;
-	imgDest_offset = (imgDest->nChannels * imgDest->roi->xOffset) + (imgDest->roi->yOffset * stepDst);
-      }
-
-      CvLabel *labels = (CvLabel *)imgLabel->imageData + imgLabel_offset + (blob->miny * stepLbl);
-      unsigned char *source = (unsigned char *)imgSource->imageData + imgSource_offset + (blob->miny * stepSrc);
-      unsigned char *imgData = (unsigned char *)imgDest->imageData + imgDest_offset + (blob->miny * stepDst);
-
-      for (unsigned int r=blob->miny; r<blob->maxy; r++, labels+=stepLbl, source+=stepSrc, imgData+=stepDst)
-	for (unsigned int c=blob->minx; c<blob->maxx; c++)
-	{
-	  if (labels[c]==blob->label)
-	  {
-	    imgData[imgDest->nChannels*c+0] = (unsigned char)((1.-alpha)*source[imgSource->nChannels*c+0]+alpha*color.val[0]);
-	    imgData[imgDest->nChannels*c+1] = (unsigned char)((1.-alpha)*source[imgSource->nChannels*c+1]+alpha*color.val[1]);
-	    imgData[imgDest->nChannels*c+2] = (unsigned char)((1.-alpha)*source[imgSource->nChannels*c+2]+alpha*color.val[2]);
-	  }
-	}
+      if (imgLabel->depth==IPL_DEPTH_LABEL16)
+	cvRenderBlobColor<CvLabel16>(imgLabel, blob, imgSource, imgDest, color, alpha);
+      else
+	cvRenderBlobColor<CvLabel>(imgLabel, blob, imgSource, imgDest, color, alpha);
     }
 
     if (mode)
@@ -287,7 +298,7 @@ namespace cvb
     __CV_BEGIN__;
     {
 
-      CV_ASSERT(imgLabel&&(imgLabel->depth==IPL_DEPTH_LABEL)&&(imgLabel->nChannels==1));
+      CV_ASSERT(CV_IS_LABEL_IMAGE(imgLabel));
       CV_ASSERT(imgDest&&(imgDest->depth==IPL_DEPTH_8U)&&(imgDest->nChannels==3));
 
       Palete pal;
@@ -315,6 +326,76 @@ namespace cvb
     __CV_END__;
   }
 
+  template <typename L>
+  static void cvCentroidWeightedImage(CvBlob *blob, IplImage const *imgLabel, IplImage const *img, unsigned char background)
+  {
+    int stepLbl = imgLabel->widthStep/(imgLabel->depth/8);
+    int stepImg = img->widthStep;
+    int imgLabel_offset = 0;
+    int img_offset = 0;
+    if(imgLabel->roi)
+      imgLabel_offset = imgLabel->roi->xOffset + (imgLabel->roi->yOffset * stepLbl);
+    if(img->roi)
+      img_offset = img->roi->xOffset + (img->roi->yOffset * stepImg);
+
+    // Blob coordinates are relative to the label ROI, only its bounding box is read
+    L const *labels = (L const *)imgLabel->imageData + imgLabel_offset + blob->miny*stepLbl;
+    unsigned char const *imgData = (unsigned char const *)img->imageData + img_offset + blob->miny*stepImg;
+
+    // Integer sums per row, exact whatever the blob size
+    double m00 = 0.;
+    double m10 = 0.;
+    double m01 = 0.;
+
+    for (unsigned int y=blob->miny; y<=blob->maxy; y++, labels+=stepLbl, imgData+=stepImg)
+    {
+      unsigned int s00 = 0;
+      unsigned long long s10 = 0;
+
+      for (unsigned int x=blob->minx; x<=blob->maxx; x++)
+      {
+	if ((labels[x]!=blob->label)||(imgData[x]<=background))
+	  continue;
+
+	unsigned int w = imgData[x]-background;
+	s00 += w;
+	s10 += (unsigned long long)w*x;
+      }
+
+      m00 += (double)s00;
+      m10 += (double)s10;
+      m01 += (double)s00*y;
+    }
+
+    if (m00>0.)
+      blob->centroid = cvPoint2D64f(m10/m00, m01/m00);
+  }
+
+  CvPoint2D64f cvCentroidWeighted(CvBlob *blob, IplImage const *imgLabel, IplImage const *img, unsigned char background)
+  {
+    CV_FUNCNAME("cvCentroidWeighted");
+    __CV_BEGIN__;
+    {
+      CV_ASSERT(blob);
+      CV_ASSERT(CV_IS_LABEL_IMAGE(imgLabel));
+      CV_ASSERT(img&&(img->depth==IPL_DEPTH_8U)&&(img->nChannels==1));
+
+      if (imgLabel->depth==IPL_DEPTH_LABEL16)
+	cvCentroidWeightedImage<CvLabel16>(blob, imgLabel, img, background);
+      else
+	cvCentroidWeightedImage<CvLabel>(blob, imgLabel, img, background);
+
+      return blob->centroid;
+    }
+    __CV_END__;
+  }
+
+  void cvCentroidsWeighted(CvBlobs const &blobs, IplImage const *imgLabel, IplImage const *img, unsigned char background)
+  {
+    for (CvBlobs::const_iterator it=blobs.begin(); it!=blobs.end(); ++it)
+      cvCentroidWeighted(it->second, imgLabel, img, background);
+  }
+
   // Returns radians
   double cvAngle(CvBlob *blob)
   {
@@ -326,6 +407,7 @@ namespace cvb
     __CV_END__;
   }
 
+#ifndef HEADLESS
   void cvSaveImageBlob(const char *filename, IplImage *img, CvBlob const *blob)
   {
     CvRect roi = cvGetImageROI(img);
@@ -333,6 +415,7 @@ namespace cvb
     cvSaveImage(filename, img);
     cvSetImageROI(img, roi);
   }
+#endif
 
 }
 
@@ -35,6 +35,7 @@
 #include <list>
 #include <vector>
 #include <limits>
+#include <cstring>
 
 #if (defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__) || defined(__WINDOWS__) || (defined(__APPLE__) & defined(__MACH__)))
 //#include <cv.h>
@@ -203,15 +204,50 @@ extern "C" {
   /// \brief Type of label.
   /// \see IPL_DEPTH_LABEL
   typedef unsigned int CvLabel;
-  //typedef unsigned char CvLabel;
+
+  /// \brief Type of the pixels of a compact label image.
+  /// \see IPL_DEPTH_LABEL16
+  typedef unsigned short CvLabel16;
 
   /// \def IPL_DEPTH_LABEL
   /// \brief Size of a label in bits.
   /// \see CvLabel
 #define IPL_DEPTH_LABEL (sizeof(cvb::CvLabel)*8)
 
+  /// \def IPL_DEPTH_LABEL16
+  /// \brief Size of a compact label image pixel in bits.
+  /// Compact label images halve the label bandwidth, but hold 65534 components at most: see cvLabel.
+  /// They are created by cvCreateLabelImage16, as a plain IPL_DEPTH_16U image is not a label image.
+  /// The functions reading label images take both depths.
+  /// \see CvLabel16
+#define IPL_DEPTH_LABEL16 (sizeof(cvb::CvLabel16)*8)
+
+  /// \def CV_LABEL16_MODEL
+  /// \brief Color model tag of the compact label images (OpenCV ignores the color model).
+#define CV_LABEL16_MODEL "LB16"
+
+  /// \def CV_IS_LABEL16_IMAGE(img)
+  /// \brief True if img is a compact label image, created by cvCreateLabelImage16.
+#define CV_IS_LABEL16_IMAGE(img) ((img)&&((img)->depth==(int)IPL_DEPTH_LABEL16)&&((img)->nChannels==1)&&(!strncmp((img)->colorModel, CV_LABEL16_MODEL, 4)))
+
+  /// \def CV_IS_LABEL_IMAGE(img)
+  /// \brief True if img is a label image, of either depth.
+#define CV_IS_LABEL_IMAGE(img) ((img)&&((((img)->depth==(int)IPL_DEPTH_LABEL)&&((img)->nChannels==1))||CV_IS_LABEL16_IMAGE(img)))
+
+  /// \def CV_LABEL_OVERFLOW
+  /// \brief Returned by cvLabel when a compact label image cannot hold the components.
+#define CV_LABEL_OVERFLOW ((unsigned int)-1)
+
+  /// \fn IplImage *cvCreateLabelImage16(CvSize size)
+  /// \brief Create a compact label image (depth=IPL_DEPTH_LABEL16, and num. channels=1).
+  /// \param size Image size.
+  /// \return Image, released with cvReleaseImage.
+  /// \see IPL_DEPTH_LABEL16
+  IplImage *cvCreateLabelImage16(CvSize size);
+
   /// \def CV_BLOB_MAX_LABEL
   /// \brief Max label number.
+  /// In a label image, the largest value of the pixel type marks the background next to contours. cvGetLabel returns it as CV_BLOB_MAX_LABEL.
   /// \see CvLabel.
 #define CV_BLOB_MAX_LABEL std::numeric_limits<CvLabel>::max()
   
@@ -274,16 +310,103 @@ extern "C" {
   /// \brief Label the connected parts of a binary image.
   /// Algorithm based on paper "A linear-time component-labeling algorithm using contour tracing technique" of Fu Chang, Chun-Jen Chen and Chi-Jen Lu.
   /// \param img Input binary image (depth=IPL_DEPTH_8U and num. channels=1).
-  /// \param imgOut Output image (depth=IPL_DEPTH_LABEL and num. channels=1).
+  /// \param imgOut Output image (depth=IPL_DEPTH_LABEL or IPL_DEPTH_LABEL16, and num. channels=1).
   /// \param blobs List of blobs.
-  /// \return Number of pixels that has been labeled.
+  /// \return Number of pixels that has been labeled. CV_LABEL_OVERFLOW if imgOut is a compact label image and there are too many components for 16 bits:
+  /// blobs is then empty and imgOut undefined, the caller may label again into an IPL_DEPTH_LABEL image. imgOut is never reallocated.
   unsigned int cvLabel (IplImage const *img, IplImage *imgOut, CvBlobs &blobs);
 
+  /// \brief Predicates on the components found by cvLabel.
+  /// A zero bound is not checked.
+  /// \see cvLabelFilter
+  struct CvLabelFilter
+  {
+    unsigned int minArea; ///< Min area.
+    unsigned int maxArea; ///< Max area.
+    unsigned int maxWidth; ///< Max width of the bounding box.
+    unsigned int maxHeight; ///< Max height of the bounding box.
+    double minAspect; ///< Min bounding box width/height.
+    double maxAspect; ///< Max bounding box width/height.
+  };
+
+  /// \fn inline CvLabelFilter cvLabelFilter(unsigned int minArea=0, unsigned int maxArea=0, unsigned int maxWidth=0, unsigned int maxHeight=0, double minAspect=0., double maxAspect=0.)
+  /// \brief Constructor of CvLabelFilter. The default one accepts every component.
+  inline CvLabelFilter cvLabelFilter(unsigned int minArea=0, unsigned int maxArea=0, unsigned int maxWidth=0, unsigned int maxHeight=0, double minAspect=0., double maxAspect=0.)
+  {
+    CvLabelFilter filter;
+    filter.minArea = minArea;
+    filter.maxArea = maxArea;
+    filter.maxWidth = maxWidth;
+    filter.maxHeight = maxHeight;
+    filter.minAspect = minAspect;
+    filter.maxAspect = maxAspect;
+    return filter;
+  }
+
+  /// \fn unsigned int cvLabelFiltered (IplImage const *img, IplImage *imgOut, CvBlobs &blobs, CvLabelFilter const &filter, unsigned int *numComponents=NULL)
+  /// \brief Label the connected parts of a binary image, keeping the ones that pass a filter.
+  /// Same as cvFilterByArea after cvLabel, without the blobs being inserted then released, and with shape predicates.
+  /// Once a component exceeds the max area, its moments and internal contours are no longer accumulated; it is still traced in full, for its pixels to be cleared.
+  /// The kept blobs are labeled from 1 in scan order, the pixels of the rejected ones are 0 in imgOut.
+  /// \param img Input binary image (depth=IPL_DEPTH_8U and num. channels=1).
+  /// \param imgOut Output image (depth=IPL_DEPTH_LABEL or IPL_DEPTH_LABEL16, and num. channels=1).
+  /// \param blobs List of blobs that passed the filter.
+  /// \param filter Predicates.
+  /// \param numComponents If not NULL, gets the number of components found, rejected ones included.
+  /// \return Number of pixels of the kept blobs, CV_LABEL_OVERFLOW as by cvLabel.
+  /// \see cvFilterByArea
+  unsigned int cvLabelFiltered (IplImage const *img, IplImage *imgOut, CvBlobs &blobs, CvLabelFilter const &filter, unsigned int *numComponents=NULL);
+
+  /// \brief Moments of a component being labeled by cvLabelStats.
+  struct CvRunStats
+  {
+    unsigned int area; ///< Pixels.
+    unsigned int minx; ///< X min.
+    unsigned int maxx; ///< X max.
+    unsigned int miny; ///< Y min.
+    unsigned int maxy; ///< Y max.
+    CvPoint start;     ///< First pixel in scan order.
+    unsigned int lastRow; ///< Last row with a run of the component.
+    double m10; ///< Moment 10.
+    double m01; ///< Moment 01.
+    double m11; ///< Moment 11.
+    double m20; ///< Moment 20.
+    double m02; ///< Moment 02.
+  };
+
+  /// \brief Working memory of cvLabelStats.
+  /// Kept by the caller from one frame to the next, so that it is only allocated once. Its size is in the image width.
+  struct CvLabelStatsBuffers
+  {
+    std::vector<CvLabel> rows;        ///< Labels of the previous and current rows.
+    std::vector<unsigned int> runs;   ///< Runs of the current row, first and past the last x.
+    std::vector<CvLabel> parent;      ///< Union-find forest of the labels in use.
+    std::vector<CvRunStats> stats;    ///< Moments per label, valid for the roots.
+    std::vector<CvLabel> active;      ///< Labels in use.
+    std::vector<CvLabel> freeLabels;  ///< Labels to reuse.
+    std::vector<CvBlob *> kept;       ///< Blobs that passed the filter, before they are ordered.
+  };
+
+  /// \fn unsigned int cvLabelStats (IplImage const *img, CvBlobs &blobs, CvLabelFilter const &filter=cvLabelFilter(), unsigned int *numComponents=NULL, CvLabelStatsBuffers *buffers=NULL)
+  /// \brief Find the blobs of a binary image, without a label image.
+  /// For the callers that only use the blob moments and bounding boxes: the same blobs and labels as cvLabelFiltered,
+  /// but the contours are not traced, only their starting point is set. Components are 8-connected runs, and only two rows
+  /// of labels are kept. A component is filtered as soon as a row does not continue it, and its label is reused, so that
+  /// the working memory is in the image width rather than its size, however noisy the image.
+  /// \param img Input binary image (depth=IPL_DEPTH_8U and num. channels=1).
+  /// \param blobs List of blobs that passed the filter.
+  /// \param filter Predicates.
+  /// \param numComponents If not NULL, gets the number of components found, rejected ones included.
+  /// \param buffers Working memory kept between calls, or NULL to allocate it for this call only.
+  /// \return Number of pixels of the kept blobs.
+  /// \see cvLabelFiltered
+  unsigned int cvLabelStats (IplImage const *img, CvBlobs &blobs, CvLabelFilter const &filter=cvLabelFilter(), unsigned int *numComponents=NULL, CvLabelStatsBuffers *buffers=NULL);
+
   //IplImage *cvFilterLabel(IplImage *imgIn, CvLabel label);
 
   /// \fn void cvFilterLabels(IplImage *imgIn, IplImage *imgOut, const CvBlobs &blobs)
   /// \brief Draw a binary image with the blobs that have been given.
-  /// \param imgIn Input image (depth=IPL_DEPTH_LABEL and num. channels=1).
+  /// \param imgIn Input image (depth=IPL_DEPTH_LABEL or IPL_DEPTH_LABEL16, and num. channels=1).
   /// \param imgOut Output binary image (depth=IPL_DEPTH_8U and num. channels=1).
   /// \param blobs List of blobs to be drawn.
   /// \see cvLabel
@@ -369,6 +492,28 @@ extern "C" {
     return blob->centroid=cvPoint2D64f(blob->m10/blob->area, blob->m01/blob->area);
   }
 
+  /// \fn CvPoint2D64f cvCentroidWeighted(CvBlob *blob, IplImage const *imgLabel, IplImage const *img, unsigned char background=0)
+  /// \brief Calculates the intensity weighted centroid of a blob.
+  /// Each pixel of the blob is weighted by its value in img minus background, instead of 1 for the binary moments. Only the bounding box of the blob is read.
+  /// With background set to the threshold the image was labeled at, the weight of a pixel goes to 0 as it leaves the blob, and the centroid moves by fractions of a pixel instead of jumping with the footprint.
+  /// The centroid is returned and stored in the blob structure, the moments are left unchanged. It is left unchanged if every pixel is at the background level or below.
+  /// \param blob Blob whose centroid will be calculated.
+  /// \param imgLabel Label image (depth=IPL_DEPTH_LABEL or IPL_DEPTH_LABEL16, and num. channels=1).
+  /// \param img Intensity image, the one labeled before thresholding (depth=IPL_DEPTH_8U and num. channels=1).
+  /// \param background Intensity of weight 0.
+  /// \return Centroid.
+  /// \see cvCentroid
+  CvPoint2D64f cvCentroidWeighted(CvBlob *blob, IplImage const *imgLabel, IplImage const *img, unsigned char background=0);
+
+  /// \fn void cvCentroidsWeighted(CvBlobs const &blobs, IplImage const *imgLabel, IplImage const *img, unsigned char background=0)
+  /// \brief Calculates the intensity weighted centroid of every blob.
+  /// \param blobs List of blobs.
+  /// \param imgLabel Label image (depth=IPL_DEPTH_LABEL or IPL_DEPTH_LABEL16, and num. channels=1).
+  /// \param img Intensity image (depth=IPL_DEPTH_8U and num. channels=1).
+  /// \param background Intensity of weight 0.
+  /// \see cvCentroidWeighted
+  void cvCentroidsWeighted(CvBlobs const &blobs, IplImage const *imgLabel, IplImage const *img, unsigned char background=0);
+
   /// \fn double cvAngle(CvBlob *blob)
   /// \brief Calculates angle orientation of a blob.
   /// \param blob Blob.
@@ -385,7 +530,10 @@ extern "C" {
   /// \param blob Blob.
   /// \see CvBlob
   /// \see cvRenderBlob
+  /// \note Not available when built with HEADLESS (no highgui).
+#ifndef HEADLESS
   void cvSaveImageBlob(const char *filename, IplImage *img, CvBlob const *blob);
+#endif
   
 #define CV_BLOB_RENDER_COLOR            0x0001 ///< Render each blog with a different color. \see cvRenderBlobs
 #define CV_BLOB_RENDER_CENTROID         0x0002 ///< Render centroid. \see cvRenderBlobs
@@ -396,7 +544,7 @@ extern "C" {
 
   /// \fn void cvRenderBlob(const IplImage *imgLabel, CvBlob *blob, IplImage *imgSource, IplImage *imgDest, unsigned short mode=0x000f, CvScalar const &color=CV_RGB(255, 255, 255), double alpha=1.)
   /// \brief Draws or prints information about a blob.
-  /// \param imgLabel Label image (depth=IPL_DEPTH_LABEL and num. channels=1).
+  /// \param imgLabel Label image (depth=IPL_DEPTH_LABEL or IPL_DEPTH_LABEL16, and num. channels=1).
   /// \param blob Blob.
   /// \param imgSource Input image (depth=IPL_DEPTH_8U and num. channels=3).
   /// \param imgDest Output image (depth=IPL_DEPTH_8U and num. channels=3).
@@ -413,7 +561,7 @@ extern "C" {
 
   /// \fn void cvRenderBlobs(const IplImage *imgLabel, CvBlobs &blobs, IplImage *imgSource, IplImage *imgDest, unsigned short mode=0x000f, double alpha=1.)
   /// \brief Draws or prints information about blobs.
-  /// \param imgLabel Label image (depth=IPL_DEPTH_LABEL and num. channels=1).
+  /// \param imgLabel Label image (depth=IPL_DEPTH_LABEL or IPL_DEPTH_LABEL16, and num. channels=1).
   /// \param blobs List of blobs.
   /// \param imgSource Input image (depth=IPL_DEPTH_8U and num. channels=3).
   /// \param imgDest Output image (depth=IPL_DEPTH_8U and num. channels=3).
@@ -505,6 +653,10 @@ extern "C" {
     unsigned int lifetime; ///< Indicates how much frames the object has been in scene.
     unsigned int active; ///< Indicates number of frames that has been active from last inactive period.
     unsigned int inactive; ///< Indicates number of frames that has been missing.
+
+    unsigned int sequence; ///< Sequence number of the last frame the track was seen in (cvUpdateTracksTimed only).
+    unsigned long long timestamp; ///< Capture time of that frame, monotonic nanoseconds (cvUpdateTracksTimed only).
+    CvPoint2D64f velocity; ///< Centroid velocity between the last two frames the track was seen in, pixels per second (cvUpdateTracksTimed only).
   };
 
   /// \var typedef std::map<CvID, CvTrack *> CvTracks
@@ -550,6 +702,24 @@ extern "C" {
   /// \see Tracks
   void cvUpdateTracks(CvBlobs const &b, CvTracks &t, const double thDistance, const unsigned int thInactive, const unsigned int thActive=0);
 
+  /// \fn cvUpdateTracksTimed(CvBlobs const &b, CvTracks &t, unsigned int sequence, unsigned long long timestamp, const double thDistance, const unsigned int thInactive, const unsigned int thActive=0)
+  /// \brief Updates list of tracks based on the blobs of a stamped frame.
+  /// Same as cvUpdateTracks, with the real frame timing instead of a constant interval:
+  /// the velocity of the tracks is measured over the time between the frames they were
+  /// seen in, blobs are matched with where the active tracks should be at timestamp, and
+  /// frames missing from the sequence (dropped by the camera or the pipeline) count as
+  /// inactive frames. A track is thus followed through a dropped frame instead of being
+  /// lost on the motion jump.
+  /// \param b List of blobs.
+  /// \param t List of tracks.
+  /// \param sequence Frame sequence number, increasing by one per captured frame.
+  /// \param timestamp Frame capture time, monotonic nanoseconds.
+  /// \param thDistance Max distance to determine when a track and a blob match.
+  /// \param thInactive Max number of frames a track can be inactive.
+  /// \param thActive If a track becomes inactive but it has been active less than thActive frames, the track will be deleted.
+  /// \see cvUpdateTracks
+  void cvUpdateTracksTimed(CvBlobs const &b, CvTracks &t, unsigned int sequence, unsigned long long timestamp, const double thDistance, const unsigned int thInactive, const unsigned int thActive=0);
+
 #define CV_TRACK_RENDER_ID            0x0001 ///< Print the ID of each track in the image. \see cvRenderTracks
 #define CV_TRACK_RENDER_BOUNDING_BOX  0x0002 ///< Draw bounding box of each track in the image. \see cvRenderTracks
 #define CV_TRACK_RENDER_TO_LOG        0x0010 ///< Print track info to log out. \see cvRenderTracks
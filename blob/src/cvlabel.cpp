@@ -19,6 +19,9 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
 using namespace std;
 
 #if (defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__) || defined(__WINDOWS__) || (defined(__APPLE__) & defined(__MACH__)))
@@ -46,19 +49,71 @@ namespace cvb
 
   unsigned int cvLabel (IplImage const *img, IplImage *imgOut, CvBlobs &blobs)
   {
-    CV_FUNCNAME("cvLabel");
+    return cvLabelFiltered(img, imgOut, blobs, cvLabelFilter());
+  }
+
+  static bool cvLabelFilterAccepts(CvLabelFilter const &filter, CvBlob const *blob)
+  {
+    unsigned int width = blob->maxx - blob->minx + 1;
+    unsigned int height = blob->maxy - blob->miny + 1;
+    double aspect = (double)width/(double)height;
+
+    return ((!filter.minArea)||(blob->area>=filter.minArea))&&
+      ((!filter.maxArea)||(blob->area<=filter.maxArea))&&
+      ((!filter.maxWidth)||(width<=filter.maxWidth))&&
+      ((!filter.maxHeight)||(height<=filter.maxHeight))&&
+      ((filter.minAspect<=0.)||(aspect>=filter.minAspect))&&
+      ((filter.maxAspect<=0.)||(aspect<=filter.maxAspect));
+  }
+
+  // Centroid, central, normalized and Hu moments from the raw ones
+  static void cvBlobMoments(CvBlob *blob)
+  {
+    cvCentroid(blob);
+
+    blob->u11 = blob->m11 - (blob->m10*blob->m01)/blob->m00;
+    blob->u20 = blob->m20 - (blob->m10*blob->m10)/blob->m00;
+    blob->u02 = blob->m02 - (blob->m01*blob->m01)/blob->m00;
+
+    double m00_2 = blob->m00 * blob->m00;
+
+    blob->n11 = blob->u11 / m00_2;
+    blob->n20 = blob->u20 / m00_2;
+    blob->n02 = blob->u02 / m00_2;
+
+    blob->p1 = blob->n20 + blob->n02;
+
+    double nn = blob->n20 - blob->n02;
+    blob->p2 = nn*nn + 4.*(blob->n11*blob->n11);
+  }
+
+  // Labels in an image of L pixels. The largest L value marks the contours,
+  // false is returned, with no blob, when the components need more labels.
+  template <typename L>
+  static bool cvLabelImage (IplImage const *img, IplImage *imgOut, CvBlobs &blobs, CvLabelFilter const &filter, unsigned int *numComponents, unsigned int &numPixels)
+  {
+    CV_FUNCNAME("cvLabelImage");
     __CV_BEGIN__;
     {
-      CV_ASSERT(img&&(img->depth==IPL_DEPTH_8U)&&(img->nChannels==1));
-      CV_ASSERT(imgOut&&(imgOut->depth==IPL_DEPTH_LABEL)&&(imgOut->nChannels==1));
+      const L maxLabel = numeric_limits<L>::max();
 
-      unsigned int numPixels=0;
+      numPixels=0;
 
       cvSetZero(imgOut);
 
       CvLabel label=0;
       cvReleaseBlobs(blobs);
 
+      // Components are only inserted in blobs once they pass the filter.
+      // Meanwhile they are looked up by label.
+      vector<CvBlob *> components(1, (CvBlob *)NULL);
+
+      // A component larger than the max area is rejected whatever its
+      // shape: its moments stop being accumulated as soon as it gets there.
+      // It is still traced in full, and its bounding box kept, for its
+      // pixels to be cleared.
+      unsigned int areaLimit = ((filter.maxArea)&&(filter.maxArea<numeric_limits<unsigned int>::max())) ? filter.maxArea+1 : numeric_limits<unsigned int>::max();
+
       unsigned int stepIn = img->widthStep / (img->depth / 8);
       unsigned int stepOut = imgOut->widthStep / (imgOut->depth / 8);
       unsigned int imgIn_width = img->width;
@@ -81,7 +136,7 @@ namespace cvb
       }
 
       unsigned char *imgDataIn = (unsigned char *)img->imageData + imgIn_offset;
-      CvLabel *imgDataOut = (CvLabel *)imgOut->imageData + imgOut_offset;
+      L *imgDataOut = (L *)imgOut->imageData + imgOut_offset;
 
 #define imageIn(X, Y) imgDataIn[(X) + (Y)*stepIn]
 #define imageOut(X, Y) imgDataOut[(X) + (Y)*stepOut]
@@ -103,14 +158,18 @@ namespace cvb
 
 	      // Label contour.
 	      label++;
-	      CV_ASSERT(label!=CV_BLOB_MAX_LABEL);
+	      if (label==maxLabel)
+	      {
+		for (CvLabel l=1; l<label; l++)
+		  cvReleaseBlob(components[l]);
+		return false;
+	      }
 
 	      imageOut(x, y) = label;
-	      numPixels++;
 
 	      // XXX This is not necessary at all. I only do this for consistency.
 	      if (y>0)
-		imageOut(x, y-1) = CV_BLOB_MAX_LABEL;
+		imageOut(x, y-1) = maxLabel;
 
 	      CvBlob *blob = new CvBlob;
 	      blob->label = label;
@@ -121,7 +180,7 @@ namespace cvb
 	      blob->m11=x*y;
 	      blob->m20=x*x; blob->m02=y*y;
 	      blob->internalContours.clear();
-	      blobs.insert(CvLabelBlob(label,blob));
+	      components.push_back(blob);
 
               lastLabel = label;
 	      lastBlob = blob;
@@ -161,7 +220,7 @@ namespace cvb
 		      }
 		      else
 		      {
-			imageOut(nx, ny) = CV_BLOB_MAX_LABEL;
+			imageOut(nx, ny) = maxLabel;
 		      }
 		    }
 		  }
@@ -173,17 +232,19 @@ namespace cvb
 		    if (imageOut(xx, yy) != label)
 		    {
 		      imageOut(xx, yy) = label;
-		      numPixels++;
 
 		      if (xx<blob->minx) blob->minx = xx;
 		      else if (xx>blob->maxx) blob->maxx = xx;
 		      if (yy<blob->miny) blob->miny = yy;
 		      else if (yy>blob->maxy) blob->maxy = yy;
 
-		      blob->area++;
-		      blob->m10+=xx; blob->m01+=yy;
-		      blob->m11+=xx*yy;
-		      blob->m20+=xx*xx; blob->m02+=yy*yy;
+		      if (blob->area<areaLimit)
+		      {
+			blob->area++;
+			blob->m10+=xx; blob->m01+=yy;
+			blob->m11+=xx*yy;
+			blob->m20+=xx*xx; blob->m02+=yy*yy;
+		      }
 		    }
 
 		    break;
@@ -216,20 +277,22 @@ namespace cvb
 		l = imageOut(x-1, y);
 
 		imageOut(x, y) = l;
-		numPixels++;
 
                 if (l==lastLabel)
                   blob = lastBlob;
                 else
                 {
-                  blob = blobs.find(l)->second;
+                  blob = components[l];
                   lastLabel = l;
                   lastBlob = blob;
                 }
-		blob->area++;
-		blob->m10+=x; blob->m01+=y;
-		blob->m11+=x*y;
-		blob->m20+=x*x; blob->m02+=y*y;
+		if (blob->area<areaLimit)
+		{
+		  blob->area++;
+		  blob->m10+=x; blob->m01+=y;
+		  blob->m11+=x*y;
+		  blob->m20+=x*x; blob->m02+=y*y;
+		}
 	      }
 	      else
 	      {
@@ -239,14 +302,14 @@ namespace cvb
                   blob = lastBlob;
                 else
                 {
-                  blob = blobs.find(l)->second;
+                  blob = components[l];
                   lastLabel = l;
                   lastBlob = blob;
                 }
 	      }
 
 	      // XXX This is not necessary (I believe). I only do this for consistency.
-	      imageOut(x, y+1) = CV_BLOB_MAX_LABEL;
+	      imageOut(x, y+1) = maxLabel;
 
 	      CvContourChainCode *contour = new CvContourChainCode;
 	      contour->startingPoint = cvPoint(x, y);
@@ -279,7 +342,7 @@ namespace cvb
 		    }
 		    else
 		    {
-		      imageOut(nx, ny) = CV_BLOB_MAX_LABEL;
+		      imageOut(nx, ny) = maxLabel;
 		    }
 		  }
 
@@ -290,12 +353,14 @@ namespace cvb
 		    if (!imageOut(xx, yy))
 		    {
 		      imageOut(xx, yy) = l;
-		      numPixels++;
 
-		      blob->area++;
-		      blob->m10+=xx; blob->m01+=yy;
-		      blob->m11+=xx*yy;
-		      blob->m20+=xx*xx; blob->m02+=yy*yy;
+		      if (blob->area<areaLimit)
+		      {
+			blob->area++;
+			blob->m10+=xx; blob->m01+=yy;
+			blob->m11+=xx*yy;
+			blob->m20+=xx*xx; blob->m02+=yy*yy;
+		      }
 		    }
 
 		    break;
@@ -304,7 +369,11 @@ namespace cvb
 	      }
 	      while (!(xx==x && yy==y));
 
-	      blob->internalContours.push_back(contour);
+	      // The contour of a rejected component is only traced
+	      if (blob->area<areaLimit)
+		blob->internalContours.push_back(contour);
+	      else
+		delete contour;
 	    }
 
 	    //else if (!imageOut(x, y))
@@ -314,99 +383,413 @@ namespace cvb
 	      CvLabel l = imageOut(x-1, y);
 
 	      imageOut(x, y) = l;
-	      numPixels++;
 
 	      CvBlob *blob = NULL;
               if (l==lastLabel)
                 blob = lastBlob;
               else
               {
-                blob = blobs.find(l)->second;
+                blob = components[l];
                 lastLabel = l;
                 lastBlob = blob;
               }
-	      blob->area++;
-	      blob->m10+=x; blob->m01+=y;
-	      blob->m11+=x*y;
-	      blob->m20+=x*x; blob->m02+=y*y;
+	      if (blob->area<areaLimit)
+	      {
+		blob->area++;
+		blob->m10+=x; blob->m01+=y;
+		blob->m11+=x*y;
+		blob->m20+=x*x; blob->m02+=y*y;
+	      }
 	    }
 	  }
 	}
       }
 
-      for (CvBlobs::iterator it=blobs.begin(); it!=blobs.end(); ++it)
+      if (numComponents)
+	*numComponents = label;
+
+      // Survivors are labeled again from 1, in scan order. Pixels are only
+      // rewritten within the bounding boxes: the ones of rejected components
+      // are cleared, the contour marks are left. In label order, the pixels
+      // holding l are still those of component l, the ones rewritten before
+      // hold lower labels.
+      CvLabel kept=0;
+
+      for (CvLabel l=1; l<=label; l++)
       {
-	cvCentroid((*it).second);
+	CvBlob *blob = components[l];
+	bool accepted = cvLabelFilterAccepts(filter, blob);
 
-        (*it).second->u11 = (*it).second->m11 - ((*it).second->m10*(*it).second->m01)/(*it).second->m00;
-        (*it).second->u20 = (*it).second->m20 - ((*it).second->m10*(*it).second->m10)/(*it).second->m00;
-        (*it).second->u02 = (*it).second->m02 - ((*it).second->m01*(*it).second->m01)/(*it).second->m00;
+	if (accepted)
+	  kept++;
 
-        double m00_2 = (*it).second->m00 * (*it).second->m00;
+	if ((!accepted)||(kept!=l))
+	{
+	  L from = (L)l;
+	  L to = accepted ? (L)kept : 0;
+	  for (unsigned int y=blob->miny; y<=blob->maxy; y++)
+	  {
+	    L *row = &imageOut(0, y);
+	    for (unsigned int x=blob->minx; x<=blob->maxx; x++)
+	      if (row[x]==from)
+		row[x] = to;
+	  }
+	}
 
-        (*it).second->n11 = (*it).second->u11 / m00_2;
-        (*it).second->n20 = (*it).second->u20 / m00_2;
-        (*it).second->n02 = (*it).second->u02 / m00_2;
+	if (!accepted)
+	{
+	  cvReleaseBlob(blob);
+	  continue;
+	}
 
-        (*it).second->p1 = (*it).second->n20 + (*it).second->n02;
+	blob->label = kept;
+	numPixels += blob->area;
 
-        double nn = (*it).second->n20 - (*it).second->n02;
-        (*it).second->p2 = nn*nn + 4.*((*it).second->n11*(*it).second->n11);
+	cvBlobMoments(blob);
+
+	blobs.insert(blobs.end(), CvLabelBlob(kept, blob));
       }
 
-      return numPixels;
+      return true;
 
     }
     __CV_END__;
   }
 
-  void cvFilterLabels(IplImage *imgIn, IplImage *imgOut, const CvBlobs &blobs)
+  IplImage *cvCreateLabelImage16(CvSize size)
   {
-    CV_FUNCNAME("cvFilterLabels");
+    IplImage *img = cvCreateImage(size, IPL_DEPTH_LABEL16, 1);
+    if (img)
+      memcpy(img->colorModel, CV_LABEL16_MODEL, 4);
+    return img;
+  }
+
+  unsigned int cvLabelFiltered (IplImage const *img, IplImage *imgOut, CvBlobs &blobs, CvLabelFilter const &filter, unsigned int *numComponents)
+  {
+    CV_FUNCNAME("cvLabelFiltered");
     __CV_BEGIN__;
     {
-      CV_ASSERT(imgIn&&(imgIn->depth==IPL_DEPTH_LABEL)&&(imgIn->nChannels==1));
-      CV_ASSERT(imgOut&&(imgOut->depth==IPL_DEPTH_8U)&&(imgOut->nChannels==1));
+      CV_ASSERT(img&&(img->depth==IPL_DEPTH_8U)&&(img->nChannels==1));
+      CV_ASSERT(CV_IS_LABEL_IMAGE(imgOut));
+
+      unsigned int numPixels = 0;
+
+      // Too many components for 16 bits: the image belongs to the caller,
+      // who decides whether to label again into a wide one
+      if (imgOut->depth==IPL_DEPTH_LABEL16)
+	return cvLabelImage<CvLabel16>(img, imgOut, blobs, filter, numComponents, numPixels) ? numPixels : CV_LABEL_OVERFLOW;
+
+      bool labeled = cvLabelImage<CvLabel>(img, imgOut, blobs, filter, numComponents, numPixels);
+      CV_ASSERT(labeled);
+
+      return numPixels;
+    }
+    __CV_END__;
+  }
 
-      int stepIn = imgIn->widthStep / (imgIn->depth / 8);
-      int stepOut = imgOut->widthStep / (imgOut->depth / 8);
-      int imgIn_width = imgIn->width;
-      int imgIn_height = imgIn->height;
-      int imgIn_offset = 0;
-      int imgOut_width = imgOut->width;
-      int imgOut_height = imgOut->height;
-      int imgOut_offset = 0;
-      if(imgIn->roi)
+  // Sums of x and x^2 for x in [0, n)
+  static inline unsigned long long cvSum1(unsigned long long n) { return n*(n-1)/2; }
+  static inline unsigned long long cvSum2(unsigned long long n) { return n ? (n-1)*n*(2*n-1)/6 : 0; }
+
+  static inline CvLabel cvFindRoot(vector<CvLabel> &parent, CvLabel l)
+  {
+    while (parent[l]!=l)
+    {
+      parent[l] = parent[parent[l]];
+      l = parent[l];
+    }
+    return l;
+  }
+
+  // Scan order of the first pixels, the order cvLabel numbers components in
+  static bool cvStartsBefore(CvBlob const *a, CvBlob const *b)
+  {
+    CvPoint const &p = a->contour.startingPoint;
+    CvPoint const &q = b->contour.startingPoint;
+    return (p.y<q.y)||((p.y==q.y)&&(p.x<q.x));
+  }
+
+  // Component r is complete: filtered, kept as a blob if it passes
+  static void cvLabelStatsEmit(CvRunStats const &r, CvLabelFilter const &filter, CvLabelStatsBuffers &b)
+  {
+    CvBlob blob;
+    blob.area = r.area;
+    blob.minx = r.minx; blob.maxx = r.maxx;
+    blob.miny = r.miny; blob.maxy = r.maxy;
+    if (!cvLabelFilterAccepts(filter, &blob))
+      return;
+
+    CvBlob *kept = new CvBlob(blob);
+    kept->contour.startingPoint = r.start;
+    kept->m10 = r.m10; kept->m01 = r.m01;
+    kept->m11 = r.m11;
+    kept->m20 = r.m20; kept->m02 = r.m02;
+    b.kept.push_back(kept);
+  }
+
+  // Labels absorbed by another component are free again, the components
+  // without a run in row y (all of them once past the last row) are complete
+  static void cvLabelStatsRetire(CvLabelStatsBuffers &b, CvLabelFilter const &filter, unsigned int y, bool all, unsigned int &found)
+  {
+    unsigned int n = 0;
+    for (unsigned int i=0; i<b.active.size(); i++)
+    {
+      CvLabel l = b.active[i];
+      if ((b.parent[l]==l)&&(!all)&&(b.stats[l].lastRow==y))
       {
-	imgIn_width = imgIn->roi->width;
-	imgIn_height = imgIn->roi->height;
-	imgIn_offset = imgIn->roi->xOffset + (imgIn->roi->yOffset * stepIn);
+	b.active[n++] = l;
+	continue;
       }
-      if(imgOut->roi)
+      if (b.parent[l]==l)
       {
-	imgOut_width = imgOut->roi->width;
-	imgOut_height = imgOut->roi->height;
-	imgOut_offset = imgOut->roi->xOffset + (imgOut->roi->yOffset * stepOut);
+	found++;
+	cvLabelStatsEmit(b.stats[l], filter, b);
+      }
+      b.freeLabels.push_back(l);
+    }
+    b.active.resize(n);
+  }
+
+  unsigned int cvLabelStats (IplImage const *img, CvBlobs &blobs, CvLabelFilter const &filter, unsigned int *numComponents, CvLabelStatsBuffers *buffers)
+  {
+    CV_FUNCNAME("cvLabelStats");
+    __CV_BEGIN__;
+    {
+      CV_ASSERT(img&&(img->depth==IPL_DEPTH_8U)&&(img->nChannels==1));
+
+      cvReleaseBlobs(blobs);
+
+      CvLabelStatsBuffers local;
+      CvLabelStatsBuffers &b = buffers ? *buffers : local;
+
+      unsigned int stepIn = img->widthStep;
+      unsigned int imgIn_width = img->width;
+      unsigned int imgIn_height = img->height;
+      unsigned int imgIn_offset = 0;
+      if(img->roi)
+      {
+	imgIn_width = img->roi->width;
+	imgIn_height = img->roi->height;
+	imgIn_offset = img->roi->xOffset + (img->roi->yOffset * stepIn);
       }
 
-      char *imgDataOut=imgOut->imageData + imgOut_offset;
-      CvLabel *imgDataIn=(CvLabel *)imgIn->imageData + imgIn_offset;
+      unsigned char const *row = (unsigned char const *)img->imageData + imgIn_offset;
+
+      // Provisional labels of the previous and current rows. Runs are
+      // 8-connected to the ones of the previous row they overlap, or touch
+      // diagonally; when two components meet, the one that started first
+      // absorbs the other's moments. Once a row is done, its labels are
+      // the roots, and the labels absorbed or not continued are free again:
+      // there are never more of them than twice the runs of a row.
+      b.rows.assign(2*imgIn_width, 0);
+      CvLabel *prev = &b.rows[0];
+      CvLabel *cur = &b.rows[imgIn_width];
+
+      b.runs.clear();
+      b.parent.resize(1);
+      b.stats.resize(1);
+      b.active.clear();
+      b.freeLabels.clear();
+      b.kept.clear();
+
+      unsigned int found = 0;
 
-      for (unsigned int r=0;r<(unsigned int)imgIn_height;r++,
-	  imgDataIn+=stepIn,imgDataOut+=stepOut)
+      for (unsigned int y=0; y<imgIn_height; y++, row+=stepIn)
       {
-	for (unsigned int c=0;c<(unsigned int)imgIn_width;c++)
+	unsigned int x=0;
+	while (x<imgIn_width)
 	{
-	  if (imgDataIn[c])
+	  if (!row[x])
 	  {
-	    if (blobs.find(imgDataIn[c])==blobs.end()) imgDataOut[c]=0x00;
-	    else imgDataOut[c]=(char)0xff;
+	    cur[x++] = 0;
+	    continue;
 	  }
-	  else
-	    imgDataOut[c]=0x00;
+
+	  unsigned int x0 = x;
+	  while ((x<imgIn_width)&&(row[x]))
+	    x++;
+	  unsigned int x1 = x;
+
+	  CvLabel l = 0;
+	  unsigned int first = (x0>0) ? x0-1 : 0;
+	  unsigned int last = (x1<imgIn_width) ? x1 : imgIn_width-1;
+	  for (unsigned int k=first; k<=last; k++)
+	  {
+	    if (!prev[k])
+	      continue;
+
+	    CvLabel root = cvFindRoot(b.parent, prev[k]);
+	    if (!l)
+	    {
+	      l = root;
+	      continue;
+	    }
+	    if (root==l)
+	      continue;
+
+	    // The component met first in scan order absorbs the other
+	    CvLabel from = root;
+	    if ((b.stats[root].start.y<b.stats[l].start.y)||
+		((b.stats[root].start.y==b.stats[l].start.y)&&(b.stats[root].start.x<b.stats[l].start.x)))
+	    {
+	      from = l;
+	      l = root;
+	    }
+	    CvRunStats const &s = b.stats[from];
+	    CvRunStats &t = b.stats[l];
+	    if (s.minx<t.minx) t.minx = s.minx;
+	    if (s.maxx>t.maxx) t.maxx = s.maxx;
+	    if (s.miny<t.miny) t.miny = s.miny;
+	    if (s.maxy>t.maxy) t.maxy = s.maxy;
+	    t.area += s.area;
+	    t.m10 += s.m10; t.m01 += s.m01;
+	    t.m11 += s.m11;
+	    t.m20 += s.m20; t.m02 += s.m02;
+	    b.parent[from] = l;
+	  }
+
+	  if (!l)
+	  {
+	    if (b.freeLabels.empty())
+	    {
+	      l = b.parent.size();
+	      b.parent.push_back(l);
+	      b.stats.push_back(CvRunStats());
+	    }
+	    else
+	    {
+	      l = b.freeLabels.back();
+	      b.freeLabels.pop_back();
+	      b.parent[l] = l;
+	    }
+	    b.active.push_back(l);
+
+	    CvRunStats &s = b.stats[l];
+	    s.area = 0;
+	    s.minx = x0; s.maxx = x1-1;
+	    s.miny = y; s.maxy = y;
+	    s.start = cvPoint(x0, y);
+	    s.m10 = s.m01 = s.m11 = s.m20 = s.m02 = 0.;
+	  }
+
+	  for (unsigned int k=x0; k<x1; k++)
+	    cur[k] = l;
+	  b.runs.push_back(x0);
+	  b.runs.push_back(x1);
+
+	  // The moments of the run in closed form
+	  unsigned int n = x1-x0;
+	  double sx = (double)(cvSum1(x1)-cvSum1(x0));
+	  double sxx = (double)(cvSum2(x1)-cvSum2(x0));
+
+	  CvRunStats &s = b.stats[l];
+	  if (x0<s.minx) s.minx = x0;
+	  if (x1-1>s.maxx) s.maxx = x1-1;
+	  s.maxy = y;
+	  s.lastRow = y;
+	  s.area += n;
+	  s.m10 += sx; s.m01 += (double)n*y;
+	  s.m11 += sx*y;
+	  s.m20 += sxx; s.m02 += (double)n*y*y;
 	}
+
+	// The row only refers to roots from now on
+	for (unsigned int i=0; i<b.runs.size(); i+=2)
+	{
+	  CvLabel l = cur[b.runs[i]];
+	  CvLabel root = cvFindRoot(b.parent, l);
+	  if (root!=l)
+	    for (unsigned int k=b.runs[i]; k<b.runs[i+1]; k++)
+	      cur[k] = root;
+	}
+	b.runs.clear();
+	cvLabelStatsRetire(b, filter, y, false, found);
+
+	CvLabel *tmp = prev;
+	prev = cur;
+	cur = tmp;
+      }
+      cvLabelStatsRetire(b, filter, imgIn_height, true, found);
+
+      // Labeled in scan order, as cvLabel
+      sort(b.kept.begin(), b.kept.end(), cvStartsBefore);
+
+      unsigned int numPixels = 0;
+      for (unsigned int i=0; i<b.kept.size(); i++)
+      {
+	CvBlob *blob = b.kept[i];
+	blob->label = i+1;
+	cvBlobMoments(blob);
+	numPixels += blob->area;
+
+	blobs.insert(blobs.end(), CvLabelBlob(blob->label, blob));
+      }
+      b.kept.clear();
+
+      if (numComponents)
+	*numComponents = found;
+
+      return numPixels;
+    }
+    __CV_END__;
+  }
+
+  template <typename L>
+  static void cvFilterLabelImage(IplImage *imgIn, IplImage *imgOut, const CvBlobs &blobs)
+  {
+    int stepIn = imgIn->widthStep / (imgIn->depth / 8);
+    int stepOut = imgOut->widthStep / (imgOut->depth / 8);
+    int imgIn_width = imgIn->width;
+    int imgIn_height = imgIn->height;
+    int imgIn_offset = 0;
+    int imgOut_width = imgOut->width;
+    int imgOut_height = imgOut->height;
+    int imgOut_offset = 0;
+    if(imgIn->roi)
+    {
+      imgIn_width = imgIn->roi->width;
+      imgIn_height = imgIn->roi->height;
+      imgIn_offset = imgIn->roi->xOffset + (imgIn->roi->yOffset * stepIn);
+    }
+    if(imgOut->roi)
+    {
+      imgOut_width = imgOut->roi->width;
+      imgOut_height = imgOut->roi->height;
+      imgOut_offset = imgOut->roi->xOffset + (imgOut->roi->yOffset * stepOut);
+    }
+
+    char *imgDataOut=imgOut->imageData + imgOut_offset;
+    L *imgDataIn=(L *)imgIn->imageData + imgIn_offset;
+
+    for (unsigned int r=0;r<(unsigned int)imgIn_height;r++,
+	imgDataIn+=stepIn,imgDataOut+=stepOut)
+    {
+      for (unsigned int c=0;c<(unsigned int)imgIn_width;c++)
+      {
+	if (imgDataIn[c])
+	{
+	  if (blobs.find(imgDataIn[c])==blobs.end()) imgDataOut[c]=0x00;
+	  else imgDataOut[c]=(char)0xff;
+	}
+	else
+	  imgDataOut[c]=0x00;
       }
     }
+  }
+
+  void cvFilterLabels(IplImage *imgIn, IplImage *imgOut, const CvBlobs &blobs)
+  {
+    CV_FUNCNAME("cvFilterLabels");
+    __CV_BEGIN__;
+    {
+      CV_ASSERT(CV_IS_LABEL_IMAGE(imgIn));
+      CV_ASSERT(imgOut&&(imgOut->depth==IPL_DEPTH_8U)&&(imgOut->nChannels==1));
+
+      if (imgIn->depth==IPL_DEPTH_LABEL16)
+	cvFilterLabelImage<CvLabel16>(imgIn, imgOut, blobs);
+      else
+	cvFilterLabelImage<CvLabel>(imgIn, imgOut, blobs);
+    }
     __CV_END__;
   }
 
@@ -416,7 +799,7 @@ namespace cvb
     CV_FUNCNAME("cvGetLabel");
     __CV_BEGIN__;
     {
-      CV_ASSERT(img&&(img->depth==IPL_DEPTH_LABEL)&&(img->nChannels==1));
+      CV_ASSERT(CV_IS_LABEL_IMAGE(img));
 
       int step = img->widthStep / (img->depth / 8);
       int img_width = 0;
@@ -436,7 +819,14 @@ namespace cvb
 
       CV_ASSERT((x>=0)&&(x<img_width)&&(y>=0)&&(y<img_height));
 
-      return ((CvLabel *)(img->imageData + img_offset))[x + y*step];
+      // The contour marks read the same whatever the depth
+      if (img->depth==IPL_DEPTH_LABEL16)
+      {
+	CvLabel16 l = ((CvLabel16 *)img->imageData + img_offset)[x + y*step];
+	return (l==numeric_limits<CvLabel16>::max()) ? CV_BLOB_MAX_LABEL : l;
+      }
+
+      return ((CvLabel *)img->imageData + img_offset)[x + y*step];
     }
     __CV_END__;
   }
@@ -154,11 +154,34 @@ namespace cvb
     }
   }
 
-  void cvUpdateTracks(CvBlobs const &blobs, CvTracks &tracks, const double thDistance, const unsigned int thInactive, const unsigned int thActive)
+  // Frames since the track was last seen, at least one
+  static unsigned int framesSince(CvTrack const *track, unsigned int sequence)
   {
-    CV_FUNCNAME("cvUpdateTracks");
-    __CV_BEGIN__;
+    unsigned int n = sequence - track->sequence;
+    return ((n==0)||(n>0x7fffffff)) ? 1 : n;
+  }
+
+  // Where an active track should be at timestamp, moving at its velocity
+  static CvTrack predictTrack(CvTrack const *track, unsigned long long timestamp)
+  {
+    CvTrack p = *track;
+    if (track->inactive||(timestamp<=track->timestamp))
+      return p;
+
+    double dt = (timestamp - track->timestamp)*1e-9;
+    double dx = track->velocity.x*dt;
+    double dy = track->velocity.y*dt;
+    p.centroid.x += dx;
+    p.centroid.y += dy;
+    p.minx = (p.minx+dx>0.) ? (unsigned int)(p.minx+dx+.5) : 0;
+    p.maxx = (p.maxx+dx>0.) ? (unsigned int)(p.maxx+dx+.5) : 0;
+    p.miny = (p.miny+dy>0.) ? (unsigned int)(p.miny+dy+.5) : 0;
+    p.maxy = (p.maxy+dy>0.) ? (unsigned int)(p.maxy+dy+.5) : 0;
+    return p;
+  }
 
+  static void updateTracks(CvBlobs const &blobs, CvTracks &tracks, bool timed, unsigned int sequence, unsigned long long timestamp, const double thDistance, const unsigned int thInactive, const unsigned int thActive)
+  {
     unsigned int nBlobs = blobs.size();
     unsigned int nTracks = tracks.size();
 
@@ -188,10 +211,17 @@ namespace cvb
 	  maxTrackID = jt->second->id;
       }
 
+      // Timed, the blobs are matched with where the tracks should be by
+      // now, the frames dropped in between included
+      vector<CvTrack> predicted;
+      if (timed)
+	for (j=0; j<nTracks; j++)
+	  predicted.push_back(predictTrack(T(j), timestamp));
+
       // Proximity matrix calculation and "used blob" list inicialization:
       for (i=0; i<nBlobs; i++)
 	for (j=0; j<nTracks; j++)
-	  if (C(i, j) = (distantBlobTrack(B(i), T(j)) < thDistance))
+	  if (C(i, j) = (distantBlobTrack(B(i), timed ? &predicted[j] : T(j)) < thDistance))
 	  {
 	    AB(i)++;
 	    AT(j)++;
@@ -209,7 +239,7 @@ namespace cvb
 
 	  // Inactive track.
 	  CvTrack *track = T(j);
-	  track->inactive++;
+	  track->inactive = timed ? framesSince(track, sequence) : track->inactive+1;
 	  track->label = 0;
 	}
       }
@@ -238,6 +268,9 @@ namespace cvb
 	  track->lifetime = 0;
 	  track->active = 0;
 	  track->inactive = 0;
+	  track->sequence = sequence;
+	  track->timestamp = timestamp;
+	  track->velocity = cvPoint2D64f(0., 0.);
 	  tracks.insert(CvIDTrack(maxTrackID, track));
 	}
       }
@@ -254,8 +287,8 @@ namespace cvb
 
 	  getClusterForTrack(j, close, nBlobs, nTracks, blobs, tracks, bb, tt);
 
-	  // Select track
-	  CvTrack *track;
+	  // Select track, the first one if all are flat
+	  CvTrack *track = tt.front();
 	  unsigned int area = 0;
 	  for (list<CvTrack*>::const_iterator it=tt.begin(); it!=tt.end(); ++it)
 	  {
@@ -270,7 +303,7 @@ namespace cvb
 	  }
 
 	  // Select blob
-	  CvBlob *blob;
+	  CvBlob *blob = bb.front();
 	  area = 0;
 	  //cout << "Matching blobs: ";
 	  for (list<CvBlob*>::const_iterator it=bb.begin(); it!=bb.end(); ++it)
@@ -289,6 +322,18 @@ namespace cvb
 
 	  // Update track
 	  //cout << "Matching: track=" << track->id << ", blob=" << blob->label << endl;
+	  if (timed)
+	  {
+	    // Real time since the track was last seen, not a frame interval
+	    if (timestamp>track->timestamp)
+	    {
+	      double dt = (timestamp - track->timestamp)*1e-9;
+	      track->velocity.x = (blob->centroid.x - track->centroid.x)/dt;
+	      track->velocity.y = (blob->centroid.y - track->centroid.y)/dt;
+	    }
+	    track->sequence = sequence;
+	    track->timestamp = timestamp;
+	  }
 	  track->label = blob->label;
 	  track->centroid = blob->centroid;
 	  track->minx = blob->minx;
@@ -307,7 +352,7 @@ namespace cvb
 	    if (t!=track)
 	    {
 	      //cout << "Inactive: track=" << t->id << endl;
-	      t->inactive++;
+	      t->inactive = timed ? framesSince(t, sequence) : t->inactive+1;
 	      t->label = 0;
 	    }
 	  }
@@ -336,6 +381,24 @@ namespace cvb
     }
 
     delete[] close;
+  }
+
+  void cvUpdateTracks(CvBlobs const &blobs, CvTracks &tracks, const double thDistance, const unsigned int thInactive, const unsigned int thActive)
+  {
+    CV_FUNCNAME("cvUpdateTracks");
+    __CV_BEGIN__;
+
+    updateTracks(blobs, tracks, false, 0, 0, thDistance, thInactive, thActive);
+
+    __CV_END__;
+  }
+
+  void cvUpdateTracksTimed(CvBlobs const &blobs, CvTracks &tracks, unsigned int sequence, unsigned long long timestamp, const double thDistance, const unsigned int thInactive, const unsigned int thActive)
+  {
+    CV_FUNCNAME("cvUpdateTracksTimed");
+    __CV_BEGIN__;
+
+    updateTracks(blobs, tracks, true, sequence, timestamp, thDistance, thInactive, thActive);
 
     __CV_END__;
   }
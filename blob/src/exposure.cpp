@@ -0,0 +1,127 @@
+#include <iostream>
+using namespace std;
+
+#include "exposure.h"
+
+ExposureControl::ExposureControl(CameraControls &camera, unsigned char threshold, unsigned int minArea, unsigned int period)
+    : camera(camera), threshold(threshold), minArea(minArea), period(period ? period : 1), frames(0), changes(0)
+{
+    for (unsigned int i = 0; i < CAMERA_CONTROL_COUNT; i++)
+        available[i] = false;
+}
+
+bool ExposureControl::start()
+{
+    for (unsigned int i = 0; i < CAMERA_CONTROL_COUNT; i++)
+        available[i] = camera.query(i, ranges[i]) && (ranges[i].maximum > ranges[i].minimum);
+
+    return available[CAMERA_CONTROL_EXPOSURE] || available[CAMERA_CONTROL_GAIN];
+}
+
+bool ExposureControl::due()
+{
+    return (frames++ % period) == 0;
+}
+
+void ExposureControl::update(ExposureStats const &s)
+{
+    unsigned int margin = (255 - threshold) / 4;
+
+    if ((s.background > threshold / 2) ||
+        (s.spots && (s.peak == 255) && (s.spotArea > 2. * minArea)))
+        darker();
+    else if (s.spots && ((s.peak < threshold + margin) || (s.spotArea < 1.25 * minArea)))
+        brighter();
+    else if (!s.spots && (s.peak > threshold))
+        brighter(); // Something above the threshold, too small to be kept
+    else
+        return;
+
+    adjustFrameRate();
+}
+
+int ExposureControl::value(unsigned int control) const
+{
+    return available[control] ? ranges[control].value : -1;
+}
+
+void ExposureControl::print() const
+{
+    static const char *names[CAMERA_CONTROL_COUNT] = { "exposure (us)", "gain", "fps" };
+
+    clog << "camera:";
+    for (unsigned int i = 0; i < CAMERA_CONTROL_COUNT; i++)
+        if (available[i])
+            clog << " " << names[i] << " " << ranges[i].value;
+    clog << ", " << changes << " changes" << endl;
+}
+
+// One step of a control, 1/4 of the exposure or 1/16 of the gain range.
+// Returns false if the control is at its bound.
+bool ExposureControl::step(unsigned int control, bool up)
+{
+    if (!available[control])
+        return false;
+
+    CameraControlRange &r = ranges[control];
+    int unit = (r.step > 0) ? r.step : 1;
+    int delta = (control == CAMERA_CONTROL_EXPOSURE) ? r.value / 4 : (r.maximum - r.minimum) / 16;
+    delta = (delta < unit) ? unit : delta - delta % unit;
+
+    int v = up ? r.value + delta : r.value - delta;
+    if (v > r.maximum) v = r.maximum;
+    if (v < r.minimum) v = r.minimum;
+    if (v == r.value)
+        return false;
+
+    // The camera may round, the value is read back
+    if (!camera.set(control, v))
+    {
+        available[control] = false;
+        return false;
+    }
+    int previous = r.value;
+    if (!camera.query(control, r))
+        r.value = v;
+
+    changes++;
+    return r.value != previous;
+}
+
+void ExposureControl::darker()
+{
+    // Shorter exposure first, the spots get sharper too
+    if (!step(CAMERA_CONTROL_EXPOSURE, false))
+        step(CAMERA_CONTROL_GAIN, false);
+}
+
+void ExposureControl::brighter()
+{
+    // Gain first, a longer exposure blurs the strokes
+    if (!step(CAMERA_CONTROL_GAIN, true))
+        step(CAMERA_CONTROL_EXPOSURE, true);
+}
+
+// The highest frame rate whose frame interval holds the exposure
+void ExposureControl::adjustFrameRate()
+{
+    if (!available[CAMERA_CONTROL_FRAME_RATE] || !available[CAMERA_CONTROL_EXPOSURE])
+        return;
+
+    CameraControlRange &r = ranges[CAMERA_CONTROL_FRAME_RATE];
+    int exposure = ranges[CAMERA_CONTROL_EXPOSURE].value;
+    int fps = (exposure > 0) ? 1000000 / exposure : r.maximum;
+    if (fps > r.maximum) fps = r.maximum;
+    if (fps < r.minimum) fps = r.minimum;
+    if (fps == r.value)
+        return;
+
+    if (!camera.set(CAMERA_CONTROL_FRAME_RATE, fps))
+    {
+        available[CAMERA_CONTROL_FRAME_RATE] = false;
+        return;
+    }
+    if (!camera.query(CAMERA_CONTROL_FRAME_RATE, r))
+        r.value = fps;
+    changes++;
+}
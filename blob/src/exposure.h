@@ -0,0 +1,110 @@
+/// \file exposure.h
+/// \brief Camera exposure, gain and frame rate driven by the spots seen.
+///
+/// A short exposure gives small, sharp stylus spots and little ambient IR,
+/// and lets the camera run at its highest frame rate: both the labeling work
+/// and the motion blur go down. Too short, and the spots fade below the
+/// threshold or under the area filter. Once every period frames, the loop
+/// looks at the brightest sample (the spot peak), the mean level (the
+/// background) and the mean area of the blobs kept, and steps the camera
+/// towards the shortest exposure that still gives well lit spots:
+///  - background above half the threshold, or saturated spots larger than
+///    twice the minimum area: darker, exposure first, then gain;
+///  - spot peak close to the threshold, spots smaller than 1.25 times the
+///    minimum area, or samples above the threshold but no spot kept:
+///    brighter, gain first, then exposure;
+///  - otherwise the settings are kept.
+/// The frame rate is then set to the highest one whose frame interval still
+/// holds the exposure.
+///
+/// The camera is reached through CameraControls, implemented by V4l2Capture
+/// and easily replaced by a model of the camera.
+
+#ifndef EXPOSURE_H
+#define EXPOSURE_H
+
+#define CAMERA_CONTROL_EXPOSURE   0 ///< Exposure time, microseconds.
+#define CAMERA_CONTROL_GAIN       1 ///< Analog gain, device units.
+#define CAMERA_CONTROL_FRAME_RATE 2 ///< Frames per second.
+#define CAMERA_CONTROL_COUNT      3
+
+/// \brief Range and value of a camera control.
+struct CameraControlRange
+{
+    int minimum;
+    int maximum;
+    int step;
+    int value; ///< Current value.
+};
+
+/// \brief Camera settings the exposure loop acts on.
+class CameraControls
+{
+public:
+    virtual ~CameraControls() {}
+
+    /// \brief Range and current value of a control (CAMERA_CONTROL_...).
+    /// \return false if the camera does not have the control.
+    virtual bool query(unsigned int control, CameraControlRange &range) = 0;
+
+    /// \brief Set a control, automatic modes overriding it are turned off.
+    /// The camera may round the value, see query().
+    /// \return false if the camera refused the value.
+    virtual bool set(unsigned int control, int value) = 0;
+};
+
+/// \brief Levels and blobs of a frame, see ExposureControl::update().
+struct ExposureStats
+{
+    unsigned char peak;       ///< Brightest sample.
+    unsigned char background; ///< Mean level.
+    unsigned int spots;       ///< Blobs kept.
+    double spotArea;          ///< Mean area of the blobs kept, pixels.
+};
+
+/// \brief Exposure control loop. Not thread safe, meant for the vision thread.
+class ExposureControl
+{
+public:
+    /// \param camera Camera to drive.
+    /// \param threshold Luminance threshold of the labeling.
+    /// \param minArea Minimum blob area of the labeling.
+    /// \param period Frames between two steps, so that a setting is seen before the next one.
+    ExposureControl(CameraControls &camera, unsigned char threshold, unsigned int minArea, unsigned int period=8);
+
+    /// \brief Read the camera ranges.
+    /// \return false if the camera has neither exposure nor gain control.
+    bool start();
+
+    /// \brief Whether the frame to come is due for update(). Counts the frames.
+    bool due();
+
+    /// \brief Step the camera settings from the stats of a frame.
+    void update(ExposureStats const &s);
+
+    /// \brief Current setting of a control (CAMERA_CONTROL_...), -1 if not available.
+    int value(unsigned int control) const;
+
+    /// \brief Print the settings to the log.
+    void print() const;
+
+private:
+    bool step(unsigned int control, bool up);
+    void darker();
+    void brighter();
+    void adjustFrameRate();
+
+    CameraControls &camera;
+    unsigned char threshold;
+    unsigned int minArea;
+    unsigned int period;
+    unsigned int frames;
+    bool available[CAMERA_CONTROL_COUNT];
+    CameraControlRange ranges[CAMERA_CONTROL_COUNT];
+    unsigned long long changes;
+
+    ExposureControl(ExposureControl const &);
+    ExposureControl &operator=(ExposureControl const &);
+};
+
+#endif
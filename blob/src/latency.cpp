@@ -0,0 +1,306 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+using namespace std;
+
+#include "latency.h"
+#include "pipeline.h"
+
+LatencyHistogram::LatencyHistogram()
+    : total(0), sumNs(0), maxNs(0)
+{
+    memset(counts, 0, sizeof(counts));
+}
+
+// Values below 2^subBits have a bucket each, then every power of two has
+// 2^subBits buckets: the top bits of the value after the leading one.
+unsigned int LatencyHistogram::bucket(unsigned long long ns)
+{
+    if (ns < (1ULL << subBits))
+        return (unsigned int)ns;
+
+    unsigned int msb = 63 - __builtin_clzll(ns);
+    unsigned int sub = (unsigned int)(ns >> (msb - subBits)) & ((1 << subBits) - 1);
+    return ((msb - subBits + 1) << subBits) + sub;
+}
+
+unsigned long long LatencyHistogram::upperBound(unsigned int i)
+{
+    if (i < (1U << subBits))
+        return i;
+
+    unsigned int msb = (i >> subBits) + subBits - 1;
+    unsigned long long sub = i & ((1 << subBits) - 1);
+    return ((((1ULL << subBits) + sub + 1) << (msb - subBits)) - 1);
+}
+
+// Single writer: plain read-modify-write, stores visible to the readers
+void LatencyHistogram::add(unsigned long long ns)
+{
+    unsigned int i = bucket(ns);
+    __atomic_store_n(&counts[i], counts[i] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&total, total + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&sumNs, sumNs + ns, __ATOMIC_RELAXED);
+    if (ns > maxNs)
+        __atomic_store_n(&maxNs, ns, __ATOMIC_RELAXED);
+}
+
+void LatencyHistogram::merge(LatencyHistogram const &h)
+{
+    for (unsigned int i = 0; i < nBuckets; i++)
+        counts[i] += __atomic_load_n(&h.counts[i], __ATOMIC_RELAXED);
+    total += h.count();
+    sumNs += h.sum();
+    if (h.max() > maxNs)
+        maxNs = h.max();
+}
+
+unsigned long long LatencyHistogram::countBelow(unsigned long long ns) const
+{
+    unsigned long long n = 0;
+    for (unsigned int i = 0; (i < nBuckets) && (upperBound(i) <= ns); i++)
+        n += __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+    return n;
+}
+
+unsigned long long LatencyHistogram::percentile(double p) const
+{
+    if (!total)
+        return 0;
+
+    unsigned long long rank = (unsigned long long)ceil(p * total);
+    if (rank < 1)
+        rank = 1;
+
+    unsigned long long seen = 0;
+    for (unsigned int i = 0; i < nBuckets; i++)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+            return (upperBound(i) < maxNs) ? upperBound(i) : maxNs;
+    }
+
+    return maxNs;
+}
+
+void LatencyHistogram::print(ostream &out) const
+{
+    static const unsigned int width = 50;
+
+    unsigned long long highest = 0;
+    for (unsigned int i = 0; i < nBuckets; i++)
+        if (counts[i] > highest)
+            highest = counts[i];
+
+    char line[128];
+    for (unsigned int i = 0; i < nBuckets; i++)
+    {
+        if (!counts[i])
+            continue;
+
+        unsigned int bar = (unsigned int)((counts[i] * width + highest - 1) / highest);
+        int len = snprintf(line, sizeof(line), "  <= %10.1f us %8llu ", upperBound(i) / 1e3, counts[i]);
+        for (unsigned int k = 0; (k < bar) && (len + 1 < (int)sizeof(line)); k++)
+            line[len++] = '#';
+        line[len] = 0;
+        out << line << endl;
+    }
+}
+
+LatencyRecorder::LatencyRecorder()
+{
+    memset(glass, 0, sizeof(glass));
+    for (unsigned int i = 0; i < nSent; i++)
+        glassSeq[i] = ~0U;
+}
+
+void LatencyRecorder::record(unsigned long long const *probe)
+{
+    unsigned long long t0 = probe[LATENCY_GLASS];
+
+    for (unsigned int i = LATENCY_CAPTURE; i < LATENCY_EVENT; i++)
+        if (probe[i] && (probe[i] >= t0))
+            points[i].add(probe[i] - t0);
+}
+
+void LatencyRecorder::sent(unsigned int seq, unsigned long long t0)
+{
+    // The slot is invalidated while it is written, the reader checks the
+    // sequence number on both sides of the read
+    unsigned int i = seq % nSent;
+    __atomic_store_n(&glassSeq[i], ~0U, __ATOMIC_RELEASE);
+    __atomic_store_n(&glass[i], t0, __ATOMIC_RELEASE);
+    __atomic_store_n(&glassSeq[i], seq, __ATOMIC_RELEASE);
+}
+
+void LatencyRecorder::received(unsigned int seq, unsigned long long ns)
+{
+    unsigned int i = seq % nSent;
+    if (__atomic_load_n(&glassSeq[i], __ATOMIC_ACQUIRE) != seq)
+        return;
+    unsigned long long t0 = __atomic_load_n(&glass[i], __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&glassSeq[i], __ATOMIC_ACQUIRE) != seq)
+        return;
+
+    if (ns >= t0)
+        points[LATENCY_EVENT].add(ns - t0);
+}
+
+void LatencyRecorder::print() const
+{
+    static const char *names[LATENCY_POINT_COUNT] = { "glass", "capture", "infrared", "label", "track", "map", "output", "event" };
+
+    char line[128];
+    snprintf(line, sizeof(line), "%-16s %10s %10s %10s %10s %8s", "latency (us)", "p50", "p90", "p99", "max", "count");
+    clog << line << endl;
+
+    unsigned int last = 0;
+    for (unsigned int i = LATENCY_CAPTURE; i < LATENCY_POINT_COUNT; i++)
+    {
+        LatencyHistogram const &h = points[i];
+        if (!h.count())
+            continue;
+        last = i;
+
+        snprintf(line, sizeof(line), "glass to %-7s %10.1f %10.1f %10.1f %10.1f %8llu", names[i],
+                 h.percentile(.50) / 1e3, h.percentile(.90) / 1e3, h.percentile(.99) / 1e3, h.max() / 1e3, h.count());
+        clog << line << endl;
+    }
+
+    if (last)
+    {
+        clog << "glass to " << names[last] << ":" << endl;
+        points[last].print(clog);
+    }
+}
+
+LatencyLoopback::LatencyLoopback(LatencyRecorder &recorder, SyntheticSource const *truth)
+    : recorder(recorder), truth(truth), fd(-1), running(0), lines(0), matched(0), missed(0)
+{
+    memset(&addr, 0, sizeof(addr));
+}
+
+LatencyLoopback::~LatencyLoopback()
+{
+    stop();
+}
+
+bool LatencyLoopback::start(const char *path)
+{
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return false;
+
+    fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd == -1)
+        return false;
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    // A timeout, so that the reader notices stop() once the line is quiet
+    struct timeval tv = { 0, 100000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&thread, NULL, entry, this) != 0)
+    {
+        running = 0;
+        close(fd);
+        fd = -1;
+        unlink(addr.sun_path);
+        return false;
+    }
+
+    return true;
+}
+
+void LatencyLoopback::stop()
+{
+    if (fd == -1)
+        return;
+
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+
+    close(fd);
+    fd = -1;
+    unlink(addr.sun_path);
+}
+
+void LatencyLoopback::printCheck() const
+{
+    clog << "loopback: " << lines << " lines, pointers " << matched << " matched, " << missed << " missed" << endl;
+}
+
+void *LatencyLoopback::entry(void *self)
+{
+    ((LatencyLoopback *)self)->loop();
+    return NULL;
+}
+
+void LatencyLoopback::loop()
+{
+    char buffer[1024];
+
+    for (;;)
+    {
+        ssize_t n = recv(fd, buffer, sizeof(buffer) - 1, 0);
+        unsigned long long now = pipelineNow();
+
+        if (n <= 0)
+        {
+            // Quiet: done if stopped, lines in flight were read
+            if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+                break;
+            continue;
+        }
+        buffer[n] = 0;
+
+        unsigned int seq, count;
+        int len;
+        if (sscanf(buffer, "%u %u%n", &seq, &count, &len) != 2)
+            continue;
+
+        lines++;
+        recorder.received(seq, now);
+
+        if (truth && count)
+            check(seq, buffer + len);
+    }
+}
+
+// Every published pointer should be on a spot of the frame
+void LatencyLoopback::check(unsigned int seq, char const *pointers)
+{
+    truth->spots(seq, expected);
+
+    unsigned int id, area;
+    double x, y;
+    int len;
+    while (sscanf(pointers, "%u %lf %lf %u%n", &id, &x, &y, &area, &len) == 4)
+    {
+        pointers += len;
+
+        bool found = false;
+        for (unsigned int k = 0; (k < expected.size()) && !found; k++)
+            found = (hypot(x - expected[k].x, y - expected[k].y) <= 1.);
+
+        if (found)
+            matched++;
+        else
+            missed++;
+    }
+}
@@ -0,0 +1,142 @@
+/// \file latency.h
+/// \brief Motion to pointer latency measurement.
+///
+/// Frames are stamped at fixed probe points on their way through the
+/// pipeline, from the sensor (the source buffer timestamp, the driver's one
+/// for V4L2) to the coordinates output. The latencies from the sensor to
+/// every point are accumulated in histograms. A loopback reader receives the
+/// published coordinates as a client would, which gives the glass to event
+/// latency without hardware when the frames are synthetic.
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <ostream>
+#include <pthread.h>
+#include <sys/un.h>
+
+#include "source.h"
+
+#define LATENCY_GLASS    0 ///< Exposure: source buffer timestamp.
+#define LATENCY_CAPTURE  1 ///< Frame grabbed.
+#define LATENCY_INFRARED 2 ///< IR plane extracted.
+#define LATENCY_LABEL    3 ///< cvLabel done.
+#define LATENCY_TRACK    4 ///< cvUpdateTracks done.
+#define LATENCY_MAP      5 ///< Output coordinates ready.
+#define LATENCY_OUTPUT   6 ///< Coordinates published or rendered.
+#define LATENCY_EVENT    7 ///< Coordinates received by the loopback reader.
+#define LATENCY_POINT_COUNT 8
+
+/// \brief Log-linear latency histogram, in nanoseconds.
+/// Each power of two is split in 8 buckets, so values are known within 12.5%.
+/// There must be a single writer, other threads may read (relaxed, the
+/// counts of a snapshot are approximate) or merge() it meanwhile.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    /// \brief Account one sample.
+    void add(unsigned long long ns);
+
+    /// \brief Add the samples of h.
+    void merge(LatencyHistogram const &h);
+
+    unsigned long long count() const { return __atomic_load_n(&total, __ATOMIC_RELAXED); }
+    unsigned long long max() const { return __atomic_load_n(&maxNs, __ATOMIC_RELAXED); }
+    unsigned long long sum() const { return __atomic_load_n(&sumNs, __ATOMIC_RELAXED); }
+
+    /// \brief Number of samples of at most ns, within the bucket precision.
+    unsigned long long countBelow(unsigned long long ns) const;
+
+    /// \brief Upper bound of the bucket holding the p quantile (0 <= p <= 1).
+    unsigned long long percentile(double p) const;
+
+    /// \brief Print the non empty buckets, one per line, in microseconds.
+    void print(std::ostream &out) const;
+
+private:
+    static const unsigned int subBits = 3;
+    static const unsigned int nBuckets = (64 - subBits + 1) << subBits;
+
+    static unsigned int bucket(unsigned long long ns);
+    static unsigned long long upperBound(unsigned int i);
+
+    unsigned long long counts[nBuckets];
+    unsigned long long total;
+    unsigned long long sumNs;
+    unsigned long long maxNs;
+};
+
+/// \brief Latencies from the sensor to each probe point.
+class LatencyRecorder
+{
+public:
+    LatencyRecorder();
+
+    /// \brief Account the probes of an output frame (see LATENCY_GLASS...).
+    /// Zero probes are skipped. Display thread.
+    void record(unsigned long long const *probe);
+
+    /// \brief The coordinates of frame seq, whose exposure was at glass, are
+    /// about to be published. Display thread.
+    void sent(unsigned int seq, unsigned long long glass);
+
+    /// \brief The coordinates of frame seq were received at ns. Loopback thread.
+    void received(unsigned int seq, unsigned long long ns);
+
+    /// \brief Print the latency percentiles of every probe point, and the
+    /// histogram of the last one, to the log.
+    void print() const;
+
+private:
+    // Frames in flight between sent() and received()
+    static const unsigned int nSent = 256;
+
+    LatencyHistogram points[LATENCY_POINT_COUNT];
+    unsigned long long glass[nSent];
+    unsigned int glassSeq[nSent];
+};
+
+/// \brief Loopback client of the Publisher socket.
+/// Received lines are timestamped and matched with the frames sent; with
+/// the synthetic source, the pointers are checked against the spots rendered.
+class LatencyLoopback
+{
+public:
+    /// \param recorder Gets the received events.
+    /// \param truth Synthetic source the frames come from, or NULL.
+    LatencyLoopback(LatencyRecorder &recorder, SyntheticSource const *truth);
+    ~LatencyLoopback();
+
+    /// \brief Bind the socket at path and start reading.
+    /// \return false if the socket cannot be bound.
+    bool start(const char *path);
+
+    /// \brief Read what is still in flight, then stop.
+    void stop();
+
+    /// \brief Print the pointer check to the log.
+    void printCheck() const;
+
+private:
+    static void *entry(void *self);
+    void loop();
+    void check(unsigned int seq, char const *pointers);
+
+    LatencyRecorder &recorder;
+    SyntheticSource const *truth;
+    int fd;
+    int running;
+    pthread_t thread;
+    struct sockaddr_un addr;
+    std::vector<CvPoint2D64f> expected;
+    unsigned long long lines;
+    unsigned long long matched;
+    unsigned long long missed;
+
+    LatencyLoopback(LatencyLoopback const &);
+    LatencyLoopback &operator=(LatencyLoopback const &);
+};
+
+#endif
@@ -1,89 +1,840 @@
-#include <iostream>
-using namespace std;
-
-// Blob manager lib
-#include "cvblob.h"
-using namespace cvb;
-
-// OpenCV lib
-#if (defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__) || defined(__WINDOWS__) || (defined(__APPLE__) & defined(__MACH__)))
-#include <opencv2\highgui\highgui_c.h>
-#include <opencv2\imgproc\types_c.h>
-#include <opencv2\imgproc\imgproc_c.h>
-#else
-#include <opencv2/highgui/highgui_c.h>
-#include <opencv2/imgproc/types_c.h>
-#include <opencv2/imgproc/imgproc_c.h>
-#endif
-
-int main(int argc, char *argv[])
-{
-    IplImage *image, *frame = 0;
-    CvTracks tracks;
-    char key;
-
-    // Open webcam flux
-    CvCapture *capture;
-    capture = cvCreateCameraCapture( CV_CAP_ANY );
-    double test = cvGetCaptureProperty(capture, CV_CAP_PROP_FORMAT );
-
-    if (!capture)
-        printf("Ouverture du flux vido impossible !\n");
-
-    // Create window for display
-    cvNamedWindow("IRStylus Window", CV_WINDOW_AUTOSIZE);
-
-    // Loop for webcam flux
-    while(key != 'q' && key != 'Q')
-    {
-        // Get image from webcam flux
-        image = cvQueryFrame(capture);
-
-        // If not already done, create result image to filter and display
-        if( !frame )
-            frame = cvCreateImage(cvGetSize(image), image->depth, image->nChannels);
-        cvResetImageROI(frame);
-        cvConvertScale(image, frame); // Nota: this method can scale and shift values if neccessary
-
-        // Get specific channels
-        IplImage *chB=cvCreateImage(cvGetSize(frame),8,1);
-        IplImage *chV=cvCreateImage(cvGetSize(frame),8,1);
-        IplImage *chR=cvCreateImage(cvGetSize(frame),8,1);
-        cvSplit(frame, chB, chV, chR, 0);
- 
-        IplImage *infraRed = cvCreateImage(cvGetSize(frame),8,1);
-        cvAddWeighted(chB, 0.33f, chV, 0.33f, 0.0f, infraRed);
-        cvAddWeighted(infraRed, 0.33f, chR, 0.33f, 0.0f, infraRed);
-
-        // Detect blobs
-        CvBlobs blobs;
-        IplImage *labelImg = cvCreateImage(cvGetSize(frame), IPL_DEPTH_LABEL, 1);
-        unsigned int result = cvLabel(infraRed, labelImg, blobs);
-
-        // Filter blobs
-        cvFilterByArea(blobs, 500, 2000);
-        cvUpdateTracks(blobs, tracks, 5., 10);
-
-        cvRenderBlobs(labelImg, blobs, frame, frame, CV_BLOB_RENDER_CENTROID|CV_BLOB_RENDER_BOUNDING_BOX);
-        cvRenderTracks(tracks, frame, frame, CV_TRACK_RENDER_ID|CV_TRACK_RENDER_BOUNDING_BOX|CV_TRACK_RENDER_TO_LOG);
-        
-        // Display image
-        cvShowImage("IRStylus Window", frame);
-
-        // Release objects
-        cvReleaseBlobs(blobs);
-        cvReleaseImage(&chB);
-        cvReleaseImage(&chV);
-        cvReleaseImage(&chR);
-        cvReleaseImage(&labelImg);
-        cvReleaseImage(&infraRed);
-
-        // Wait for 10ms
-        key = cvWaitKey(10);
-
-    }
-
-    // Release capture and close window
-    cvReleaseCapture(&capture);
-	cvDestroyWindow("IRStylus Window");
-}
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <unistd.h>
+using namespace std;
+
+// Blob manager lib
+#include "cvblob.h"
+using namespace cvb;
+
+// Capture / vision / display threads
+#include "pipeline.h"
+
+// Coordinates output
+#include "publish.h"
+
+// Direct V4L2 capture
+#include "v4l2cap.h"
+
+// Replay and synthetic frames
+#include "source.h"
+
+// Latency probes
+#include "latency.h"
+
+// Counters, served as text
+#include "metrics.h"
+
+// Heap allocations of the stages
+#include "allocations.h"
+
+// Camera exposure loop
+#include "exposure.h"
+
+// Several cameras, one board
+#include "multicam.h"
+
+// OpenCV lib
+#if (defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__) || defined(__WINDOWS__) || (defined(__APPLE__) & defined(__MACH__)))
+#include <opencv2\highgui\highgui_c.h>
+#include <opencv2\imgproc\types_c.h>
+#include <opencv2\imgproc\imgproc_c.h>
+#else
+#ifndef HEADLESS
+#include <opencv2/highgui/highgui_c.h>
+#endif
+#include <opencv2/imgproc/types_c.h>
+#include <opencv2/imgproc/imgproc_c.h>
+#endif
+
+// Frame limit, tracking, latency probes and counters, shared by the single
+// and the multi-camera stages. With a synthetic source, the blobs of every
+// frame are checked against the spots they were rendered from: each spot
+// once, none twice.
+class StylusStages : public PipelineStages
+{
+public:
+    StylusStages(SyntheticSource *truth, unsigned int frames, LatencyRecorder *latency, MetricsRegistry *metrics)
+        : truth(truth), latency(latency), metrics(metrics), frames(frames), grabbed(0), lastTrackId(0), checked(0), missed(0), duplicates(0), maxError(0.)
+    {
+    }
+
+    ~StylusStages()
+    {
+        cvReleaseTracks(tracks);
+    }
+
+    // Synthetic source only, once the pipeline is stopped
+    void printCheck() const
+    {
+        clog << "centroids: " << checked << " checked, " << missed << " missed, " << duplicates << " duplicates, max error " << maxError << " px" << endl;
+    }
+
+    // Synthetic source only: no spot missed or found twice
+    bool checkPassed() const
+    {
+        return !missed && !duplicates;
+    }
+
+protected:
+    // Capture thread: false once the frame limit is reached
+    bool grab()
+    {
+        if (frames && (grabbed == frames))
+            return false;
+        grabbed++;
+        return true;
+    }
+
+    // Vision thread: tracking, timed by the exposure
+    void track(PipelineFrame &f, unsigned long long time)
+    {
+        // Frames dropped by the source or the pipeline show in the sequence
+        unsigned int nTracks = tracks.size();
+        cvUpdateTracksTimed(f.blobs, tracks, f.buffer.sequence, time, 5., 10);
+        stamp(f, LATENCY_TRACK);
+
+        // Track ids only grow: the new ones are above the last seen
+        if (metrics)
+        {
+            unsigned int created = 0;
+            for (CvTracks::const_iterator it = tracks.begin(); it != tracks.end(); ++it)
+                if (it->first > lastTrackId)
+                {
+                    created++;
+                    lastTrackId = it->first;
+                }
+            count(PIPELINE_STAGE_VISION, METRICS_TRACKS_CREATED, created);
+            count(PIPELINE_STAGE_VISION, METRICS_TRACKS_EXPIRED, nTracks + created - tracks.size());
+        }
+
+        // The tracks keep changing, the display thread gets a copy
+        f.tracks.clear();
+        for (CvTracks::const_iterator it = tracks.begin(); it != tracks.end(); ++it)
+            f.tracks.push_back(*it->second);
+        stamp(f, LATENCY_MAP);
+    }
+
+    void stamp(PipelineFrame &f, unsigned int point)
+    {
+        if (latency)
+            f.probe[point] = pipelineNow();
+    }
+
+    void count(unsigned int shard, unsigned int counter, unsigned long long n=1)
+    {
+        if (metrics)
+            metrics->add(shard, counter, n);
+    }
+
+    // Match the blobs of a synthetic frame with the rendered spots
+    void check(PipelineFrame const &f)
+    {
+        truth->spots(f.buffer.sequence, expected);
+
+        for (unsigned int k = 0; k < expected.size(); k++)
+        {
+            double best = -1.;
+            for (CvBlobs::const_iterator it = f.blobs.begin(); it != f.blobs.end(); ++it)
+            {
+                double d = hypot(it->second->centroid.x - expected[k].x, it->second->centroid.y - expected[k].y);
+                if ((best < 0.) || (d < best))
+                    best = d;
+            }
+
+            if ((best < 0.) || (best > 1.))
+                missed++;
+            else
+            {
+                checked++;
+                if (best > maxError)
+                    maxError = best;
+            }
+        }
+
+        if (f.blobs.size() > expected.size())
+            duplicates += f.blobs.size() - expected.size();
+    }
+
+    SyntheticSource *truth;
+    LatencyRecorder *latency;
+    MetricsRegistry *metrics;
+
+private:
+    unsigned int frames;
+    unsigned int grabbed;
+    CvTracks tracks;
+    CvID lastTrackId;
+    std::vector<CvPoint2D64f> expected;
+    unsigned long long checked;
+    unsigned long long missed;
+    unsigned long long duplicates;
+    double maxError;
+};
+
+// IR stylus detection, split over the pipeline stages.
+// Frames come from a FrameSource: a camera (HighGUI or V4L2), a replayed
+// recording, or the synthetic generator. With a publisher the display stage
+// only outputs coordinates (headless), otherwise it renders blobs and tracks
+// in a HighGUI window. Building with HEADLESS defined compiles the HighGUI
+// code out. With the synthetic source, every blob is checked against the
+// spot it was rendered from. With a latency recorder, frames are stamped at
+// every probe point. With a metrics registry, the vision stage counts blobs,
+// tracks and allocations. Headless, the frames without any bright pixel on
+// one of every idleRows rows are not labeled at all. With an exposure loop,
+// the levels and blobs of one frame in a period drive the camera settings.
+class IrStylusStages : public StylusStages
+{
+public:
+    IrStylusStages(FrameSource *source, unsigned char threshold, bool weighted, unsigned int idleRows, Publisher *publisher, SyntheticSource *truth, unsigned int frames, LatencyRecorder *latency, MetricsRegistry *metrics)
+        : StylusStages(truth, frames, latency, metrics), source(source), threshold(threshold), weighted(weighted), idleRows(idleRows), grayscale(NULL), exposure(NULL), publisher(publisher)
+    {
+#ifndef HEADLESS
+        if (!publisher)
+            cvNamedWindow("IRStylus Window", CV_WINDOW_AUTOSIZE);
+#endif
+    }
+
+    ~IrStylusStages()
+    {
+        if (grayscale)
+            cvReleaseImage(&grayscale);
+#ifndef HEADLESS
+        if (!publisher)
+            cvDestroyWindow("IRStylus Window");
+#endif
+    }
+
+    // Capture thread
+    bool capture(PipelineFrame &f)
+    {
+        if (!grab() || !source->grab(f.buffer))
+            return false;
+
+        // The exposure is the buffer timestamp, if the source has one
+        if (latency)
+        {
+            unsigned long long now = pipelineNow();
+            unsigned long long glass = bufferTime(f.buffer);
+            f.probe[LATENCY_GLASS] = (glass && (glass <= now)) ? glass : now;
+            f.probe[LATENCY_CAPTURE] = now;
+        }
+        return true;
+    }
+
+    // Vision thread
+    void process(PipelineFrame &f)
+    {
+        unsigned long long allocated = heapAllocations();
+
+        // Idle board: nothing above the threshold on the rows scanned, the
+        // tracker gets an empty frame. Headless only, the window shows every
+        // frame.
+        if (publisher && idleRows && !source->anyAbove(f.buffer, threshold, idleRows))
+        {
+            cvReleaseBlobs(f.blobs);
+            count(PIPELINE_STAGE_VISION, METRICS_FRAMES_IDLE);
+        }
+        else
+            detect(f);
+
+        if (exposure && exposure->due())
+            control(f);
+
+        // Labeling done, the source can refill the buffer
+        source->release(f.buffer);
+
+        if (truth)
+            check(f);
+
+        track(f, bufferTime(f.buffer));
+
+        count(PIPELINE_STAGE_VISION, METRICS_ALLOCATIONS, heapAllocations() - allocated);
+    }
+
+    // Display thread
+    bool display(PipelineFrame &f)
+    {
+        if (publisher)
+        {
+            if (latency)
+                latency->sent(f.seq, f.probe[LATENCY_GLASS]);
+            publisher->publish(f.seq, f.tracks);
+            stamp(f, LATENCY_OUTPUT);
+            if (latency)
+                latency->record(f.probe);
+            return true;
+        }
+
+#ifdef HEADLESS
+        return false;
+#else
+        IplImage *frame = f.image;
+
+        CvTracks snapshot;
+        for (unsigned int i = 0; i < f.tracks.size(); i++)
+            snapshot.insert(CvIDTrack(f.tracks[i].id, &f.tracks[i]));
+
+        cvRenderBlobs(f.labelImg, f.blobs, frame, frame, CV_BLOB_RENDER_CENTROID|CV_BLOB_RENDER_BOUNDING_BOX);
+        cvRenderTracks(snapshot, frame, frame, CV_TRACK_RENDER_ID|CV_TRACK_RENDER_BOUNDING_BOX|CV_TRACK_RENDER_TO_LOG);
+
+        // Display image
+        cvShowImage("IRStylus Window", frame);
+        stamp(f, LATENCY_OUTPUT);
+        if (latency)
+            latency->record(f.probe);
+
+        // Only pump the events, frames pace the loop
+        char key = cvWaitKey(1);
+        return (key != 'q' && key != 'Q');
+#endif
+    }
+
+    // Vision or display thread
+    void drop(PipelineFrame &f)
+    {
+        source->release(f.buffer);
+    }
+
+    // Before the pipeline runs
+    void setExposure(ExposureControl *e)
+    {
+        exposure = e;
+    }
+
+private:
+    // Vision thread: IR plane, labeling, centroids
+    void detect(PipelineFrame &f)
+    {
+        if (!f.infraRed)
+            f.infraRed = cvCreateImage(source->size(), IPL_DEPTH_8U, 1);
+        IplImage *infraRed = source->luminance(f.buffer, threshold, f.infraRed);
+        stamp(f, LATENCY_INFRARED);
+
+        // Detect blobs, the ones out of the area range are dropped meanwhile.
+        // Headless without weighted centroids, only the moments are used.
+        unsigned int nComponents = 0;
+        if (publisher && !weighted)
+            cvLabelStats(infraRed, f.blobs, cvLabelFilter(500, 2000), &nComponents, &statsBuffers);
+        else
+        {
+            // Compact labels, wide ones from the first frame they overflow
+            if (!f.labelImg)
+                f.labelImg = cvCreateLabelImage16(cvGetSize(infraRed));
+            if (cvLabelFiltered(infraRed, f.labelImg, f.blobs, cvLabelFilter(500, 2000), &nComponents) == CV_LABEL_OVERFLOW)
+            {
+                cvReleaseImage(&f.labelImg);
+                f.labelImg = cvCreateImage(cvGetSize(infraRed), IPL_DEPTH_LABEL, 1);
+                cvLabelFiltered(infraRed, f.labelImg, f.blobs, cvLabelFilter(500, 2000), &nComponents);
+            }
+        }
+        stamp(f, LATENCY_LABEL);
+        count(PIPELINE_STAGE_VISION, METRICS_BLOBS_LABELED, nComponents);
+        count(PIPELINE_STAGE_VISION, METRICS_BLOBS_KEPT, f.blobs.size());
+
+        // The window shows the colour frame, or the luminance
+        if (!publisher)
+        {
+            if (!f.image)
+                f.image = cvCreateImage(cvGetSize(infraRed), IPL_DEPTH_8U, 3);
+            IplImage *colour = source->colour(f.buffer);
+            if (colour)
+                cvCopy(colour, f.image);
+            else
+                cvMerge(infraRed, infraRed, infraRed, NULL, f.image);
+        }
+
+        // Sub-pixel centroids from the intensities, before thresholding
+        if (weighted)
+        {
+            IplImage *gray = infraRed;
+            if (threshold)
+            {
+                if (!grayscale)
+                    grayscale = cvCreateImage(cvGetSize(infraRed), IPL_DEPTH_8U, 1);
+                gray = source->luminance(f.buffer, 0, grayscale);
+            }
+            cvCentroidsWeighted(f.blobs, f.labelImg, gray, threshold);
+        }
+    }
+
+    // Vision thread: exposure loop step, the buffer is still held
+    void control(PipelineFrame const &f)
+    {
+        ExposureStats s;
+        if (!source->levels(f.buffer, 4, s.peak, s.background))
+            return;
+
+        unsigned int area = 0;
+        for (CvBlobs::const_iterator it = f.blobs.begin(); it != f.blobs.end(); ++it)
+            area += it->second->area;
+        s.spots = f.blobs.size();
+        s.spotArea = s.spots ? (double)area / s.spots : 0.;
+
+        exposure->update(s);
+    }
+
+    FrameSource *source;
+    unsigned char threshold;
+    bool weighted;
+    unsigned int idleRows;
+    IplImage *grayscale;
+    CvLabelStatsBuffers statsBuffers;
+    ExposureControl *exposure;
+    Publisher *publisher;
+};
+
+// Several cameras covering one board, headless only (see multicam.h). The
+// camera workers label and map to the screen; the capture stage gathers
+// their blobs and merges the ones seen by two cameras, the vision stage
+// tracks the result. With synthetic cameras, the merged blobs are checked
+// against the spots of the board: each spot once, none twice.
+class MultiCameraStages : public StylusStages
+{
+public:
+    MultiCameraStages(std::vector<CameraWorker *> const &cameras, double mergeDistance, Publisher *publisher, SyntheticSource *truth, unsigned int frames, LatencyRecorder *latency, MetricsRegistry *metrics)
+        : StylusStages(truth, frames, latency, metrics), cameras(cameras), gathered(cameras.size()), mergeDistance(mergeDistance), publisher(publisher)
+    {
+    }
+
+    // Capture thread
+    bool capture(PipelineFrame &f)
+    {
+        if (!grab())
+            return false;
+
+        // The n-th frame of every camera
+        bool more = true;
+        for (unsigned int i = 0; i < cameras.size(); i++)
+        {
+            gathered[i] = cameras[i]->next();
+            more = more && gathered[i];
+        }
+
+        if (more)
+        {
+            // Allocations of the workers, and of the merge
+            unsigned long long nAllocations = heapAllocations();
+            mergeCameraBlobs(gathered, mergeDistance, f.blobs);
+            nAllocations = heapAllocations() - nAllocations;
+            f.buffer.sequence = gathered[0]->sequence;
+
+            // The oldest exposure, and the last camera labeled
+            unsigned int nComponents = 0, nBlobs = 0, nIdle = 0;
+            for (unsigned int i = 0; i < gathered.size(); i++)
+            {
+                nComponents += gathered[i]->components;
+                nBlobs += gathered[i]->blobs.size();
+                nIdle += gathered[i]->idle;
+                nAllocations += gathered[i]->allocations;
+                if (!i || (gathered[i]->glass < f.probe[LATENCY_GLASS]))
+                    f.probe[LATENCY_GLASS] = gathered[i]->glass;
+                if (!i || (gathered[i]->labeled > f.probe[LATENCY_LABEL]))
+                    f.probe[LATENCY_LABEL] = gathered[i]->labeled;
+            }
+            stamp(f, LATENCY_CAPTURE);
+            count(PIPELINE_STAGE_CAPTURE, METRICS_BLOBS_LABELED, nComponents);
+            count(PIPELINE_STAGE_CAPTURE, METRICS_BLOBS_KEPT, nBlobs);
+            count(PIPELINE_STAGE_CAPTURE, METRICS_FRAMES_IDLE, nIdle);
+            count(PIPELINE_STAGE_CAPTURE, METRICS_ALLOCATIONS, nAllocations);
+        }
+
+        for (unsigned int i = 0; i < gathered.size(); i++)
+            if (gathered[i])
+                cameras[i]->recycle(gathered[i]);
+
+        return more;
+    }
+
+    // Vision thread
+    void process(PipelineFrame &f)
+    {
+        unsigned long long allocated = heapAllocations();
+
+        if (truth)
+            check(f);
+
+        // Timed by the oldest exposure of the cameras
+        track(f, f.probe[LATENCY_GLASS]);
+
+        count(PIPELINE_STAGE_VISION, METRICS_ALLOCATIONS, heapAllocations() - allocated);
+    }
+
+    // Display thread
+    bool display(PipelineFrame &f)
+    {
+        if (latency)
+            latency->sent(f.seq, f.probe[LATENCY_GLASS]);
+        publisher->publish(f.seq, f.tracks);
+        stamp(f, LATENCY_OUTPUT);
+        if (latency)
+            latency->record(f.probe);
+        return true;
+    }
+
+private:
+    std::vector<CameraWorker *> cameras;
+    std::vector<CameraFrame *> gathered;
+    double mergeDistance;
+    Publisher *publisher;
+};
+
+// Options:
+//  --stats              print pipeline timings to log
+//  --headless           no window, publish coordinates on stdout
+//  --socket <path>      headless, publish coordinates to a Unix datagram socket
+//  --v4l2 <device>      capture from a V4L2 device (GREY or YUYV)
+//  --file <video>       replay a recorded video
+//  --raw <path>         replay a raw 8 bit gray sequence of --size frames
+//  --synthetic <n>      generate n moving IR spots of --size frames
+//  --size <w>x<h>       raw and synthetic frame size, 640x480 by default
+//  --fps <f>            replay and synthetic frame rate, as fast as possible by default
+//  --frames <n>         stop after n frames
+//  --threshold <n>      label the pixels brighter than n (64 by default for synthetic)
+//  --weighted           intensity weighted, sub-pixel centroids
+//  --no-idle            label every frame, even without any pixel above the threshold
+//  --auto-exposure      V4L2: drive exposure, gain and frame rate from the spots (--threshold 64 by default)
+//  --latency            print latency histograms, from the exposure to every step
+//  --loopback           headless, read the coordinates back to time them (with --latency)
+//  --metrics <where>    serve counters over HTTP, on a local TCP port or a Unix socket path
+//  --camera <device> <h>  headless, add a V4L2 camera and its camera to screen homography
+//                       (9 comma separated values, row major), once per camera
+//  --cameras <n>        with --synthetic, n cameras side by side over one board
+//  --overlap <px>       overlap of the synthetic cameras, 80 by default
+//  --merge <px>         pointers of two cameras closer than px are one, 8 by default
+// With --synthetic, the exit status is 1 if a spot was missed or seen twice.
+int main(int argc, char *argv[])
+{
+    unsigned int statsPeriod = 0;
+#ifdef HEADLESS
+    bool headless = true;
+    const char *device = "/dev/video0";
+#else
+    bool headless = false;
+    const char *device = NULL;
+#endif
+    const char *socketPath = NULL;
+    const char *videoPath = NULL;
+    const char *rawPath = NULL;
+    int nSpots = -1;
+    CvSize size = cvSize(640, 480);
+    double fps = 0.;
+    unsigned int frames = 0;
+    int threshold = -1;
+    bool weighted = false;
+    bool skipIdle = true;
+    bool autoExposure = false;
+    bool measureLatency = false;
+    bool loopback = false;
+    const char *metricsAddress = NULL;
+    vector<const char *> cameraDevices;
+    vector<const char *> cameraHomographies;
+    unsigned int nCameras = 1;
+    int overlap = 80;
+    double mergeDistance = 8.;
+    int status = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--stats"))
+            statsPeriod = 100;
+        else if (!strcmp(argv[i], "--headless"))
+            headless = true;
+        else if (!strcmp(argv[i], "--socket") && (i + 1 < argc))
+        {
+            headless = true;
+            socketPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--v4l2") && (i + 1 < argc))
+            device = argv[++i];
+        else if (!strcmp(argv[i], "--file") && (i + 1 < argc))
+            videoPath = argv[++i];
+        else if (!strcmp(argv[i], "--raw") && (i + 1 < argc))
+            rawPath = argv[++i];
+        else if (!strcmp(argv[i], "--synthetic") && (i + 1 < argc))
+            nSpots = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--size") && (i + 1 < argc))
+            sscanf(argv[++i], "%dx%d", &size.width, &size.height);
+        else if (!strcmp(argv[i], "--fps") && (i + 1 < argc))
+            fps = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && (i + 1 < argc))
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threshold") && (i + 1 < argc))
+            threshold = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--weighted"))
+            weighted = true;
+        else if (!strcmp(argv[i], "--no-idle"))
+            skipIdle = false;
+        else if (!strcmp(argv[i], "--auto-exposure"))
+            autoExposure = true;
+        else if (!strcmp(argv[i], "--latency"))
+            measureLatency = true;
+        else if (!strcmp(argv[i], "--loopback"))
+        {
+            headless = true;
+            measureLatency = true;
+            loopback = true;
+        }
+        else if (!strcmp(argv[i], "--metrics") && (i + 1 < argc))
+            metricsAddress = argv[++i];
+        else if (!strcmp(argv[i], "--camera") && (i + 2 < argc))
+        {
+            headless = true;
+            cameraDevices.push_back(argv[++i]);
+            cameraHomographies.push_back(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--cameras") && (i + 1 < argc))
+            nCameras = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--overlap") && (i + 1 < argc))
+            overlap = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--merge") && (i + 1 < argc))
+            mergeDistance = atof(argv[++i]);
+    }
+
+    // Real cameras are added one by one with --camera
+    if ((nCameras != 1) && (nSpots < 0))
+    {
+        cerr << "--cameras needs --synthetic, use --camera for real cameras" << endl;
+        return -1;
+    }
+
+    // Several cameras only publish
+    if (nCameras > 1)
+        headless = true;
+
+    // The loopback reader binds a socket of its own
+    char loopbackPath[64];
+    if (loopback)
+    {
+        snprintf(loopbackPath, sizeof(loopbackPath), "/tmp/stylusd-loopback-%d", (int)getpid());
+        socketPath = loopbackPath;
+    }
+
+    Publisher publisher;
+    if (headless && !publisher.open(socketPath))
+    {
+        cerr << "cannot open " << socketPath << endl;
+        return -1;
+    }
+
+    // Open the frame source, or the cameras and their homographies
+    FrameSource *source = NULL;
+    SyntheticSource *synthetic = NULL;
+    vector<FrameSource *> cameraSources;
+    vector<double> homographies;
+    V4l2Capture *camera = NULL;
+
+    if (!cameraDevices.empty())
+    {
+        homographies.resize(9 * cameraDevices.size());
+        for (unsigned int i = 0; i < cameraDevices.size(); i++)
+        {
+            if (!parseHomography(cameraHomographies[i], &homographies[9 * i]))
+            {
+                cerr << "bad homography " << cameraHomographies[i] << endl;
+                for (unsigned int k = 0; k < cameraSources.size(); k++)
+                    delete cameraSources[k];
+                return -1;
+            }
+
+            V4l2Capture *v4l2 = new V4l2Capture;
+            cameraSources.push_back(v4l2);
+            if (!v4l2->open(cameraDevices[i]))
+            {
+                cerr << "cannot stream GREY or YUYV from " << cameraDevices[i] << endl;
+                for (unsigned int k = 0; k < cameraSources.size(); k++)
+                    delete cameraSources[k];
+                return -1;
+            }
+        }
+    }
+    else if ((nSpots >= 0) && (nCameras > 1))
+    {
+        // Views side by side, the homographies are translations
+        CvSize board = cvSize(nCameras * size.width - (nCameras - 1) * overlap, size.height);
+        homographies.resize(9 * nCameras);
+        for (unsigned int i = 0; i < nCameras; i++)
+        {
+            SyntheticSource *view = new SyntheticSource(size, nSpots, fps, 8., 32, 1 + i);
+            view->setView(board, cvPoint(i * (size.width - overlap), 0));
+            cameraSources.push_back(view);
+            if (!synthetic)
+                synthetic = view;
+
+            double *h = &homographies[9 * i];
+            h[0] = 1.; h[1] = 0.; h[2] = i * (size.width - overlap);
+            h[3] = 0.; h[4] = 1.; h[5] = 0.;
+            h[6] = 0.; h[7] = 0.; h[8] = 1.;
+        }
+        if (threshold < 0)
+            threshold = 64;
+    }
+    else if (nSpots >= 0)
+    {
+        synthetic = new SyntheticSource(size, nSpots, fps);
+        source = synthetic;
+        if (threshold < 0)
+            threshold = 64;
+    }
+    else if (rawPath)
+    {
+        RawSource *raw = new RawSource(fps);
+        source = raw;
+        if (!raw->open(rawPath, size))
+        {
+            cerr << "cannot replay " << rawPath << endl;
+            delete source;
+            return -1;
+        }
+    }
+#ifndef HEADLESS
+    else if (videoPath)
+    {
+        CvCapture *capture = cvCreateFileCapture(videoPath);
+        if (!capture)
+        {
+            cerr << "cannot replay " << videoPath << endl;
+            return -1;
+        }
+        source = new CaptureSource(capture, fps);
+    }
+#else
+    else if (videoPath)
+    {
+        cerr << "video replay needs HighGUI, use --raw" << endl;
+        return -1;
+    }
+#endif
+    else if (device)
+    {
+        V4l2Capture *v4l2 = new V4l2Capture;
+        source = v4l2;
+        if (!v4l2->open(device))
+        {
+            cerr << "cannot stream GREY or YUYV from " << device << endl;
+            delete source;
+            return -1;
+        }
+        camera = v4l2;
+
+        // The loop needs a threshold to keep the background under
+        if (autoExposure && (threshold < 0))
+            threshold = 64;
+    }
+#ifndef HEADLESS
+    else
+    {
+        // Open webcam flux
+        CvCapture *capture = cvCreateCameraCapture( CV_CAP_ANY );
+
+        if (!capture)
+        {
+            printf("Ouverture du flux vido impossible !\n");
+            return -1;
+        }
+        source = new CaptureSource(capture);
+    }
+#endif
+
+    if (!source && cameraSources.empty())
+    {
+        cerr << "no frame source" << endl;
+        return -1;
+    }
+
+    {
+        LatencyRecorder recorder;
+        LatencyLoopback reader(recorder, synthetic);
+        if (loopback && !reader.start(loopbackPath))
+        {
+            cerr << "cannot bind " << loopbackPath << endl;
+            delete source;
+            for (unsigned int k = 0; k < cameraSources.size(); k++)
+                delete cameraSources[k];
+            return -1;
+        }
+
+        MetricsRegistry registry;
+        MetricsServer server(registry);
+        if (metricsAddress && !server.start(metricsAddress))
+        {
+            cerr << "cannot serve metrics on " << metricsAddress << endl;
+            delete source;
+            for (unsigned int k = 0; k < cameraSources.size(); k++)
+                delete cameraSources[k];
+            return -1;
+        }
+
+        // A stylus spot is much taller than the rows skipped by the idle test
+        unsigned int idleRows = skipIdle ? 4 : 0;
+
+        // One worker per camera
+        vector<CameraWorker *> workers;
+        for (unsigned int i = 0; i < cameraSources.size(); i++)
+            workers.push_back(new CameraWorker(cameraSources[i], &homographies[9 * i], threshold < 0 ? 0 : (unsigned char)threshold, idleRows, cvLabelFilter(500, 2000)));
+
+        IrStylusStages *single = NULL;
+        StylusStages *stages;
+        if (workers.empty())
+            stages = single = new IrStylusStages(source, threshold < 0 ? 0 : (unsigned char)threshold, weighted, idleRows, headless ? &publisher : NULL, synthetic, frames, measureLatency ? &recorder : NULL, metricsAddress ? &registry : NULL);
+        else
+            stages = new MultiCameraStages(workers, mergeDistance, &publisher, synthetic, frames, measureLatency ? &recorder : NULL, metricsAddress ? &registry : NULL);
+        // Single V4L2 camera only
+        ExposureControl *exposure = NULL;
+        if (autoExposure && camera && single)
+        {
+            exposure = new ExposureControl(*camera, (unsigned char)threshold, 500);
+            if (exposure->start())
+                single->setExposure(exposure);
+            else
+            {
+                cerr << "no exposure or gain control on " << device << endl;
+                delete exposure;
+                exposure = NULL;
+            }
+        }
+
+        Pipeline pipeline(*stages, statsPeriod, metricsAddress ? &registry : NULL);
+        registry.setPipeline(&pipeline);
+
+        for (unsigned int i = 0; i < workers.size(); i++)
+            workers[i]->start();
+
+        // Loop for webcam flux
+        pipeline.run();
+        for (unsigned int i = 0; i < workers.size(); i++)
+            workers[i]->stop();
+        reader.stop();
+        server.stop();
+
+        if (statsPeriod)
+            pipeline.printStats();
+        if (synthetic)
+        {
+            stages->printCheck();
+            if (!stages->checkPassed())
+                status = 1;
+        }
+        if (loopback)
+            reader.printCheck();
+        if (measureLatency)
+            recorder.print();
+        if (exposure)
+            exposure->print();
+
+        delete stages;
+        delete exposure;
+        for (unsigned int i = 0; i < workers.size(); i++)
+            delete workers[i];
+    }
+
+    // Release capture and close window
+    delete source;
+    for (unsigned int i = 0; i < cameraSources.size(); i++)
+        delete cameraSources[i];
+
+    return status;
+}
@@ -0,0 +1,239 @@
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+using namespace std;
+
+#include "metrics.h"
+
+MetricsRegistry::MetricsRegistry()
+    : pipeline(NULL)
+{
+    for (unsigned int i = 0; i < nShards; i++)
+        memset(shards[i].counters, 0, sizeof(shards[i].counters));
+}
+
+void MetricsRegistry::observe(unsigned int stage, unsigned long long ns)
+{
+    // The end to end latency is accounted by the display thread
+    unsigned int shard = (stage == PIPELINE_STAGE_LATENCY) ? PIPELINE_STAGE_DISPLAY : stage;
+    shards[shard].stages[stage].add(ns);
+}
+
+static void appendf(string &text, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void appendf(string &text, const char *format, ...)
+{
+    char line[256];
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(line, sizeof(line), format, ap);
+    va_end(ap);
+    text += line;
+}
+
+static void appendCounter(string &text, const char *name, const char *help, unsigned long long value)
+{
+    appendf(text, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, value);
+}
+
+void MetricsRegistry::snapshot(string &text) const
+{
+    static const char *counterNames[METRICS_COUNTER_COUNT][2] =
+    {
+        { "stylus_blobs_labeled_total", "Blobs found by labeling." },
+        { "stylus_blobs_kept_total", "Blobs left after the area filter." },
+        { "stylus_tracks_created_total", "Tracks started." },
+        { "stylus_tracks_expired_total", "Tracks dropped after inactivity." },
+        { "stylus_allocations_total", "Heap allocations of labeling, merging and tracking." },
+        { "stylus_frames_idle_total", "Frames not labeled, nothing above the threshold." }
+    };
+    static const char *stageNames[PIPELINE_STAGE_COUNT] = { "capture", "vision", "display", "end_to_end" };
+    static const double bounds[] = { .0001, .00025, .0005, .001, .0025, .005, .01, .025, .05, .1, .25, .5, 1. };
+
+    text.clear();
+
+    if (pipeline)
+    {
+        PipelineStats s = pipeline->stats();
+        appendCounter(text, "stylus_frames_captured_total", "Frames grabbed from the source.", s.stage[PIPELINE_STAGE_CAPTURE].count);
+        appendCounter(text, "stylus_frames_processed_total", "Frames labeled and tracked.", s.stage[PIPELINE_STAGE_VISION].count);
+        appendCounter(text, "stylus_frames_output_total", "Frames published or displayed.", s.stage[PIPELINE_STAGE_DISPLAY].count);
+        appendf(text, "# HELP stylus_frames_dropped_total Frames superseded by a newer one before a stage.\n");
+        appendf(text, "# TYPE stylus_frames_dropped_total counter\n");
+        appendf(text, "stylus_frames_dropped_total{stage=\"vision\"} %llu\n", s.droppedByVision);
+        appendf(text, "stylus_frames_dropped_total{stage=\"display\"} %llu\n", s.droppedByDisplay);
+    }
+
+    for (unsigned int c = 0; c < METRICS_COUNTER_COUNT; c++)
+    {
+        unsigned long long value = 0;
+        for (unsigned int i = 0; i < nShards; i++)
+            value += __atomic_load_n(&shards[i].counters[c], __ATOMIC_RELAXED);
+        appendCounter(text, counterNames[c][0], counterNames[c][1], value);
+    }
+
+    appendf(text, "# HELP stylus_stage_seconds Time spent in each pipeline stage, and from capture to output.\n");
+    appendf(text, "# TYPE stylus_stage_seconds histogram\n");
+    for (unsigned int stage = 0; stage < PIPELINE_STAGE_COUNT; stage++)
+    {
+        LatencyHistogram h;
+        for (unsigned int i = 0; i < nShards; i++)
+            h.merge(shards[i].stages[stage]);
+
+        for (unsigned int k = 0; k < sizeof(bounds) / sizeof(bounds[0]); k++)
+            appendf(text, "stylus_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n", stageNames[stage], bounds[k],
+                    h.countBelow((unsigned long long)(bounds[k] * 1e9)));
+        appendf(text, "stylus_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", stageNames[stage], h.count());
+        appendf(text, "stylus_stage_seconds_sum{stage=\"%s\"} %.9f\n", stageNames[stage], h.sum() / 1e9);
+        appendf(text, "stylus_stage_seconds_count{stage=\"%s\"} %llu\n", stageNames[stage], h.count());
+    }
+}
+
+MetricsServer::MetricsServer(MetricsRegistry const &registry)
+    : registry(registry), fd(-1), running(0)
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+bool MetricsServer::start(const char *where)
+{
+    bool isPort = (*where != 0) && (strspn(where, "0123456789") == strlen(where));
+
+    if (isPort)
+    {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == -1)
+            return false;
+
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        // Local only, the fleet agent scrapes on the board
+        struct sockaddr_in in;
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        in.sin_port = htons((unsigned short)atoi(where));
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (struct sockaddr *)&in, sizeof(in)) != 0)
+        {
+            close(fd);
+            fd = -1;
+            return false;
+        }
+    }
+    else
+    {
+        struct sockaddr_un un;
+        if (strlen(where) >= sizeof(un.sun_path))
+            return false;
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1)
+            return false;
+
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, where);
+        unlink(where);
+        if (bind(fd, (struct sockaddr *)&un, sizeof(un)) != 0)
+        {
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        path = where;
+    }
+
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    if ((listen(fd, 4) != 0) || (pthread_create(&thread, NULL, entry, this) != 0))
+    {
+        running = 0;
+        close(fd);
+        fd = -1;
+        if (!path.empty())
+            unlink(path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void MetricsServer::stop()
+{
+    if (fd == -1)
+        return;
+
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+
+    close(fd);
+    fd = -1;
+    if (!path.empty())
+        unlink(path.c_str());
+}
+
+void *MetricsServer::entry(void *self)
+{
+    ((MetricsServer *)self)->loop();
+    return NULL;
+}
+
+void MetricsServer::loop()
+{
+    // Polled with a timeout, so that stop() is noticed
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+        struct pollfd p;
+        p.fd = fd;
+        p.events = POLLIN;
+        if (poll(&p, 1, 200) <= 0)
+            continue;
+
+        int client = accept(fd, NULL, NULL);
+        if (client == -1)
+            continue;
+        serve(client);
+        close(client);
+    }
+}
+
+void MetricsServer::serve(int client)
+{
+    // Whatever the request, the answer is the snapshot. It is read so that
+    // the client does not see a reset, a slow one is not waited for.
+    struct timeval tv = { 0, 100000 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    char request[1024];
+    ssize_t n = recv(client, request, sizeof(request), 0);
+    (void)n;
+
+    registry.snapshot(text);
+
+    char header[160];
+    int len = snprintf(header, sizeof(header),
+                       "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %u\r\nConnection: close\r\n\r\n",
+                       (unsigned int)text.size());
+    text.insert(0, header, len);
+
+    for (size_t sent = 0; sent < text.size(); )
+    {
+        ssize_t k = send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (k <= 0)
+            break;
+        sent += k;
+    }
+}
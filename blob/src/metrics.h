@@ -0,0 +1,103 @@
+/// \file metrics.h
+/// \brief Counters and histograms of the stylus pipeline, served as text.
+///
+/// Every pipeline thread owns a shard of the registry and is its only
+/// writer, so that updates are plain stores without any lock or atomic
+/// read-modify-write. Shards, and the pipeline statistics, are only merged
+/// when a snapshot is requested. The snapshot uses the Prometheus text
+/// exposition format, and is served over HTTP on a local TCP port or a Unix
+/// socket:
+///   curl http://127.0.0.1:9100/metrics
+///   curl --unix-socket /run/stylusd.sock http://localhost/metrics
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <pthread.h>
+
+#include "latency.h"
+#include "pipeline.h"
+
+#define METRICS_BLOBS_LABELED     0 ///< Blobs found by cvLabel.
+#define METRICS_BLOBS_KEPT        1 ///< Blobs left after filtering.
+#define METRICS_TRACKS_CREATED    2 ///< Tracks started.
+#define METRICS_TRACKS_EXPIRED    3 ///< Tracks dropped after inactivity.
+#define METRICS_ALLOCATIONS       4 ///< Heap allocations (operator new) of the stages.
+#define METRICS_FRAMES_IDLE       5 ///< Frames skipped, nothing above the threshold.
+#define METRICS_COUNTER_COUNT     6
+
+/// \brief Per thread counters and stage durations.
+/// Shards are indexed by the pipeline stage of the thread writing them
+/// (PIPELINE_STAGE_CAPTURE, VISION or DISPLAY).
+class MetricsRegistry
+{
+public:
+    MetricsRegistry();
+
+    /// \brief Add n to a counter of shard. Only called from the shard's thread.
+    void add(unsigned int shard, unsigned int counter, unsigned long long n=1)
+    {
+        unsigned long long &c = shards[shard].counters[counter];
+        __atomic_store_n(&c, c + n, __ATOMIC_RELAXED);
+    }
+
+    /// \brief Account the duration of a pipeline stage (PIPELINE_STAGE_...).
+    /// Called from the thread running the stage.
+    void observe(unsigned int stage, unsigned long long ns);
+
+    /// \brief Pipeline whose frame counters are reported, or NULL.
+    void setPipeline(Pipeline const *p) { pipeline = p; }
+
+    /// \brief Merge the shards into a text snapshot.
+    void snapshot(std::string &text) const;
+
+private:
+    static const unsigned int nShards = PIPELINE_STAGE_DISPLAY + 1;
+
+    struct Shard
+    {
+        unsigned long long counters[METRICS_COUNTER_COUNT];
+        LatencyHistogram stages[PIPELINE_STAGE_COUNT];
+        // Shards are written by different threads, keep them apart
+        char padding[64];
+    };
+
+    Shard shards[nShards];
+    Pipeline const *pipeline;
+
+    MetricsRegistry(MetricsRegistry const &);
+    MetricsRegistry &operator=(MetricsRegistry const &);
+};
+
+/// \brief Serves registry snapshots, one per connection, from a thread.
+class MetricsServer
+{
+public:
+    MetricsServer(MetricsRegistry const &registry);
+    ~MetricsServer();
+
+    /// \brief Listen and start serving.
+    /// \param where TCP port on the loopback interface if numeric, Unix socket path otherwise.
+    /// \return false if the socket cannot be bound.
+    bool start(const char *where);
+
+    void stop();
+
+private:
+    static void *entry(void *self);
+    void loop();
+    void serve(int client);
+
+    MetricsRegistry const &registry;
+    int fd;
+    int running;
+    pthread_t thread;
+    std::string path;
+    std::string text;
+
+    MetricsServer(MetricsServer const &);
+    MetricsServer &operator=(MetricsServer const &);
+};
+
+#endif
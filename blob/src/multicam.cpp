@@ -0,0 +1,257 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+using namespace std;
+
+#include "allocations.h"
+#include "multicam.h"
+
+using namespace cvb;
+
+bool parseHomography(const char *text, double *h)
+{
+    int len = 0;
+    if ((sscanf(text, "%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf%n", &h[0], &h[1], &h[2], &h[3], &h[4], &h[5], &h[6], &h[7], &h[8], &len) != 9) ||
+        (text[len] != 0) || (h[8] == 0.))
+        return false;
+
+    for (int i = 7; i >= 0; i--)
+        h[i] /= h[8];
+    h[8] = 1.;
+    return true;
+}
+
+static void mapPoint(double const *h, double x, double y, double &u, double &v)
+{
+    double w = h[6] * x + h[7] * y + h[8];
+    u = (h[0] * x + h[1] * y + h[2]) / w;
+    v = (h[3] * x + h[4] * y + h[5]) / w;
+}
+
+CameraWorker::CameraWorker(FrameSource *source, double const *homography, unsigned char threshold, unsigned int idleRows, CvLabelFilter const &filter)
+    : source(source), threshold(threshold), idleRows(idleRows), filter(filter), mask(NULL), started(false), running(0), ended(0)
+{
+    memcpy(h, homography, sizeof(h));
+
+    sem_init(&filledSem, 0, 0);
+    sem_init(&freeSem, 0, 0);
+
+    // All the slots start free, before the gatherer thread exists
+    for (unsigned int i = 0; i < nSlots; i++)
+    {
+        slots[i].components = 0;
+        slots[i].idle = false;
+        slots[i].sequence = 0;
+        slots[i].glass = 0;
+        slots[i].labeled = 0;
+        slots[i].allocations = 0;
+        freed.push(&slots[i]);
+    }
+}
+
+CameraWorker::~CameraWorker()
+{
+    stop();
+
+    cvReleaseBlobs(blobs);
+    if (mask)
+        cvReleaseImage(&mask);
+
+    sem_destroy(&filledSem);
+    sem_destroy(&freeSem);
+}
+
+bool CameraWorker::start()
+{
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&thread, NULL, entry, this) != 0)
+    {
+        running = 0;
+        return false;
+    }
+
+    started = true;
+    return true;
+}
+
+void CameraWorker::stop()
+{
+    if (!started)
+        return;
+
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    sem_post(&freeSem);
+    pthread_join(thread, NULL);
+    started = false;
+
+    // A gatherer still waiting gets NULL
+    sem_post(&filledSem);
+}
+
+CameraFrame *CameraWorker::next()
+{
+    CameraFrame *f;
+
+    for (;;)
+    {
+        if (filled.pop(f))
+            return f;
+
+        // Frames pushed before the end are still handed out
+        if (__atomic_load_n(&ended, __ATOMIC_ACQUIRE))
+            return filled.pop(f) ? f : NULL;
+
+        sem_wait(&filledSem);
+    }
+}
+
+void CameraWorker::recycle(CameraFrame *f)
+{
+    freed.push(f);
+    sem_post(&freeSem);
+}
+
+void *CameraWorker::entry(void *self)
+{
+    ((CameraWorker *)self)->loop();
+    return NULL;
+}
+
+void CameraWorker::loop()
+{
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+        // Frames are gathered in order, the worker waits for a free slot
+        // rather than overwriting one
+        CameraFrame *f;
+        if (!freed.pop(f))
+        {
+            sem_wait(&freeSem);
+            continue;
+        }
+
+        SourceBuffer b;
+        b.index = -1;
+        if (!source->grab(b))
+            break;
+        unsigned long long allocated = heapAllocations();
+
+        unsigned long long now = pipelineNow();
+        unsigned long long glass = bufferTime(b);
+        f->glass = (glass && (glass <= now)) ? glass : now;
+        f->sequence = b.sequence;
+
+        // Idle view, an empty frame for the gatherer
+        f->idle = idleRows && !source->anyAbove(b, threshold, idleRows);
+        if (f->idle)
+        {
+            cvReleaseBlobs(blobs);
+            f->components = 0;
+        }
+        else
+        {
+            if (!mask)
+                mask = cvCreateImage(source->size(), IPL_DEPTH_8U, 1);
+            IplImage *img = source->luminance(b, threshold, mask);
+            cvLabelStats(img, blobs, filter, &f->components, &statsBuffers);
+        }
+        source->release(b);
+
+        f->blobs.clear();
+        for (CvBlobs::const_iterator it = blobs.begin(); it != blobs.end(); ++it)
+        {
+            f->blobs.push_back(*it->second);
+            map(f->blobs.back());
+        }
+        f->labeled = pipelineNow();
+        f->allocations = heapAllocations() - allocated;
+
+        filled.push(f);
+        sem_post(&filledSem);
+    }
+
+    __atomic_store_n(&ended, 1, __ATOMIC_RELEASE);
+    sem_post(&filledSem);
+}
+
+// Only the centroid and the bounding box are mapped, the area and the
+// moments stay in camera pixels
+void CameraWorker::map(CvBlob &blob) const
+{
+    mapPoint(h, blob.centroid.x, blob.centroid.y, blob.centroid.x, blob.centroid.y);
+
+    double minx = 0., maxx = 0., miny = 0., maxy = 0.;
+    for (unsigned int k = 0; k < 4; k++)
+    {
+        double u, v;
+        mapPoint(h, (k & 1) ? blob.maxx : blob.minx, (k & 2) ? blob.maxy : blob.miny, u, v);
+        if (!k || (u < minx)) minx = u;
+        if (!k || (u > maxx)) maxx = u;
+        if (!k || (v < miny)) miny = v;
+        if (!k || (v > maxy)) maxy = v;
+    }
+
+    blob.minx = (minx > 0.) ? (unsigned int)floor(minx) : 0;
+    blob.maxx = (maxx > 0.) ? (unsigned int)ceil(maxx) : 0;
+    blob.miny = (miny > 0.) ? (unsigned int)floor(miny) : 0;
+    blob.maxy = (maxy > 0.) ? (unsigned int)ceil(maxy) : 0;
+}
+
+void mergeCameraBlobs(vector<CameraFrame *> const &frames, double distance, CvBlobs &blobs)
+{
+    cvReleaseBlobs(blobs);
+
+    // Cameras each merged blob was seen by, one bit per camera
+    vector<CvBlob *> merged;
+    vector<unsigned long long> seenBy;
+
+    for (unsigned int c = 0; c < frames.size(); c++)
+    {
+        unsigned long long bit = 1ULL << (c % 64);
+        unsigned int n = merged.size();
+
+        for (unsigned int i = 0; i < frames[c]->blobs.size(); i++)
+        {
+            CvBlob const &b = frames[c]->blobs[i];
+
+            // Nearest blob of the cameras before, not matched in this one yet
+            int nearest = -1;
+            double best = distance;
+            for (unsigned int k = 0; k < n; k++)
+            {
+                if (seenBy[k] & bit)
+                    continue;
+                double d = hypot(b.centroid.x - merged[k]->centroid.x, b.centroid.y - merged[k]->centroid.y);
+                if (d <= best)
+                {
+                    best = d;
+                    nearest = k;
+                }
+            }
+
+            if (nearest < 0)
+            {
+                merged.push_back(new CvBlob(b));
+                seenBy.push_back(bit);
+                continue;
+            }
+
+            CvBlob *m = merged[nearest];
+            unsigned int minx = MIN(m->minx, b.minx), maxx = MAX(m->maxx, b.maxx);
+            unsigned int miny = MIN(m->miny, b.miny), maxy = MAX(m->maxy, b.maxy);
+            if (b.area > m->area)
+                *m = b;
+            m->minx = minx;
+            m->maxx = maxx;
+            m->miny = miny;
+            m->maxy = maxy;
+            seenBy[nearest] |= bit;
+        }
+    }
+
+    for (unsigned int k = 0; k < merged.size(); k++)
+    {
+        merged[k]->label = k + 1;
+        blobs.insert(CvLabelBlob(k + 1, merged[k]));
+    }
+}
@@ -0,0 +1,110 @@
+/// \file multicam.h
+/// \brief Several cameras covering one board.
+///
+/// Large boards, or two projectors side by side, do not fit the view of a
+/// single camera. Every camera then gets a worker thread of its own, which
+/// grabs, labels and maps the blobs through the camera's homography into
+/// screen coordinates. The workers run concurrently, one core each; the
+/// pipeline only gathers their blob sets, merges the pointers seen by two
+/// cameras where the views overlap, and tracks the result once.
+///
+/// Cameras are expected to run at the same frame rate, ideally genlocked:
+/// the n-th frames of all cameras are gathered together.
+
+#ifndef MULTICAM_H
+#define MULTICAM_H
+
+#include <vector>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "cvblob.h"
+#include "pipeline.h"
+#include "source.h"
+
+/// \brief Parse a camera to screen homography.
+/// \param text 9 comma separated values, row major.
+/// \param h Homography, normalized so that h[8] is 1.
+/// \return false if text is not a valid homography.
+bool parseHomography(const char *text, double *h);
+
+/// \brief Blobs of one camera frame, in screen coordinates.
+struct CameraFrame
+{
+    std::vector<cvb::CvBlob> blobs; ///< Blobs kept, centroid and bounding box mapped to the screen.
+    unsigned int components;        ///< Connected components before filtering.
+    bool idle;                      ///< Not labeled, nothing above the threshold.
+    unsigned int sequence;          ///< Source frame counter.
+    unsigned long long glass;       ///< Exposure time (ns), see LATENCY_GLASS.
+    unsigned long long labeled;     ///< Labeling done (ns).
+    unsigned long long allocations; ///< Heap allocations of the worker for the frame.
+};
+
+/// \brief Capture and labeling thread of one camera.
+class CameraWorker
+{
+public:
+    /// \param source Camera frames. Only used by the worker thread once started.
+    /// \param homography Camera to screen homography (9 values, row major).
+    /// \param threshold Luminance threshold, see FrameSource::luminance().
+    /// \param idleRows Frames without any sample above threshold on one of every idleRows rows are not labeled, 0 labels them all.
+    /// \param filter Blobs kept.
+    CameraWorker(FrameSource *source, double const *homography, unsigned char threshold, unsigned int idleRows, cvb::CvLabelFilter const &filter);
+    ~CameraWorker();
+
+    /// \brief Start grabbing.
+    bool start();
+
+    /// \brief Stop grabbing and wait for the thread.
+    void stop();
+
+    /// \brief Wait for the next frame, in capture order.
+    /// \return NULL at end of stream, or once stopped.
+    CameraFrame *next();
+
+    /// \brief Give a frame returned by next() back to the worker.
+    void recycle(CameraFrame *f);
+
+private:
+    static const unsigned int nSlots = 4;
+    typedef SpscQueue<CameraFrame *, nSlots> Queue;
+
+    static void *entry(void *self);
+    void loop();
+    void map(cvb::CvBlob &blob) const;
+
+    FrameSource *source;
+    double h[9];
+    unsigned char threshold;
+    unsigned int idleRows;
+    cvb::CvLabelFilter filter;
+    IplImage *mask;
+    cvb::CvBlobs blobs;
+    cvb::CvLabelStatsBuffers statsBuffers;
+    CameraFrame slots[nSlots];
+
+    Queue filled; // worker -> gatherer
+    Queue freed;  // gatherer -> worker
+    sem_t filledSem;
+    sem_t freeSem;
+
+    pthread_t thread;
+    bool started;
+    int running;
+    int ended;
+
+    CameraWorker(CameraWorker const &);
+    CameraWorker &operator=(CameraWorker const &);
+};
+
+/// \brief Merge the frames of every camera into one set of blobs.
+/// A blob is merged with the nearest blob of another camera closer than
+/// distance; the one with the larger area is kept, as a spot cut by the
+/// edge of a view is both smaller and off centre. The bounding boxes are
+/// joined.
+/// \param frames One frame per camera.
+/// \param distance Merge distance, in screen pixels.
+/// \param blobs Merged blobs, labeled from 1. Released first.
+void mergeCameraBlobs(std::vector<CameraFrame *> const &frames, double distance, cvb::CvBlobs &blobs);
+
+#endif
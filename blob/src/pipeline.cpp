@@ -0,0 +1,243 @@
+#include <ctime>
+#include <cstring>
+#include <iostream>
+using namespace std;
+
+#include "pipeline.h"
+#include "metrics.h"
+
+unsigned long long pipelineNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+Pipeline::Pipeline(PipelineStages &stages, unsigned int statsPeriod, MetricsRegistry *metrics)
+    : stages(stages), statsPeriod(statsPeriod), metrics(metrics), running(0)
+{
+    memset(&st, 0, sizeof(st));
+
+    sem_init(&capturedSem, 0, 0);
+    sem_init(&processedSem, 0, 0);
+    sem_init(&freeSem, 0, 0);
+
+    // All the slots start free. The display thread is the producer of
+    // freeFromDisplay, and run() is called from the display thread.
+    for (unsigned int i = 0; i < nFrames; i++)
+    {
+        frames[i].image = NULL;
+        frames[i].infraRed = NULL;
+        frames[i].labelImg = NULL;
+        frames[i].buffer.index = -1;
+        frames[i].seq = 0;
+        memset(frames[i].stamp, 0, sizeof(frames[i].stamp));
+        memset(frames[i].probe, 0, sizeof(frames[i].probe));
+        freeFromDisplay.push(&frames[i]);
+    }
+}
+
+Pipeline::~Pipeline()
+{
+    for (unsigned int i = 0; i < nFrames; i++)
+    {
+        cvb::cvReleaseBlobs(frames[i].blobs);
+        if (frames[i].image) cvReleaseImage(&frames[i].image);
+        if (frames[i].infraRed) cvReleaseImage(&frames[i].infraRed);
+        if (frames[i].labelImg) cvReleaseImage(&frames[i].labelImg);
+    }
+
+    sem_destroy(&capturedSem);
+    sem_destroy(&processedSem);
+    sem_destroy(&freeSem);
+}
+
+void Pipeline::run()
+{
+    pthread_t captureThread, visionThread;
+
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+
+    pthread_create(&visionThread, NULL, visionEntry, this);
+    pthread_create(&captureThread, NULL, captureEntry, this);
+
+    displayLoop();
+
+    stop();
+    pthread_join(captureThread, NULL);
+    pthread_join(visionThread, NULL);
+}
+
+void Pipeline::stop()
+{
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+
+    // Wake up everybody so that they notice.
+    sem_post(&capturedSem);
+    sem_post(&processedSem);
+    sem_post(&freeSem);
+}
+
+PipelineStats Pipeline::stats() const
+{
+    PipelineStats s;
+    for (unsigned int i = 0; i < PIPELINE_STAGE_COUNT; i++)
+    {
+        s.stage[i].count = __atomic_load_n(&st.stage[i].count, __ATOMIC_RELAXED);
+        s.stage[i].totalNs = __atomic_load_n(&st.stage[i].totalNs, __ATOMIC_RELAXED);
+        s.stage[i].maxNs = __atomic_load_n(&st.stage[i].maxNs, __ATOMIC_RELAXED);
+    }
+    s.droppedByVision = __atomic_load_n(&st.droppedByVision, __ATOMIC_RELAXED);
+    s.droppedByDisplay = __atomic_load_n(&st.droppedByDisplay, __ATOMIC_RELAXED);
+    return s;
+}
+
+void Pipeline::printStats() const
+{
+    static const char *names[PIPELINE_STAGE_COUNT] = { "capture", "vision", "display", "latency" };
+
+    PipelineStats s = stats();
+
+    for (unsigned int i = 0; i < PIPELINE_STAGE_COUNT; i++)
+    {
+        double mean = s.stage[i].count ? (double)s.stage[i].totalNs / s.stage[i].count : 0.;
+        clog << names[i] << ": mean " << mean / 1e6 << " ms, max " << s.stage[i].maxNs / 1e6 << " ms" << endl;
+    }
+    clog << "dropped: " << s.droppedByVision << " before vision, " << s.droppedByDisplay << " before display" << endl;
+}
+
+void *Pipeline::captureEntry(void *self)
+{
+    ((Pipeline *)self)->captureLoop();
+    return NULL;
+}
+
+void *Pipeline::visionEntry(void *self)
+{
+    ((Pipeline *)self)->visionLoop();
+    return NULL;
+}
+
+void Pipeline::account(unsigned int stage, unsigned long long ns)
+{
+    PipelineStageStats &s = st.stage[stage];
+    __atomic_store_n(&s.count, s.count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&s.totalNs, s.totalNs + ns, __ATOMIC_RELAXED);
+    if (ns > s.maxNs)
+        __atomic_store_n(&s.maxNs, ns, __ATOMIC_RELAXED);
+
+    if (metrics)
+        metrics->observe(stage, ns);
+}
+
+PipelineFrame *Pipeline::acquireFree()
+{
+    PipelineFrame *f;
+
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+        if (freeFromVision.pop(f) || freeFromDisplay.pop(f))
+            return f;
+        sem_wait(&freeSem);
+    }
+
+    return NULL;
+}
+
+// Pop everything available in q and keep the newest frame only. Older
+// frames go back to the capture stage through freeQ.
+PipelineFrame *Pipeline::latest(Queue &q, Queue &freeQ, unsigned long long &dropped)
+{
+    PipelineFrame *f = NULL;
+    PipelineFrame *g;
+
+    while (q.pop(g))
+    {
+        if (f)
+        {
+            stages.drop(*f);
+            freeQ.push(f);
+            sem_post(&freeSem);
+            __atomic_store_n(&dropped, dropped + 1, __ATOMIC_RELAXED);
+        }
+        f = g;
+    }
+
+    return f;
+}
+
+void Pipeline::captureLoop()
+{
+    unsigned int seq = 0;
+
+    while (PipelineFrame *f = acquireFree())
+    {
+        unsigned long long t0 = pipelineNow();
+        if (!stages.capture(*f))
+        {
+            // End of stream. The slot is not handed back, the pipeline is
+            // going down anyway.
+            stop();
+            break;
+        }
+        unsigned long long t1 = pipelineNow();
+
+        f->seq = seq++;
+        f->stamp[PIPELINE_STAGE_CAPTURE] = t1;
+        account(PIPELINE_STAGE_CAPTURE, t1 - t0);
+
+        captured.push(f);
+        sem_post(&capturedSem);
+    }
+}
+
+void Pipeline::visionLoop()
+{
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+        sem_wait(&capturedSem);
+
+        PipelineFrame *f = latest(captured, freeFromVision, st.droppedByVision);
+        if (!f)
+            continue;
+
+        unsigned long long t0 = pipelineNow();
+        stages.process(*f);
+        unsigned long long t1 = pipelineNow();
+
+        f->stamp[PIPELINE_STAGE_VISION] = t1;
+        account(PIPELINE_STAGE_VISION, t1 - t0);
+
+        processed.push(f);
+        sem_post(&processedSem);
+    }
+}
+
+void Pipeline::displayLoop()
+{
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+        sem_wait(&processedSem);
+
+        PipelineFrame *f = latest(processed, freeFromDisplay, st.droppedByDisplay);
+        if (!f)
+            continue;
+
+        unsigned long long t0 = pipelineNow();
+        bool more = stages.display(*f);
+        unsigned long long t1 = pipelineNow();
+
+        f->stamp[PIPELINE_STAGE_DISPLAY] = t1;
+        account(PIPELINE_STAGE_DISPLAY, t1 - t0);
+        account(PIPELINE_STAGE_LATENCY, t1 - f->stamp[PIPELINE_STAGE_CAPTURE]);
+
+        freeFromDisplay.push(f);
+        sem_post(&freeSem);
+
+        if (statsPeriod && (st.stage[PIPELINE_STAGE_DISPLAY].count % statsPeriod) == 0)
+            printStats();
+
+        if (!more)
+            break;
+    }
+}
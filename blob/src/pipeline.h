@@ -0,0 +1,184 @@
+/// \file pipeline.h
+/// \brief Threaded capture / vision / display pipeline.
+///
+/// Each stage runs on its own thread. Stages exchange frame slots through
+/// lock-free single-producer/single-consumer queues, and a consumer always
+/// skips to the newest frame available ("latest frame wins"), so that the
+/// stylus output never lags behind the camera.
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <vector>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "cvblob.h"
+#include "latency.h"
+#include "source.h"
+
+/// \brief Lock-free single-producer/single-consumer ring.
+/// N must be a power of two. push() must only be called from one thread
+/// and pop() from one (possibly other) thread.
+template <typename T, unsigned int N>
+class SpscQueue
+{
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    /// \brief Append v. Returns false if the ring is full.
+    bool push(T const &v)
+    {
+        unsigned int t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+        unsigned int h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+        if (t - h == N)
+            return false;
+        items[t & (N - 1)] = v;
+        __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /// \brief Remove the oldest element into v. Returns false if empty.
+    bool pop(T &v)
+    {
+        unsigned int h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        unsigned int t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+        if (h == t)
+            return false;
+        v = items[h & (N - 1)];
+        __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    T items[N];
+    // Producer and consumer indices live on separate cache lines.
+    unsigned int head;
+    char padding[64 - sizeof(unsigned int)];
+    unsigned int tail;
+};
+
+class MetricsRegistry;
+
+/// \brief Monotonic clock in nanoseconds.
+unsigned long long pipelineNow();
+
+#define PIPELINE_STAGE_CAPTURE 0 ///< Camera grab.
+#define PIPELINE_STAGE_VISION  1 ///< IR extraction, labeling, tracking.
+#define PIPELINE_STAGE_DISPLAY 2 ///< Rendering and output.
+#define PIPELINE_STAGE_LATENCY 3 ///< Capture to end of display.
+#define PIPELINE_STAGE_COUNT   4
+
+/// \brief Frame slot travelling through the pipeline.
+/// Images are allocated lazily by the stages and reused across frames.
+struct PipelineFrame
+{
+    IplImage *image;    ///< Captured frame (owned copy).
+    IplImage *infraRed; ///< IR plane (depth=IPL_DEPTH_8U, 1 channel).
+    IplImage *labelImg; ///< Label image (depth=IPL_DEPTH_LABEL16, or IPL_DEPTH_LABEL once overflowed).
+    SourceBuffer buffer; ///< Source buffer held by the frame (index -1 if none).
+    cvb::CvBlobs blobs; ///< Blobs kept after filtering.
+    std::vector<cvb::CvTrack> tracks; ///< Snapshot of the tracks for this frame.
+    unsigned int seq;   ///< Capture sequence number.
+    unsigned long long stamp[PIPELINE_STAGE_LATENCY]; ///< Stage completion times (ns).
+    unsigned long long probe[LATENCY_POINT_COUNT]; ///< Latency probe times (ns), set by the stages, see latency.h.
+};
+
+/// \brief Per stage timing, in nanoseconds.
+struct PipelineStageStats
+{
+    unsigned long long count;
+    unsigned long long totalNs;
+    unsigned long long maxNs;
+};
+
+/// \brief Pipeline statistics.
+/// Each counter is only written by the thread owning it; readers get a
+/// relaxed, approximate snapshot.
+struct PipelineStats
+{
+    PipelineStageStats stage[PIPELINE_STAGE_COUNT];
+    unsigned long long droppedByVision;  ///< Frames superseded before processing.
+    unsigned long long droppedByDisplay; ///< Frames superseded before display.
+};
+
+/// \brief Work done by each stage. Called from the stage's own thread.
+class PipelineStages
+{
+public:
+    virtual ~PipelineStages() {}
+
+    /// \brief Grab the next frame into f. Returns false at end of stream.
+    virtual bool capture(PipelineFrame &f) = 0;
+
+    /// \brief Extract and track blobs of f.
+    virtual void process(PipelineFrame &f) = 0;
+
+    /// \brief Render or output f. Returns false to stop the pipeline.
+    virtual bool display(PipelineFrame &f) = 0;
+
+    /// \brief f is superseded by a newer frame and will not be processed
+    /// any further. Called from the vision or display thread.
+    virtual void drop(PipelineFrame &) {}
+};
+
+/// \brief Capture / vision / display runner.
+class Pipeline
+{
+public:
+    /// \param stages Stage implementation.
+    /// \param statsPeriod If not 0, print stats to log every statsPeriod displayed frames.
+    /// \param metrics If not NULL, gets the stage durations (see metrics.h).
+    Pipeline(PipelineStages &stages, unsigned int statsPeriod=0, MetricsRegistry *metrics=NULL);
+    ~Pipeline();
+
+    /// \brief Run until a stage stops. The display stage runs on the calling
+    /// thread, as HighGUI requires.
+    void run();
+
+    /// \brief Request termination. Can be called from any thread.
+    void stop();
+
+    /// \brief Snapshot of the statistics.
+    PipelineStats stats() const;
+
+    /// \brief Print the statistics to the log.
+    void printStats() const;
+
+private:
+    static const unsigned int nFrames = 4;
+    typedef SpscQueue<PipelineFrame *, nFrames> Queue;
+
+    static void *captureEntry(void *self);
+    static void *visionEntry(void *self);
+    void captureLoop();
+    void visionLoop();
+    void displayLoop();
+
+    PipelineFrame *acquireFree();
+    PipelineFrame *latest(Queue &q, Queue &freeQ, unsigned long long &dropped);
+    void account(unsigned int stage, unsigned long long ns);
+
+    PipelineStages &stages;
+    unsigned int statsPeriod;
+    MetricsRegistry *metrics;
+    PipelineFrame frames[nFrames];
+
+    Queue captured;        // capture -> vision
+    Queue processed;       // vision -> display
+    Queue freeFromVision;  // vision -> capture
+    Queue freeFromDisplay; // display -> capture
+
+    sem_t capturedSem;
+    sem_t processedSem;
+    sem_t freeSem;
+
+    int running;
+    PipelineStats st;
+
+    // Not copyable.
+    Pipeline(Pipeline const &);
+    Pipeline &operator=(Pipeline const &);
+};
+
+#endif
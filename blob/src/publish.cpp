@@ -0,0 +1,81 @@
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+using namespace std;
+
+#include "publish.h"
+
+Publisher::Publisher()
+    : fd(1), isSocket(false)
+{
+}
+
+Publisher::~Publisher()
+{
+    if (isSocket)
+        close(fd);
+}
+
+bool Publisher::open(const char *path)
+{
+    if (!path)
+        return true;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return false;
+
+    int s = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (s == -1)
+        return false;
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+    // Not connected: the reader may come and go, each send is addressed
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (isSocket)
+        close(fd);
+    fd = s;
+    isSocket = true;
+
+    return true;
+}
+
+void Publisher::publish(unsigned int seq, vector<cvb::CvTrack> const &tracks)
+{
+    // Bounded so that a line always fits in the buffer
+    static const unsigned int maxPointers = 16;
+
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < tracks.size(); i++)
+        if (!tracks[i].inactive)
+            count++;
+    if (count > maxPointers)
+        count = maxPointers;
+
+    int len = snprintf(buffer, sizeof(buffer), "%u %u", seq, count);
+
+    for (unsigned int i = 0, j = 0; (i < tracks.size()) && (j < count); i++)
+    {
+        cvb::CvTrack const &t = tracks[i];
+        if (t.inactive)
+            continue;
+
+        unsigned int area = (t.maxx - t.minx) * (t.maxy - t.miny);
+        len += snprintf(buffer + len, sizeof(buffer) - len, " %u %.2f %.2f %u", t.id, t.centroid.x, t.centroid.y, area);
+        j++;
+    }
+
+    buffer[len++] = '\n';
+
+    if (isSocket)
+        sendto(fd, buffer, len, MSG_DONTWAIT, (struct sockaddr *)&addr, sizeof(addr));
+    else
+    {
+        ssize_t n = write(fd, buffer, len);
+        (void)n;
+    }
+}
@@ -0,0 +1,46 @@
+/// \file publish.h
+/// \brief Stylus coordinates output for headless operation.
+///
+/// One text line is written per frame:
+///   seq count [id x y area]...
+/// where count is the number of active pointers that follow and area is the
+/// bounding box area of the pointer. The line is sent either to stdout (pipe)
+/// or as a datagram to a local Unix socket bound by the reader. Socket sends
+/// never block: if nobody listens, or the reader lags behind, coordinates are
+/// dropped.
+
+#ifndef PUBLISH_H
+#define PUBLISH_H
+
+#include <vector>
+#include <sys/un.h>
+
+#include "cvblob.h"
+
+class Publisher
+{
+public:
+    Publisher();
+    ~Publisher();
+
+    /// \brief Select the output.
+    /// \param path Unix socket path, or NULL for stdout.
+    /// \return false if the socket cannot be created.
+    bool open(const char *path);
+
+    /// \brief Publish the active tracks of a frame.
+    /// \param seq Frame sequence number.
+    /// \param tracks Tracks of the frame.
+    void publish(unsigned int seq, std::vector<cvb::CvTrack> const &tracks);
+
+private:
+    int fd;
+    bool isSocket;
+    struct sockaddr_un addr;
+    char buffer[1024];
+
+    Publisher(Publisher const &);
+    Publisher &operator=(Publisher const &);
+};
+
+#endif
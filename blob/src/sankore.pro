@@ -1,23 +1,41 @@
-#-------------------------------------------------
-#
-# Project created by QtCreator 2012-07-24T18:08:17
-#
-#-------------------------------------------------
-
-QT       += core gui
-
-TARGET = sankore
-TEMPLATE = app
-
-
-SOURCES += main.cpp\
-        cvaux.cpp\
-        cvblob.cpp\
-        cvcolor.cpp\
-        cvcontour.cpp\
-        cvlabel.cpp\
-        cvtrack.cpp
-        
-HEADERS  += cvblob.h
-
-LIBS += -lopencv_highgui -lopencv_core
+#-------------------------------------------------
+#
+# Project created by QtCreator 2012-07-24T18:08:17
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = sankore
+TEMPLATE = app
+
+
+SOURCES += main.cpp\
+        allocations.cpp\
+        cvaux.cpp\
+        cvblob.cpp\
+        cvcolor.cpp\
+        cvcontour.cpp\
+        cvlabel.cpp\
+        cvtrack.cpp\
+        exposure.cpp\
+        latency.cpp\
+        metrics.cpp\
+        multicam.cpp\
+        pipeline.cpp\
+        publish.cpp\
+        v4l2cap.cpp\
+        source.cpp
+        
+HEADERS  += allocations.h\
+        cvblob.h\
+        exposure.h\
+        latency.h\
+        metrics.h\
+        multicam.h\
+        pipeline.h\
+        publish.h\
+        v4l2cap.h\
+        source.h
+
+LIBS += -lopencv_highgui -lopencv_core
@@ -0,0 +1,441 @@
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+#include "source.h"
+
+#ifndef HEADLESS
+#include <opencv2/core/core_c.h>
+#include <opencv2/highgui/highgui_c.h>
+#endif
+
+static unsigned long long monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+unsigned long long bufferTime(SourceBuffer const &b)
+{
+    return (unsigned long long)b.timestamp.tv_sec * 1000000000ULL + b.timestamp.tv_usec * 1000ULL;
+}
+
+void thresholdPlane(unsigned char const *src, unsigned int srcStep, unsigned int pixelStep, unsigned char threshold, IplImage *mask)
+{
+    CV_FUNCNAME("thresholdPlane");
+    __CV_BEGIN__;
+    {
+        CV_ASSERT(mask&&(mask->depth==IPL_DEPTH_8U)&&(mask->nChannels==1));
+
+        unsigned int width = mask->width;
+        unsigned int height = mask->height;
+        unsigned char *dst = (unsigned char *)mask->imageData;
+
+        // Separate loops so that the compiler vectorizes each step
+        for (unsigned int y = 0; y < height; y++, src += srcStep, dst += mask->widthStep)
+        {
+            if ((threshold == 0) && (pixelStep == 1))
+                memcpy(dst, src, width);
+            else if (threshold == 0)
+            {
+                for (unsigned int x = 0; x < width; x++)
+                    dst[x] = src[x * pixelStep];
+            }
+            else if (pixelStep == 1)
+            {
+                for (unsigned int x = 0; x < width; x++)
+                    dst[x] = (src[x] > threshold) ? 0xff : 0;
+            }
+            else
+            {
+                for (unsigned int x = 0; x < width; x++)
+                    dst[x] = (src[x * pixelStep] > threshold) ? 0xff : 0;
+            }
+        }
+    }
+    __CV_END__;
+}
+
+bool planeAbove(unsigned char const *src, unsigned int srcStep, unsigned int pixelStep, CvSize size, unsigned char threshold, unsigned int rowStep)
+{
+    if (rowStep < 1)
+        rowStep = 1;
+
+    // A max reduction per row vectorizes, the rows are tested in between
+    for (int y = 0; y < size.height; y += rowStep, src += rowStep * srcStep)
+    {
+        unsigned char highest = 0;
+        if (pixelStep == 1)
+        {
+            for (int x = 0; x < size.width; x++)
+                highest = (src[x] > highest) ? src[x] : highest;
+        }
+        else
+        {
+            for (int x = 0; x < size.width; x++)
+                highest = (src[x * pixelStep] > highest) ? src[x * pixelStep] : highest;
+        }
+
+        if (highest > threshold)
+            return true;
+    }
+
+    return false;
+}
+
+void planeLevels(unsigned char const *src, unsigned int srcStep, unsigned int pixelStep, CvSize size, unsigned int rowStep, unsigned char &peak, unsigned char &mean)
+{
+    if (rowStep < 1)
+        rowStep = 1;
+
+    unsigned long long sum = 0, count = 0;
+    peak = 0;
+    for (int y = 0; y < size.height; y += rowStep, src += rowStep * srcStep)
+    {
+        unsigned int rowSum = 0;
+        unsigned char highest = 0;
+        for (int x = 0; x < size.width; x++)
+        {
+            unsigned char v = src[x * pixelStep];
+            rowSum += v;
+            highest = (v > highest) ? v : highest;
+        }
+
+        sum += rowSum;
+        count += size.width;
+        if (highest > peak)
+            peak = highest;
+    }
+
+    mean = count ? (unsigned char)(sum / count) : 0;
+}
+
+PooledSource::PooledSource(double fps)
+    : headers(false), period(fps > 0. ? (unsigned long long)(1e9 / fps) : 0), deadline(0), sequence(0)
+{
+    frameSize = cvSize(0, 0);
+    for (unsigned int i = 0; i < nSlots; i++)
+    {
+        slots[i] = NULL;
+        busy[i] = 0;
+    }
+}
+
+PooledSource::~PooledSource()
+{
+    for (unsigned int i = 0; i < nSlots; i++)
+    {
+        if (!slots[i])
+            continue;
+        if (headers)
+            cvReleaseImageHeader(&slots[i]);
+        else
+            cvReleaseImage(&slots[i]);
+    }
+}
+
+void PooledSource::init(CvSize size, bool headers)
+{
+    this->headers = headers;
+    frameSize = size;
+    for (unsigned int i = 0; i < nSlots; i++)
+        slots[i] = headers ? cvCreateImageHeader(size, IPL_DEPTH_8U, 1) : cvCreateImage(size, IPL_DEPTH_8U, 1);
+}
+
+bool PooledSource::grab(SourceBuffer &b)
+{
+    b.index = -1;
+
+    // The pipeline holds fewer frames than there are slots, one is free
+    unsigned int i;
+    for (i = 0; i < nSlots; i++)
+        if (!__atomic_load_n(&busy[i], __ATOMIC_ACQUIRE))
+            break;
+    if (i == nSlots)
+        return false;
+
+    unsigned long long now = monotonicNs();
+    if (period)
+    {
+        // Late by more than a frame: restart the clock rather than burst
+        deadline += period;
+        if (deadline + period < now)
+            deadline = now;
+
+        struct timespec ts;
+        ts.tv_sec = deadline / 1000000000ULL;
+        ts.tv_nsec = deadline % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+            ;
+        now = deadline;
+    }
+
+    if (!fill(i, sequence))
+        return false;
+
+    busy[i] = 1;
+    b.index = i;
+    b.data = (unsigned char *)slots[i]->imageData;
+    b.bytesused = slots[i]->imageSize;
+    b.sequence = sequence++;
+    b.timestamp.tv_sec = now / 1000000000ULL;
+    b.timestamp.tv_usec = (now % 1000000000ULL) / 1000;
+    return true;
+}
+
+void PooledSource::release(SourceBuffer &b)
+{
+    if (b.index < 0)
+        return;
+
+    __atomic_store_n(&busy[b.index], 0, __ATOMIC_RELEASE);
+    b.index = -1;
+}
+
+IplImage *PooledSource::luminance(SourceBuffer const &b, unsigned char threshold, IplImage *mask)
+{
+    IplImage *slot = slots[b.index];
+    if (threshold == 0)
+        return slot;
+
+    thresholdPlane((unsigned char *)slot->imageData, slot->widthStep, 1, threshold, mask);
+    return mask;
+}
+
+bool PooledSource::anyAbove(SourceBuffer const &b, unsigned char threshold, unsigned int rowStep)
+{
+    IplImage *slot = slots[b.index];
+    return planeAbove((unsigned char *)slot->imageData, slot->widthStep, 1, frameSize, threshold, rowStep);
+}
+
+bool PooledSource::levels(SourceBuffer const &b, unsigned int rowStep, unsigned char &peak, unsigned char &mean)
+{
+    IplImage *slot = slots[b.index];
+    planeLevels((unsigned char *)slot->imageData, slot->widthStep, 1, frameSize, rowStep, peak, mean);
+    return true;
+}
+
+#ifndef HEADLESS
+CaptureSource::CaptureSource(CvCapture *capture, double fps)
+    : PooledSource(fps), capture(capture), chB(0), chV(0), chR(0)
+{
+    for (unsigned int i = 0; i < nSlots; i++)
+        colours[i] = NULL;
+}
+
+CaptureSource::~CaptureSource()
+{
+    for (unsigned int i = 0; i < nSlots; i++)
+        if (colours[i])
+            cvReleaseImage(&colours[i]);
+    if (chB) cvReleaseImage(&chB);
+    if (chV) cvReleaseImage(&chV);
+    if (chR) cvReleaseImage(&chR);
+    cvReleaseCapture(&capture);
+}
+
+IplImage *CaptureSource::colour(SourceBuffer const &b)
+{
+    return colours[b.index];
+}
+
+bool CaptureSource::fill(unsigned int i, unsigned int)
+{
+    // Get image from webcam flux
+    IplImage *image = cvQueryFrame(capture);
+    if (!image)
+        return false;
+
+    // The size is only known once a frame is decoded
+    if (!chB)
+    {
+        init(cvGetSize(image));
+        for (unsigned int j = 0; j < nSlots; j++)
+            colours[j] = cvCreateImage(frameSize, image->depth, image->nChannels);
+        chB = cvCreateImage(frameSize, 8, 1);
+        chV = cvCreateImage(frameSize, 8, 1);
+        chR = cvCreateImage(frameSize, 8, 1);
+    }
+
+    // cvQueryFrame reuses its buffer, keep our own copy
+    cvConvertScale(image, colours[i]); // Nota: this method can scale and shift values if neccessary
+
+    // Mix of the colour channels
+    cvSplit(colours[i], chB, chV, chR, 0);
+    cvAddWeighted(chB, 0.33f, chV, 0.33f, 0.0f, slots[i]);
+    cvAddWeighted(slots[i], 0.33f, chR, 0.33f, 0.0f, slots[i]);
+
+    return true;
+}
+#endif
+
+RawSource::RawSource(double fps)
+    : PooledSource(fps), data(NULL), length(0), nFrames(0), current(0), loops(1), played(0)
+{
+}
+
+RawSource::~RawSource()
+{
+    if (data)
+        munmap(data, length);
+}
+
+bool RawSource::open(const char *path, CvSize size, unsigned int loops)
+{
+    if (data || (size.width <= 0) || (size.height <= 0))
+        return false;
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    size_t frameBytes = (size_t)size.width * size.height;
+    if ((fstat(fd, &st) == -1) || ((size_t)st.st_size < frameBytes))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+    data = (unsigned char *)p;
+    length = st.st_size;
+    nFrames = length / frameBytes;
+    current = 0;
+    this->loops = loops;
+    played = 0;
+
+    init(size, true);
+    return true;
+}
+
+bool RawSource::fill(unsigned int i, unsigned int)
+{
+    if (!data)
+        return false;
+
+    if (current == nFrames)
+    {
+        if (loops && (++played >= loops))
+            return false;
+        current = 0;
+    }
+
+    // Labeling only reads its input, frames are used in place
+    size_t frameBytes = (size_t)frameSize.width * frameSize.height;
+    cvSetData(slots[i], data + current * frameBytes, frameSize.width);
+    current++;
+
+    return true;
+}
+
+// Position at time t of a point moving at speed v and bouncing between 0 and l
+static int bounce(unsigned int t, int v, int l)
+{
+    if (l <= 0)
+        return 0;
+    unsigned int u = (t * (unsigned int)v) % (unsigned int)(2 * l);
+    return ((int)u <= l) ? (int)u : 2 * l - (int)u;
+}
+
+SyntheticSource::SyntheticSource(CvSize size, unsigned int nSpots, double fps, double sigma, unsigned char noise, unsigned int seed)
+    : PooledSource(fps), nSpots(nSpots), radius((int)ceil(3. * sigma)), board(size), origin(cvPoint(0, 0))
+{
+    init(size);
+
+    // Spot rendered once: integer centres all use the same pixels
+    int side = 2 * radius + 1;
+    kernel.resize(side * side);
+    for (int dy = -radius; dy <= radius; dy++)
+        for (int dx = -radius; dx <= radius; dx++)
+            kernel[(dy + radius) * side + dx + radius] = (unsigned char)(255. * exp(-(dx * dx + dy * dy) / (2. * sigma * sigma)) + .5);
+
+    // Noise is read at a shifting offset, one row of margin
+    noiseField.resize((size_t)size.width * (size.height + 1));
+    unsigned int state = seed;
+    for (size_t i = 0; i < noiseField.size(); i++)
+    {
+        state = state * 1103515245u + 12345u;
+        noiseField[i] = (unsigned char)(((state >> 16) & 0x7fff) % ((unsigned int)noise + 1));
+    }
+}
+
+SyntheticSource::~SyntheticSource()
+{
+}
+
+void SyntheticSource::setView(CvSize board, CvPoint origin)
+{
+    this->board = board;
+    this->origin = origin;
+}
+
+void SyntheticSource::spots(unsigned int sequence, vector<CvPoint2D64f> &centres) const
+{
+    centres.resize(nSpots);
+    if (!nSpots)
+        return;
+
+    // Every spot keeps to its own band, the footprints never meet
+    int band = board.height / nSpots;
+    for (unsigned int k = 0; k < nSpots; k++)
+    {
+        int top = k * band;
+        int x = radius + bounce(sequence + 17 * k, 1 + k % 4, board.width - 1 - 2 * radius);
+        int y = top + band / 2;
+        if (band > 2 * radius + 1)
+            y = top + radius + bounce(sequence + 5 * k, 1 + k % 3, band - 1 - 2 * radius);
+
+        centres[k].x = x;
+        centres[k].y = y;
+    }
+}
+
+bool SyntheticSource::fill(unsigned int i, unsigned int sequence)
+{
+    IplImage *img = slots[i];
+    int width = frameSize.width;
+    int height = frameSize.height;
+
+    const unsigned char *noise = &noiseField[(sequence * 37u) % width];
+    for (int y = 0; y < height; y++)
+        memcpy(img->imageData + y * img->widthStep, noise + y * width, width);
+
+    spots(sequence, centres);
+
+    int side = 2 * radius + 1;
+    for (unsigned int k = 0; k < nSpots; k++)
+    {
+        int cx = (int)centres[k].x - origin.x;
+        int cy = (int)centres[k].y - origin.y;
+        if ((cx + radius < 0) || (cx - radius >= width) || (cy + radius < 0) || (cy - radius >= height))
+            continue;
+        for (int dy = -radius; dy <= radius; dy++)
+        {
+            int y = cy + dy;
+            if ((y < 0) || (y >= height))
+                continue;
+            unsigned char *row = (unsigned char *)img->imageData + y * img->widthStep;
+            const unsigned char *kernelRow = &kernel[(dy + radius) * side + radius];
+            for (int dx = -radius; dx <= radius; dx++)
+            {
+                int x = cx + dx;
+                if ((x >= 0) && (x < width) && (kernelRow[dx] > row[x]))
+                    row[x] = kernelRow[dx];
+            }
+        }
+    }
+
+    return true;
+}
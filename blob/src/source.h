@@ -0,0 +1,227 @@
+/// \file source.h
+/// \brief Frame sources feeding the IR stylus pipeline.
+///
+/// A source hands out luminance frames, ready to be thresholded and
+/// labeled. grab() is called from the capture thread; luminance(), colour()
+/// and release() from the vision or display threads. Every grabbed buffer
+/// must be released.
+///
+/// Besides live cameras (HighGUI capture and V4L2, see v4l2cap.h), frames
+/// can be replayed from a recorded video or a raw 8 bit sequence, or
+/// generated synthetically. The last two make the pipeline benchmarkable
+/// without a camera, and the synthetic source knows the exact centroid of
+/// every spot it renders.
+
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <vector>
+#include <sys/time.h>
+
+#include "cvblob.h"
+
+/// \brief A grabbed frame.
+struct SourceBuffer
+{
+    int index;                 ///< Source buffer index, -1 if none.
+    unsigned char *data;       ///< Pixels.
+    unsigned int bytesused;    ///< Payload size.
+    unsigned int sequence;     ///< Source frame counter.
+    struct timeval timestamp;  ///< Capture time (CLOCK_MONOTONIC).
+};
+
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+
+    /// \brief Frame size.
+    virtual CvSize size() const = 0;
+
+    /// \brief Wait for and take the next frame.
+    /// \return false at end of stream or on error.
+    virtual bool grab(SourceBuffer &b) = 0;
+
+    /// \brief Give a frame back to the source. Does nothing if b holds none.
+    virtual void release(SourceBuffer &b) = 0;
+
+    /// \brief Luminance of a frame, ready for cvLabel.
+    /// \param b Grabbed frame.
+    /// \param threshold Pixels above are set to 0xff, others to 0. 0 keeps the raw values.
+    /// \param mask Output image (depth=IPL_DEPTH_8U, 1 channel), used when a pass over the pixels is needed.
+    /// \return Image to label. Valid until b is released.
+    virtual IplImage *luminance(SourceBuffer const &b, unsigned char threshold, IplImage *mask) = 0;
+
+    /// \brief Whether a frame may hold something to label: a sample above
+    /// threshold on one of every rowStep rows. Far cheaper than luminance(),
+    /// meant to skip the frames of an idle board. Sources that cannot tell
+    /// always answer true.
+    virtual bool anyAbove(SourceBuffer const &, unsigned char, unsigned int) { return true; }
+
+    /// \brief Brightest and mean sample of a frame, on one of every rowStep
+    /// rows, for the exposure loop (see exposure.h).
+    /// \return false if the source cannot tell.
+    virtual bool levels(SourceBuffer const &, unsigned int, unsigned char &, unsigned char &) { return false; }
+
+    /// \brief Colour view of a frame (depth=IPL_DEPTH_8U, 3 channels), or
+    /// NULL if the source only has luminance. Valid until b is released.
+    virtual IplImage *colour(SourceBuffer const &) { return NULL; }
+};
+
+/// \brief Capture time of a frame, monotonic nanoseconds.
+unsigned long long bufferTime(SourceBuffer const &b);
+
+/// \brief Threshold an 8 bit plane into a binary mask.
+/// \param src First sample.
+/// \param srcStep Bytes between rows.
+/// \param pixelStep Bytes between samples (2 for the Y of YUYV).
+/// \param threshold Samples above are set to 0xff, others to 0. 0 copies the samples.
+/// \param mask Output image, same size as the plane.
+void thresholdPlane(unsigned char const *src, unsigned int srcStep, unsigned int pixelStep, unsigned char threshold, IplImage *mask);
+
+/// \brief Whether an 8 bit plane has a sample above threshold, on one of
+/// every rowStep rows.
+/// \param src First sample.
+/// \param srcStep Bytes between rows.
+/// \param pixelStep Bytes between samples (2 for the Y of YUYV).
+/// \param size Plane size.
+/// \param threshold Level to exceed.
+/// \param rowStep Rows scanned, one in rowStep: blobs at least rowStep rows tall are never missed.
+bool planeAbove(unsigned char const *src, unsigned int srcStep, unsigned int pixelStep, CvSize size, unsigned char threshold, unsigned int rowStep);
+
+/// \brief Brightest and mean sample of an 8 bit plane, on one of every
+/// rowStep rows. Same parameters as planeAbove().
+void planeLevels(unsigned char const *src, unsigned int srcStep, unsigned int pixelStep, CvSize size, unsigned int rowStep, unsigned char &peak, unsigned char &mean);
+
+/// \brief Sources whose frames live in a small pool of luminance images.
+/// The pool is large enough for every frame the pipeline can hold at once.
+class PooledSource : public FrameSource
+{
+public:
+    /// \param fps Frame rate to pace grab() at, 0 for as fast as possible.
+    PooledSource(double fps);
+    ~PooledSource();
+
+    CvSize size() const { return frameSize; }
+    bool grab(SourceBuffer &b);
+    void release(SourceBuffer &b);
+    IplImage *luminance(SourceBuffer const &b, unsigned char threshold, IplImage *mask);
+    bool anyAbove(SourceBuffer const &b, unsigned char threshold, unsigned int rowStep);
+    bool levels(SourceBuffer const &b, unsigned int rowStep, unsigned char &peak, unsigned char &mean);
+
+protected:
+    static const unsigned int nSlots = 8;
+
+    /// \brief Allocate the pool.
+    /// \param size Frame size.
+    /// \param headers Only allocate image headers, fill() sets their data.
+    void init(CvSize size, bool headers=false);
+
+    /// \brief Fill the luminance of slot i with frame sequence. Capture thread.
+    virtual bool fill(unsigned int i, unsigned int sequence) = 0;
+
+    CvSize frameSize;
+    IplImage *slots[nSlots];
+
+private:
+    bool headers;
+    unsigned long long period;
+    unsigned long long deadline;
+    unsigned int sequence;
+    int busy[nSlots];
+
+    PooledSource(PooledSource const &);
+    PooledSource &operator=(PooledSource const &);
+};
+
+#ifndef HEADLESS
+/// \brief HighGUI capture: camera, or replay of a recorded video file.
+/// The IR plane is a mix of the colour channels.
+class CaptureSource : public PooledSource
+{
+public:
+    /// \param capture Opened capture, released by the source.
+    /// \param fps Replay frame rate, 0 for as fast as possible (cameras pace themselves).
+    CaptureSource(CvCapture *capture, double fps=0);
+    ~CaptureSource();
+
+    IplImage *colour(SourceBuffer const &b);
+
+protected:
+    bool fill(unsigned int i, unsigned int sequence);
+
+private:
+    CvCapture *capture;
+    IplImage *colours[nSlots];
+    IplImage *chB, *chV, *chR;
+};
+#endif
+
+/// \brief Replay of a raw sequence: concatenated 8 bit gray frames of
+/// width x height pixels, without header. The file is mapped, frames are
+/// labeled in place.
+class RawSource : public PooledSource
+{
+public:
+    RawSource(double fps=0);
+    ~RawSource();
+
+    /// \param path Sequence file.
+    /// \param size Frame size.
+    /// \param loops Number of times to play the sequence, 0 for ever.
+    /// \return false if the file cannot be mapped or holds no frame.
+    bool open(const char *path, CvSize size, unsigned int loops=1);
+
+protected:
+    bool fill(unsigned int i, unsigned int sequence);
+
+private:
+    unsigned char *data;
+    size_t length;
+    unsigned int nFrames;
+    unsigned int current;
+    unsigned int loops;
+    unsigned int played;
+};
+
+/// \brief Synthetic IR frames: moving Gaussian spots over noise.
+/// Each spot bounces in its own horizontal band, with integer centres and
+/// integer speeds. Noise never reaches the spots' threshold footprint, which
+/// is symmetric around the centre: once thresholded above the noise, the
+/// centroid of every blob is exactly the centre returned by spots(), as long
+/// as the bands are taller than the spots (height / nSpots > 6 * sigma).
+/// Several sources can share a board larger than their frames, each one
+/// rendering its own view of the same spots, as cameras side by side would.
+class SyntheticSource : public PooledSource
+{
+public:
+    /// \param size Frame size.
+    /// \param nSpots Number of spots.
+    /// \param fps Frame rate, 0 for as fast as possible.
+    /// \param sigma Spot radius (Gaussian standard deviation, pixels).
+    /// \param noise Max background level. Threshold above it to label the spots.
+    /// \param seed Noise seed.
+    SyntheticSource(CvSize size, unsigned int nSpots, double fps=0, double sigma=8., unsigned char noise=32, unsigned int seed=1);
+    ~SyntheticSource();
+
+    /// \brief Render the part of a board at origin, the spots moving over the
+    /// whole board. spots() then gives board coordinates. Call before grabbing.
+    void setView(CvSize board, CvPoint origin);
+
+    /// \brief Centres of the spots in frame sequence.
+    void spots(unsigned int sequence, std::vector<CvPoint2D64f> &centres) const;
+
+protected:
+    bool fill(unsigned int i, unsigned int sequence);
+
+private:
+    unsigned int nSpots;
+    int radius;
+    CvSize board;
+    CvPoint origin;
+    std::vector<unsigned char> kernel;     // Spot, (2*radius+1)^2
+    std::vector<unsigned char> noiseField; // One row larger than a frame
+    std::vector<CvPoint2D64f> centres;
+};
+
+#endif
@@ -0,0 +1,48 @@
+#-------------------------------------------------
+#
+# Headless IR stylus daemon: no window, no
+# rendering, frames straight from V4L2 buffers
+# (or replayed / synthetic, see source.h),
+# coordinates are published on stdout or on a
+# Unix datagram socket (see publish.h).
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = stylusd
+TEMPLATE = app
+CONFIG += console
+
+DEFINES += HEADLESS
+
+SOURCES += main.cpp\
+        allocations.cpp\
+        cvaux.cpp\
+        cvblob.cpp\
+        cvcolor.cpp\
+        cvcontour.cpp\
+        cvlabel.cpp\
+        cvtrack.cpp\
+        exposure.cpp\
+        latency.cpp\
+        metrics.cpp\
+        multicam.cpp\
+        pipeline.cpp\
+        publish.cpp\
+        v4l2cap.cpp\
+        source.cpp
+
+HEADERS  += allocations.h\
+        cvblob.h\
+        exposure.h\
+        latency.h\
+        metrics.h\
+        multicam.h\
+        pipeline.h\
+        publish.h\
+        v4l2cap.h\
+        source.h
+
+# no highgui: V4L2, raw replay and synthetic sources only
+LIBS += -lopencv_core
@@ -0,0 +1,193 @@
+#include <iostream>
+#include <vector>
+using namespace std;
+
+// Camera exposure loop
+#include "exposure.h"
+
+// Exposure loop against a model of the camera.
+//
+// The fake camera rounds the values it is given, as V4L2 drivers do: the
+// exposure to 100 us units, the frame rate down to a multiple of 5 fps.
+// Checked:
+//  - dark background, dim spots: the gain goes up before the exposure;
+//  - saturated background: the exposure goes down before the gain;
+//  - the frame rate follows the rounded exposure, within its range, and
+//    the loop keeps the values the camera actually took.
+// Exit status 0 on success, 1 on failure.
+
+static const unsigned char threshold = 64;
+static const unsigned int minArea = 500;
+
+class FakeCamera : public CameraControls
+{
+public:
+    FakeCamera(int exposure, int gain, int fps)
+    {
+        init(CAMERA_CONTROL_EXPOSURE, 100, 33000, exposure);
+        init(CAMERA_CONTROL_GAIN, 0, 255, gain);
+        init(CAMERA_CONTROL_FRAME_RATE, 5, 120, fps);
+    }
+
+    bool query(unsigned int control, CameraControlRange &range)
+    {
+        range = ranges[control];
+        return true;
+    }
+
+    bool set(unsigned int control, int value)
+    {
+        CameraControlRange &r = ranges[control];
+        if (control == CAMERA_CONTROL_EXPOSURE)
+            value = (value + 50) / 100 * 100;
+        else if (control == CAMERA_CONTROL_FRAME_RATE)
+            value -= value % 5;
+        if (value > r.maximum) value = r.maximum;
+        if (value < r.minimum) value = r.minimum;
+
+        if (value != r.value)
+            changed.push_back(control);
+        r.value = value;
+        return true;
+    }
+
+    int value(unsigned int control) const
+    {
+        return ranges[control].value;
+    }
+
+    std::vector<unsigned int> changed; ///< Controls changed, in order.
+
+private:
+    void init(unsigned int control, int minimum, int maximum, int value)
+    {
+        ranges[control].minimum = minimum;
+        ranges[control].maximum = maximum;
+        ranges[control].step = 1;
+        ranges[control].value = value;
+    }
+
+    CameraControlRange ranges[CAMERA_CONTROL_COUNT];
+};
+
+static unsigned int failures = 0;
+
+static void expect(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        cout << "FAILED: " << what << endl;
+        failures++;
+    }
+}
+
+// The loop sees what the camera took, the frame rate holds the exposure
+static void checkFrameRate(ExposureControl const &loop, FakeCamera const &camera)
+{
+    int exposure = camera.value(CAMERA_CONTROL_EXPOSURE);
+    int fps = camera.value(CAMERA_CONTROL_FRAME_RATE);
+
+    expect(loop.value(CAMERA_CONTROL_EXPOSURE) == exposure, "exposure read back");
+    expect(loop.value(CAMERA_CONTROL_GAIN) == camera.value(CAMERA_CONTROL_GAIN), "gain read back");
+    expect(loop.value(CAMERA_CONTROL_FRAME_RATE) == fps, "frame rate read back");
+    expect((fps >= 5) && (fps <= 120), "frame rate within its range");
+    expect((fps == 5) || ((long long)fps * exposure <= 1000000), "frame interval holds the exposure");
+    expect((fps == 120) || ((long long)(fps + 5) * exposure > 1000000), "highest frame rate");
+}
+
+// Index of the first and after the last change of a control in the log
+static unsigned int first(std::vector<unsigned int> const &changed, unsigned int control)
+{
+    for (unsigned int i = 0; i < changed.size(); i++)
+        if (changed[i] == control)
+            return i;
+    return changed.size();
+}
+
+static unsigned int last(std::vector<unsigned int> const &changed, unsigned int control)
+{
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < changed.size(); i++)
+        if (changed[i] == control)
+            n = i + 1;
+    return n;
+}
+
+// Dark background, spots just above the threshold: gain first
+static void testDimSpots()
+{
+    FakeCamera camera(2000, 32, 120);
+    ExposureControl loop(camera, threshold, minArea);
+    expect(loop.start(), "dim: controls found");
+
+    ExposureStats s;
+    s.peak = threshold + 8;
+    s.background = 10;
+    s.spots = 2;
+    s.spotArea = 1.5 * minArea;
+    for (unsigned int i = 0; i < 64; i++)
+    {
+        loop.update(s);
+        checkFrameRate(loop, camera);
+    }
+
+    std::vector<unsigned int> const &c = camera.changed;
+    expect(first(c, CAMERA_CONTROL_GAIN) == 0, "dim: gain changed first");
+    expect(camera.value(CAMERA_CONTROL_GAIN) == 255, "dim: gain raised to its maximum");
+    expect(last(c, CAMERA_CONTROL_GAIN) <= first(c, CAMERA_CONTROL_EXPOSURE), "dim: exposure only once the gain is at its maximum");
+    expect(camera.value(CAMERA_CONTROL_EXPOSURE) > 2000, "dim: exposure raised");
+}
+
+// Saturated background: exposure first
+static void testSaturated()
+{
+    FakeCamera camera(20000, 200, 50);
+    ExposureControl loop(camera, threshold, minArea);
+    expect(loop.start(), "saturated: controls found");
+
+    ExposureStats s;
+    s.peak = 255;
+    s.background = 250;
+    s.spots = 0;
+    s.spotArea = 0.;
+    for (unsigned int i = 0; i < 64; i++)
+    {
+        loop.update(s);
+        checkFrameRate(loop, camera);
+    }
+
+    std::vector<unsigned int> const &c = camera.changed;
+    expect(first(c, CAMERA_CONTROL_EXPOSURE) == 0, "saturated: exposure changed first");
+    expect(camera.value(CAMERA_CONTROL_EXPOSURE) < 20000, "saturated: exposure lowered");
+    expect(last(c, CAMERA_CONTROL_EXPOSURE) <= first(c, CAMERA_CONTROL_GAIN), "saturated: gain only once the exposure is at its minimum");
+    expect(camera.value(CAMERA_CONTROL_GAIN) < 200, "saturated: gain lowered");
+    expect(camera.value(CAMERA_CONTROL_FRAME_RATE) == 120, "saturated: frame rate raised to its maximum");
+}
+
+// Well lit spots: nothing changes
+static void testSteady()
+{
+    FakeCamera camera(5000, 64, 120);
+    ExposureControl loop(camera, threshold, minArea);
+    expect(loop.start(), "steady: controls found");
+
+    ExposureStats s;
+    s.peak = 200;
+    s.background = 10;
+    s.spots = 1;
+    s.spotArea = 1.5 * minArea;
+    for (unsigned int i = 0; i < 16; i++)
+        loop.update(s);
+
+    expect(camera.changed.empty(), "steady: settings kept");
+}
+
+int main()
+{
+    testDimSpots();
+    testSaturated();
+    testSteady();
+
+    cout << (failures ? "FAILED" : "passed") << endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Exposure loop against a model of the camera:
+# gain before exposure on dim spots, exposure
+# before gain on a saturated background, frame
+# rate following the exposure (see
+# test_exposure.cpp). Exits with 1 on failure.
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = test_exposure
+TEMPLATE = app
+CONFIG += console
+
+SOURCES += test_exposure.cpp\
+        exposure.cpp
+
+HEADERS  += exposure.h
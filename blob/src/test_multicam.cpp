@@ -0,0 +1,196 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <time.h>
+#include <unistd.h>
+using namespace std;
+
+// Blob manager lib
+#include "cvblob.h"
+using namespace cvb;
+
+// Several cameras, one board
+#include "multicam.h"
+
+// Two synthetic cameras side by side over one board, overlapping.
+//
+// Every camera worker labels its view and maps the blobs to the board, the
+// frames are merged as stylusd does (see MultiCameraStages). Every spot of
+// the board must come out once: missed, or seen twice where the views
+// overlap, the test fails. The spots must also have crossed the overlap,
+// otherwise the merge was not tested at all.
+//
+// The same frames are then gathered again, timed, by one worker at a time
+// and by all workers at once. With several cores the concurrent run must be
+// faster; the speedup is reported, and only checked against a loose bound
+// as the test machine may be loaded.
+//
+// Options:
+//  --frames <n>   frames gathered, 300 by default
+//  --spots <n>    spots on the board, 4 by default
+// Exit status 0 on success, 1 on failure.
+
+static const CvSize viewSize = cvSize(320, 240);
+static const int overlap = 80;
+static const double mergeDistance = 8.;
+static const unsigned int nCameras = 2;
+static const double minSpeedup = 1.2;
+
+static unsigned long long now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Views side by side, the homographies are translations
+static void createCameras(unsigned int nSpots, vector<SyntheticSource *> &views, vector<CameraWorker *> &workers)
+{
+    CvSize board = cvSize(nCameras * viewSize.width - (nCameras - 1) * overlap, viewSize.height);
+    for (unsigned int i = 0; i < nCameras; i++)
+    {
+        SyntheticSource *view = new SyntheticSource(viewSize, nSpots, 0., 8., 32, 1 + i);
+        view->setView(board, cvPoint(i * (viewSize.width - overlap), 0));
+        views.push_back(view);
+
+        double h[9] = { 1., 0., (double)(i * (viewSize.width - overlap)), 0., 1., 0., 0., 0., 1. };
+        workers.push_back(new CameraWorker(view, h, 64, 0, cvLabelFilter(500, 2000)));
+    }
+}
+
+static void releaseCameras(vector<SyntheticSource *> &views, vector<CameraWorker *> &workers)
+{
+    for (unsigned int i = 0; i < workers.size(); i++)
+    {
+        delete workers[i];
+        delete views[i];
+    }
+    workers.clear();
+    views.clear();
+}
+
+// Camera frames gathered per second, nWorkers running at a time
+static double timedRun(unsigned int frames, unsigned int nSpots, unsigned int nWorkers)
+{
+    vector<SyntheticSource *> views;
+    vector<CameraWorker *> workers;
+    createCameras(nSpots, views, workers);
+
+    unsigned int gathered = 0;
+    unsigned long long start = now();
+    for (unsigned int first = 0; first < nCameras; first += nWorkers)
+    {
+        unsigned int end = min(first + nWorkers, nCameras);
+        for (unsigned int i = first; i < end; i++)
+            workers[i]->start();
+
+        for (unsigned int n = 0; n < frames; n++)
+            for (unsigned int i = first; i < end; i++)
+            {
+                CameraFrame *f = workers[i]->next();
+                if (!f)
+                    continue;
+                gathered++;
+                workers[i]->recycle(f);
+            }
+
+        for (unsigned int i = first; i < end; i++)
+            workers[i]->stop();
+    }
+    double seconds = (now() - start) * 1e-9;
+
+    releaseCameras(views, workers);
+    return seconds > 0. ? gathered / seconds : 0.;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int frames = 300;
+    unsigned int nSpots = 4;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--frames") && (i + 1 < argc))
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--spots") && (i + 1 < argc))
+            nSpots = atoi(argv[++i]);
+    }
+
+    vector<SyntheticSource *> views;
+    vector<CameraWorker *> workers;
+    createCameras(nSpots, views, workers);
+
+    for (unsigned int i = 0; i < nCameras; i++)
+        workers[i]->start();
+
+    vector<CameraFrame *> gathered(nCameras);
+    vector<CvPoint2D64f> expected;
+    CvBlobs blobs;
+    unsigned int gatheredFrames = 0, merges = 0, missed = 0, duplicates = 0;
+    while (gatheredFrames < frames)
+    {
+        bool more = true;
+        for (unsigned int i = 0; i < nCameras; i++)
+        {
+            gathered[i] = workers[i]->next();
+            more = more && gathered[i];
+        }
+        if (!more)
+            break;
+        gatheredFrames++;
+
+        mergeCameraBlobs(gathered, mergeDistance, blobs);
+
+        // Blobs seen by both cameras
+        unsigned int nBlobs = 0;
+        for (unsigned int i = 0; i < nCameras; i++)
+            nBlobs += gathered[i]->blobs.size();
+        if (nBlobs > blobs.size())
+            merges += nBlobs - blobs.size();
+
+        // Each spot once, none twice
+        views[0]->spots(gathered[0]->sequence, expected);
+        for (unsigned int k = 0; k < expected.size(); k++)
+        {
+            double best = -1.;
+            for (CvBlobs::const_iterator it = blobs.begin(); it != blobs.end(); ++it)
+            {
+                double d = hypot(it->second->centroid.x - expected[k].x, it->second->centroid.y - expected[k].y);
+                if ((best < 0.) || (d < best))
+                    best = d;
+            }
+            if ((best < 0.) || (best > 1.))
+                missed++;
+        }
+        if (blobs.size() > expected.size())
+            duplicates += blobs.size() - expected.size();
+
+        for (unsigned int i = 0; i < nCameras; i++)
+            workers[i]->recycle(gathered[i]);
+    }
+
+    for (unsigned int i = 0; i < nCameras; i++)
+        workers[i]->stop();
+
+    cout << gatheredFrames << " frames, " << merges << " merged, " << missed << " missed, " << duplicates << " duplicates" << endl;
+    bool passed = (gatheredFrames == frames) && merges && !missed && !duplicates;
+
+    cvReleaseBlobs(blobs);
+    releaseCameras(views, workers);
+
+    // Same frames, one worker then all of them
+    double single = timedRun(frames, nSpots, 1);
+    double concurrent = timedRun(frames, nSpots, nCameras);
+    double speedup = single > 0. ? concurrent / single : 0.;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    cout << "1 worker " << single << " frames/s, " << nCameras << " workers " << concurrent << " frames/s, speedup " << speedup << " on " << cores << " cores" << endl;
+    if (cores >= (long)nCameras)
+        passed = passed && (speedup > minSpeedup);
+    else
+        cout << "speedup not checked on a single core" << endl;
+
+    cout << (passed ? "passed" : "FAILED") << endl;
+    return passed ? 0 : 1;
+}
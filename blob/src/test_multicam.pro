@@ -0,0 +1,41 @@
+#-------------------------------------------------
+#
+# Two synthetic cameras over one board: every
+# spot is found once after the merge, none is
+# missed or seen twice, and the workers run
+# faster together than one at a time (see
+# test_multicam.cpp). Exits with 1 on failure.
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = test_multicam
+TEMPLATE = app
+CONFIG += console
+
+DEFINES += HEADLESS
+
+SOURCES += test_multicam.cpp\
+        allocations.cpp\
+        cvaux.cpp\
+        cvblob.cpp\
+        cvcolor.cpp\
+        cvcontour.cpp\
+        cvlabel.cpp\
+        cvtrack.cpp\
+        latency.cpp\
+        metrics.cpp\
+        multicam.cpp\
+        pipeline.cpp\
+        source.cpp
+
+HEADERS  += allocations.h\
+        cvblob.h\
+        latency.h\
+        metrics.h\
+        multicam.h\
+        pipeline.h\
+        source.h
+
+LIBS += -lopencv_core
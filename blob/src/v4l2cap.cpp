@@ -0,0 +1,348 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <linux/videodev2.h>
+using namespace std;
+
+#include "v4l2cap.h"
+
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+    int r;
+    do
+        r = ioctl(fd, request, arg);
+    while ((r == -1) && (errno == EINTR));
+    return r;
+}
+
+V4l2Capture::V4l2Capture()
+    : fd(-1), width(0), height(0), bytesPerLine(0), pixelStep(1), pixelFormat(0), nBuffers(0)
+{
+    for (unsigned int i = 0; i < CAMERA_CONTROL_COUNT; i++)
+        manual[i] = false;
+}
+
+V4l2Capture::~V4l2Capture()
+{
+    close();
+}
+
+bool V4l2Capture::open(const char *path, unsigned int w, unsigned int h)
+{
+    static const unsigned int formats[2] = { V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_YUYV };
+
+    close();
+
+    fd = ::open(path, O_RDWR | O_NONBLOCK);
+    if (fd == -1)
+        return false;
+
+    struct v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    if ((xioctl(fd, VIDIOC_QUERYCAP, &cap) == -1) ||
+        !(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+        !(cap.capabilities & V4L2_CAP_STREAMING))
+    {
+        close();
+        return false;
+    }
+
+    // Prefer GREY (zero copy), then YUYV (Y read in place)
+    struct v4l2_format fmt;
+    unsigned int i;
+    for (i = 0; i < 2; i++)
+    {
+        memset(&fmt, 0, sizeof(fmt));
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        fmt.fmt.pix.width = w;
+        fmt.fmt.pix.height = h;
+        fmt.fmt.pix.pixelformat = formats[i];
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+        if ((xioctl(fd, VIDIOC_S_FMT, &fmt) == 0) && (fmt.fmt.pix.pixelformat == formats[i]))
+            break;
+    }
+    if (i == 2)
+    {
+        close();
+        return false;
+    }
+
+    width = fmt.fmt.pix.width;
+    height = fmt.fmt.pix.height;
+    pixelFormat = fmt.fmt.pix.pixelformat;
+    pixelStep = (pixelFormat == V4L2_PIX_FMT_GREY) ? 1 : 2;
+    bytesPerLine = fmt.fmt.pix.bytesperline ? fmt.fmt.pix.bytesperline : width * pixelStep;
+
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = maxBuffers;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if ((xioctl(fd, VIDIOC_REQBUFS, &req) == -1) || (req.count < 2))
+    {
+        close();
+        return false;
+    }
+
+    // Extra buffers the driver may have added are simply never queued
+    unsigned int count = (req.count < maxBuffers) ? req.count : maxBuffers;
+    bool ok = true;
+    for (nBuffers = 0; ok && (nBuffers < count); nBuffers++)
+    {
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = nBuffers;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buf) == -1)
+            break;
+
+        void *p = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+        if (p == MAP_FAILED)
+            break;
+        buffers[nBuffers] = (unsigned char *)p;
+        lengths[nBuffers] = buf.length;
+
+        // Zero copy view of a GREY buffer
+        headers[nBuffers] = NULL;
+        if (pixelStep == 1)
+        {
+            headers[nBuffers] = cvCreateImageHeader(cvSize(width, height), IPL_DEPTH_8U, 1);
+            cvSetData(headers[nBuffers], p, bytesPerLine);
+        }
+
+        ok = (xioctl(fd, VIDIOC_QBUF, &buf) == 0);
+    }
+
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (!ok || (nBuffers != count) || (xioctl(fd, VIDIOC_STREAMON, &type) == -1))
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void V4l2Capture::close()
+{
+    if (fd == -1)
+        return;
+
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(fd, VIDIOC_STREAMOFF, &type);
+
+    for (unsigned int i = 0; i < nBuffers; i++)
+    {
+        if (headers[i])
+            cvReleaseImageHeader(&headers[i]);
+        munmap(buffers[i], lengths[i]);
+    }
+    nBuffers = 0;
+
+    ::close(fd);
+    fd = -1;
+}
+
+bool V4l2Capture::grab(SourceBuffer &b)
+{
+    b.index = -1;
+
+    while (fd != -1)
+    {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        struct timeval tv;
+        tv.tv_sec = 2;
+        tv.tv_usec = 0;
+
+        int r = select(fd + 1, &fds, NULL, NULL, &tv);
+        if (r == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (r == 0)
+            return false; // Timeout, the device stalled
+
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        if (xioctl(fd, VIDIOC_DQBUF, &buf) == -1)
+        {
+            if (errno == EAGAIN)
+                continue;
+            return false;
+        }
+
+        b.index = buf.index;
+        b.data = buffers[buf.index];
+        b.bytesused = buf.bytesused;
+        b.sequence = buf.sequence;
+        b.timestamp = buf.timestamp;
+        return true;
+    }
+
+    return false;
+}
+
+void V4l2Capture::release(SourceBuffer &b)
+{
+    if ((fd == -1) || (b.index < 0))
+        return;
+
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = b.index;
+    xioctl(fd, VIDIOC_QBUF, &buf);
+
+    b.index = -1;
+}
+
+IplImage *V4l2Capture::luminance(SourceBuffer const &b, unsigned char threshold, IplImage *mask)
+{
+    if ((pixelStep == 1) && (threshold == 0))
+        return headers[b.index];
+
+    thresholdPlane(b.data, bytesPerLine, pixelStep, threshold, mask);
+
+    return mask;
+}
+
+bool V4l2Capture::anyAbove(SourceBuffer const &b, unsigned char threshold, unsigned int rowStep)
+{
+    return planeAbove(b.data, bytesPerLine, pixelStep, size(), threshold, rowStep);
+}
+
+bool V4l2Capture::levels(SourceBuffer const &b, unsigned int rowStep, unsigned char &peak, unsigned char &mean)
+{
+    planeLevels(b.data, bytesPerLine, pixelStep, size(), rowStep, peak, mean);
+    return true;
+}
+
+// Frame rate range of the current format, from the frame intervals
+static bool frameRates(int fd, unsigned int pixelFormat, unsigned int width, unsigned int height, int &lowest, int &highest)
+{
+    struct v4l2_frmivalenum iv;
+    memset(&iv, 0, sizeof(iv));
+    iv.pixel_format = pixelFormat;
+    iv.width = width;
+    iv.height = height;
+
+    lowest = highest = 0;
+    for (iv.index = 0; xioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &iv) == 0; iv.index++)
+    {
+        struct v4l2_fract shortest = iv.discrete, longest = iv.discrete;
+        if (iv.type != V4L2_FRMIVAL_TYPE_DISCRETE)
+        {
+            shortest = iv.stepwise.min;
+            longest = iv.stepwise.max;
+        }
+        if (!shortest.numerator || !longest.numerator)
+            continue;
+
+        int fast = shortest.denominator / shortest.numerator;
+        int slow = longest.denominator / longest.numerator;
+        if (!highest || (fast > highest)) highest = fast;
+        if (!lowest || (slow < lowest)) lowest = slow;
+
+        if (iv.type != V4L2_FRMIVAL_TYPE_DISCRETE)
+            break;
+    }
+
+    return highest > 0;
+}
+
+bool V4l2Capture::query(unsigned int control, CameraControlRange &range)
+{
+    if (fd == -1)
+        return false;
+
+    if (control == CAMERA_CONTROL_FRAME_RATE)
+    {
+        struct v4l2_streamparm parm;
+        memset(&parm, 0, sizeof(parm));
+        parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if ((xioctl(fd, VIDIOC_G_PARM, &parm) == -1) ||
+            !(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME) ||
+            !parm.parm.capture.timeperframe.numerator)
+            return false;
+
+        range.value = parm.parm.capture.timeperframe.denominator / parm.parm.capture.timeperframe.numerator;
+        range.step = 1;
+        if (!frameRates(fd, pixelFormat, width, height, range.minimum, range.maximum))
+            range.minimum = range.maximum = range.value;
+        return true;
+    }
+
+    // Exposure is in 100 us units
+    unsigned int id = (control == CAMERA_CONTROL_EXPOSURE) ? V4L2_CID_EXPOSURE_ABSOLUTE : V4L2_CID_GAIN;
+    int unit = (control == CAMERA_CONTROL_EXPOSURE) ? 100 : 1;
+
+    struct v4l2_queryctrl q;
+    memset(&q, 0, sizeof(q));
+    q.id = id;
+    if ((xioctl(fd, VIDIOC_QUERYCTRL, &q) == -1) || (q.flags & V4L2_CTRL_FLAG_DISABLED))
+        return false;
+
+    struct v4l2_control c;
+    memset(&c, 0, sizeof(c));
+    c.id = id;
+    if (xioctl(fd, VIDIOC_G_CTRL, &c) == -1)
+        return false;
+
+    range.minimum = q.minimum * unit;
+    range.maximum = q.maximum * unit;
+    range.step = (q.step ? q.step : 1) * unit;
+    range.value = c.value * unit;
+    return true;
+}
+
+bool V4l2Capture::set(unsigned int control, int value)
+{
+    if ((fd == -1) || !value)
+        return false;
+
+    if (control == CAMERA_CONTROL_FRAME_RATE)
+    {
+        struct v4l2_streamparm parm;
+        memset(&parm, 0, sizeof(parm));
+        parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        parm.parm.capture.timeperframe.numerator = 1;
+        parm.parm.capture.timeperframe.denominator = value;
+        return xioctl(fd, VIDIOC_S_PARM, &parm) == 0;
+    }
+
+    // Automatic modes would fight the loop, failures are ignored: the
+    // camera may have none
+    struct v4l2_control c;
+    memset(&c, 0, sizeof(c));
+    if (!manual[control])
+    {
+        if (control == CAMERA_CONTROL_EXPOSURE)
+        {
+            c.id = V4L2_CID_EXPOSURE_AUTO;
+            c.value = V4L2_EXPOSURE_MANUAL;
+        }
+        else
+        {
+            c.id = V4L2_CID_AUTOGAIN;
+            c.value = 0;
+        }
+        xioctl(fd, VIDIOC_S_CTRL, &c);
+        manual[control] = true;
+    }
+
+    c.id = (control == CAMERA_CONTROL_EXPOSURE) ? V4L2_CID_EXPOSURE_ABSOLUTE : V4L2_CID_GAIN;
+    c.value = (control == CAMERA_CONTROL_EXPOSURE) ? (value + 50) / 100 : value;
+    return xioctl(fd, VIDIOC_S_CTRL, &c) == 0;
+}
@@ -0,0 +1,94 @@
+/// \file v4l2cap.h
+/// \brief Direct V4L2 capture using driver mmap buffers.
+///
+/// Only the luminance is used by the IR path, so the device is set to GREY
+/// or YUYV and the Y samples are read in place from the driver buffers:
+/// there is no colour conversion and no frame copy. A dequeued buffer must
+/// be given back with release() once labeling is done with it.
+///
+/// The exposure, gain and frame rate are exposed as CameraControls, for the
+/// exposure loop (see exposure.h).
+///
+/// Works with any capture device, including the vivid and v4l2loopback
+/// virtual drivers:
+///   modprobe vivid && ./sankore --v4l2 /dev/video0
+
+#ifndef V4L2CAP_H
+#define V4L2CAP_H
+
+#include "exposure.h"
+#include "source.h"
+
+class V4l2Capture : public FrameSource, public CameraControls
+{
+public:
+    V4l2Capture();
+    ~V4l2Capture();
+
+    /// \brief Open and start streaming.
+    /// \param path Device node.
+    /// \param width Requested width (the driver may adjust it).
+    /// \param height Requested height (the driver may adjust it).
+    /// \return false if the device cannot stream GREY or YUYV.
+    bool open(const char *path, unsigned int width=640, unsigned int height=480);
+
+    /// \brief Stop streaming and unmap the buffers.
+    void close();
+
+    /// \brief Wait for and dequeue the next filled buffer.
+    /// \return false on error or timeout.
+    bool grab(SourceBuffer &b);
+
+    /// \brief Give a buffer back to the driver.
+    void release(SourceBuffer &b);
+
+    /// \brief Luminance of a buffer, ready for cvLabel.
+    /// With threshold 0 on a GREY device, this is an image header over the
+    /// driver buffer (no copy at all). Otherwise the Y samples are
+    /// thresholded in a single pass into mask (depth=IPL_DEPTH_8U, 1 channel).
+    /// \param b Dequeued buffer.
+    /// \param threshold Pixels above are set to 0xff, others to 0. 0 keeps the raw values.
+    /// \param mask Output image, used when a pass over the pixels is needed.
+    /// \return Image to label. Valid until b is released.
+    IplImage *luminance(SourceBuffer const &b, unsigned char threshold, IplImage *mask);
+
+    /// \brief Scan the Y samples of a buffer in place, see FrameSource::anyAbove().
+    bool anyAbove(SourceBuffer const &b, unsigned char threshold, unsigned int rowStep);
+
+    /// \brief Levels of the Y samples, see FrameSource::levels().
+    bool levels(SourceBuffer const &b, unsigned int rowStep, unsigned char &peak, unsigned char &mean);
+
+    /// \brief Exposure (V4L2_CID_EXPOSURE_ABSOLUTE), gain (V4L2_CID_GAIN) or
+    /// frame rate (VIDIOC_G_PARM, ranges from VIDIOC_ENUM_FRAMEINTERVALS).
+    bool query(unsigned int control, CameraControlRange &range);
+
+    /// \brief Set a control. Automatic exposure or gain is turned off first.
+    /// The frame rate can only be set if the driver allows it while streaming.
+    bool set(unsigned int control, int value);
+
+    /// \brief Frame size.
+    CvSize size() const { return cvSize(width, height); }
+
+    /// \brief Device file descriptor, -1 if closed.
+    int handle() const { return fd; }
+
+private:
+    static const unsigned int maxBuffers = 8;
+
+    int fd;
+    unsigned int width;
+    unsigned int height;
+    unsigned int bytesPerLine;
+    unsigned int pixelStep; // 1 for GREY, 2 for YUYV
+    unsigned int pixelFormat;
+    bool manual[CAMERA_CONTROL_COUNT]; // Automatic mode turned off
+    unsigned int nBuffers;
+    unsigned char *buffers[maxBuffers];
+    unsigned int lengths[maxBuffers];
+    IplImage *headers[maxBuffers];
+
+    V4l2Capture(V4l2Capture const &);
+    V4l2Capture &operator=(V4l2Capture const &);
+};
+
+#endif
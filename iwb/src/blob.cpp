@@ -0,0 +1,228 @@
+#include <new>
+#include "cvblob.h"
+#include "blob.h"
+
+using namespace cvb;
+
+
+/* the label image, the labeling buffers, the blob map
+   and the tracks are kept across frames. the previous pointers are kept to report
+   the ones the tracker dropped.
+ */
+
+struct iwb_blob
+{
+  IplImage* labels;
+  CvLabelStatsBuffers stats;
+  CvBlobs blobs;
+  CvTracks tracks;
+
+  unsigned int nprev;
+  iwb_cam_pointer_t prev[IWB_MAX_POINTERS];
+};
+
+
+struct iwb_blob* iwb_blob_create(int width, int height)
+{
+  /* called from c, nothing may throw */
+  iwb_blob* const blob = new (std::nothrow) iwb_blob;
+  if (blob == NULL) return NULL;
+
+  blob->labels = cvCreateImage(cvSize(width, height), IPL_DEPTH_LABEL, 1);
+  if (blob->labels == NULL)
+  {
+    delete blob;
+    return NULL;
+  }
+
+  blob->nprev = 0;
+  return blob;
+}
+
+void iwb_blob_destroy(struct iwb_blob* blob)
+{
+  cvReleaseTracks(blob->tracks);
+  cvReleaseBlobs(blob->blobs);
+  cvReleaseImage(&blob->labels);
+  delete blob;
+}
+
+static int is_tracked(const CvTracks& tracks, unsigned int id)
+{
+  return tracks.find(id) != tracks.end();
+}
+
+unsigned int iwb_blob_label
+(
+ struct iwb_blob* blob,
+ const struct _IplImage* bin,
+ const struct _IplImage* gray,
+ unsigned int background,
+ unsigned int min_area,
+ unsigned int max_area
+)
+{
+  /* out of range components are dropped while labeling. the
+     label image is only needed by the weighted centroids.
+   */
+  if (gray == NULL)
+  {
+    cvLabelStats
+      (bin, blob->blobs, cvLabelFilter(min_area, max_area), NULL, &blob->stats);
+    return blob->blobs.size();
+  }
+
+  cvLabelFiltered
+    (bin, blob->labels, blob->blobs, cvLabelFilter(min_area, max_area));
+
+  cvCentroidsWeighted
+    (blob->blobs, blob->labels, gray, (unsigned char)background);
+
+  return blob->blobs.size();
+}
+
+int iwb_blob_find_markers
+(
+ struct iwb_blob* blob,
+ double* markers
+)
+{
+  /* the corners maximize one of x + y, x - y, and their
+     opposites. points inside the hull, like the stylus,
+     never do.
+   */
+
+  static const double dirs[4][2] =
+    { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+
+  CvBlob* corners[4] = { NULL, NULL, NULL, NULL };
+  double best[4];
+  unsigned int i;
+  unsigned int j;
+
+  for (CvBlobs::const_iterator it = blob->blobs.begin(); it != blob->blobs.end(); ++it)
+  {
+    CvBlob* const b = it->second;
+
+    for (i = 0; i < 4; ++i)
+    {
+      const double d = dirs[i][0] * b->centroid.x + dirs[i][1] * b->centroid.y;
+      if ((corners[i] != NULL) && (d <= best[i])) continue ;
+      corners[i] = b;
+      best[i] = d;
+    }
+  }
+
+  for (i = 0; i < 4; ++i)
+  {
+    if (corners[i] == NULL) return -1;
+    for (j = 0; j < i; ++j)
+      if (corners[j] == corners[i]) return -1;
+
+    markers[i * 2 + 0] = corners[i]->centroid.x;
+    markers[i * 2 + 1] = corners[i]->centroid.y;
+  }
+
+  return 0;
+}
+
+void iwb_blob_exclude
+(
+ struct iwb_blob* blob,
+ const double* points,
+ unsigned int n,
+ double radius
+)
+{
+  CvBlobs::iterator it = blob->blobs.begin();
+  unsigned int i;
+
+  while (it != blob->blobs.end())
+  {
+    CvBlob* const b = it->second;
+
+    for (i = 0; i < n; ++i)
+    {
+      const double dx = b->centroid.x - points[i * 2 + 0];
+      const double dy = b->centroid.y - points[i * 2 + 1];
+      if (dx * dx + dy * dy < radius * radius) break ;
+    }
+
+    if (i == n)
+    {
+      ++it;
+      continue ;
+    }
+
+    cvReleaseBlob(b);
+    blob->blobs.erase(it++);
+  }
+}
+
+unsigned int iwb_blob_track
+(
+ struct iwb_blob* blob,
+ unsigned int seq,
+ uint64_t timestamp,
+ double max_distance,
+ unsigned int max_inactive,
+ iwb_cam_pointer_t* pointers,
+ unsigned int n
+)
+{
+  CvTracks::const_iterator pos;
+  unsigned int count = 0;
+  unsigned int i;
+
+  /* cvUpdateTracks drops every track with a 0 threshold */
+  if (max_inactive == 0) max_inactive = 1;
+
+  /* the real frame timing: a dropped frame is not a jump */
+  cvUpdateTracksTimed
+    (blob->blobs, blob->tracks, seq, timestamp, max_distance, max_inactive);
+
+  /* tracks dropped since the previous frame */
+  for (i = 0; (i < blob->nprev) && (count < n); ++i)
+  {
+    if (is_tracked(blob->tracks, blob->prev[i].id)) continue ;
+    pointers[count] = blob->prev[i];
+    pointers[count].state = IWB_POINTER_UP;
+    ++count;
+  }
+
+  for (pos = blob->tracks.begin(); (pos != blob->tracks.end()) && (count < n); ++pos)
+  {
+    const CvTrack* const track = pos->second;
+    iwb_cam_pointer_t* const p = &pointers[count++];
+
+    p->id = track->id;
+    p->coords[0] = track->centroid.x;
+    p->coords[1] = track->centroid.y;
+    p->area = 0;
+
+    if (track->inactive)
+    {
+      /* keep the last seen area for the UP to come */
+      for (i = 0; i < blob->nprev; ++i)
+        if (blob->prev[i].id == p->id) p->area = blob->prev[i].area;
+      p->state = IWB_POINTER_OCCLUDED;
+      continue ;
+    }
+
+    p->state = (track->lifetime == 1) ? IWB_POINTER_DOWN : IWB_POINTER_MOVE;
+
+    CvBlobs::const_iterator b = blob->blobs.find(track->label);
+    if (b != blob->blobs.end()) p->area = b->second->area;
+  }
+
+  /* remember the live pointers */
+  blob->nprev = 0;
+  for (i = 0; i < count; ++i)
+  {
+    if (pointers[i].state == IWB_POINTER_UP) continue ;
+    if (blob->nprev == IWB_MAX_POINTERS) break ;
+    blob->prev[blob->nprev++] = pointers[i];
+  }
+
+  return count;
+}
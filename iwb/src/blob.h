@@ -0,0 +1,102 @@
+#ifndef BLOB_H_INCLUDED
+# define BLOB_H_INCLUDED
+
+
+/* stylus detection and tracking on top of cvblob
+   (c++), exported to the c engine.
+
+   the label image and the labeling buffers are allocated
+   once, by iwb_blob_create. the blobs and the tracks are
+   cvblob's own, and cvblob allocates them every frame: a
+   CvBlob and a map node per kept blob, the contour points
+   when the centroids are weighted, the match matrix of
+   cvUpdateTracks, a CvTrack and a map node per new track.
+   all are released by the next frame, so the memory does
+   not grow, but the allocations are not O(1) per frame:
+   about 40 with a pointer, 90 at most, default settings.
+   going below needs blob and track storage owned by the
+   caller in cvblob.
+ */
+
+#include "iwb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct _IplImage;
+struct iwb_blob;
+
+
+/* width, height: size of the images to label. NULL if out of memory */
+
+struct iwb_blob* iwb_blob_create(int width, int height);
+
+void iwb_blob_destroy(struct iwb_blob* blob);
+
+/* label a binary image (IPL_DEPTH_8U, 1 channel) and
+   keep the blobs whose area is in [min_area, max_area].
+   if gray is not NULL, the centroids are weighted by
+   the gray levels above background, sub-pixel accurate.
+   returns the blob count.
+ */
+
+unsigned int iwb_blob_label
+(
+ struct iwb_blob* blob,
+ const struct _IplImage* bin,
+ const struct _IplImage* gray,
+ unsigned int background,
+ unsigned int min_area,
+ unsigned int max_area
+);
+
+/* panel markers: the blobs at the corners of the convex
+   hull of the labeled ones. markers gets their centroids,
+   top left, top right, bottom right, bottom left order.
+   returns -1 if there are not 4 distinct corners.
+ */
+
+int iwb_blob_find_markers
+(
+ struct iwb_blob* blob,
+ double* markers
+);
+
+/* forget the labeled blobs whose centroid is closer than
+   radius to one of the n points
+ */
+
+void iwb_blob_exclude
+(
+ struct iwb_blob* blob,
+ const double* points,
+ unsigned int n,
+ double radius
+);
+
+/* update the tracks with the labeled blobs of frame seq,
+   captured at timestamp (CLOCK_MONOTONIC nanoseconds).
+   tracks missing for more than max_inactive frames are
+   lifted (IWB_POINTER_UP, reported once, at their last
+   position); the frames skipped in seq count as missing.
+   fill up to n pointers, return their count.
+ */
+
+unsigned int iwb_blob_track
+(
+ struct iwb_blob* blob,
+ unsigned int seq,
+ uint64_t timestamp,
+ double max_distance,
+ unsigned int max_inactive,
+ iwb_cam_pointer_t* pointers,
+ unsigned int n
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* ! BLOB_H_INCLUDED */
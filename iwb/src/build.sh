@@ -0,0 +1,8 @@
+#!/usr/bin/env sh
+# libiwb.a: the engine (c) and the stylus detection on
+# top of cvblob (c++). link with -lstdc++ and opencv.
+CVBLOB=../../blob/src
+g++ -Wall -O2 -c -I$CVBLOB blob.cpp $CVBLOB/cvaux.cpp $CVBLOB/cvblob.cpp $CVBLOB/cvcolor.cpp $CVBLOB/cvcontour.cpp $CVBLOB/cvlabel.cpp $CVBLOB/cvtrack.cpp
+gcc -Wall -O2 -c iwb.c store.c uinput.c
+ar rcs libiwb.a iwb.o store.o uinput.o blob.o cvaux.o cvblob.o cvcolor.o cvcontour.o cvlabel.o cvtrack.o
+gcc -Wall main.c libiwb.a -lstdc++ -lopencv_highgui -lopencv_imgproc -lopencv_core -lm
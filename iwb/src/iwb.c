@@ -1,50 +1,1117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <opencv2/core/core_c.h>
+#include <opencv2/core/types_c.h>
+#include <opencv2/highgui/highgui_c.h>
+#include <opencv2/imgproc/imgproc_c.h>
 #include "iwb.h"
+#include "blob.h"
+#include "store.h"
 
 
+/* helpers
+ */
+
+static inline int round_to_int(double x)
+{
+  return (int)floor(x + 0.5);
+}
+
+static uint64_t get_monotonic_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void set_identity(double* h)
+{
+  unsigned int i;
+  for (i = 0; i < 9; ++i) h[i] = (i % 4) ? 0 : 1;
+}
+
+static int apply_homography(const double* h, const double* in, double* out)
+{
+  /* from equation at http://www.zaunert.de/jochenz/wii:
+     x' = (a1 * x + b1 * y + c1) / (a3 * x + b3 * y + 1);
+     y' = (a2 * x + b2 * y + c2) / (a3 * x + b3 * y + 1);
+   */
+
+  const double w = h[6] * in[0] + h[7] * in[1] + h[8];
+
+  /* point on the horizon line */
+  if (fabs(w) < 1e-12) return -1;
+
+  out[0] = (h[0] * in[0] + h[1] * in[1] + h[2]) / w;
+  out[1] = (h[3] * in[0] + h[4] * in[1] + h[5]) / w;
+
+  return 0;
+}
+
+static void undistort_normalized(const double* k, double* u)
+{
+  /* brown model, radial k[0] k[1] and tangential k[2] k[3].
+     the parameters are fitted for this direction, from
+     the observed point to the ideal one, no iteration.
+   */
+
+  const double x = u[0];
+  const double y = u[1];
+  const double r2 = x * x + y * y;
+  const double radial = 1 + k[0] * r2 + k[1] * r2 * r2;
+
+  u[0] = x * radial + 2 * k[2] * x * y + k[3] * (r2 + 2 * x * x);
+  u[1] = y * radial + k[2] * (r2 + 2 * y * y) + 2 * k[3] * x * y;
+}
+
+static void undistort(const iwb_distortion_t* d, const double* in, double* out)
+{
+  double u[2];
+
+  u[0] = (in[0] - d->center[0]) / d->focal;
+  u[1] = (in[1] - d->center[1]) / d->focal;
+
+  undistort_normalized(d->k, u);
+
+  out[0] = d->center[0] + u[0] * d->focal;
+  out[1] = d->center[1] + u[1] * d->focal;
+}
+
+static int cam_to_user(const iwb_state_t* state, const double* cam, double* user)
+{
+  /* camera to screen, then to window user units if any.
+     every camera correction goes here, the lut is built
+     from this function and gets them for free.
+   */
+
+  double undistorted[2];
+
+  /* centroids only, frames are never remapped */
+  if (state->has_distortion)
+  {
+    undistort(&state->distortion, cam, undistorted);
+    cam = undistorted;
+  }
+
+  if (apply_homography(state->h, cam, user)) return -1;
+
+  if (state->has_window)
+  {
+    user[0] = (user[0] - state->win_origin[0]) *
+      state->win_units[0] / state->win_size[0];
+    user[1] = (user[1] - state->win_origin[1]) *
+      state->win_units[1] / state->win_size[1];
+  }
+
+  return 0;
+}
+
+
+/* camera to user lookup table. cam_to_user is sampled
+   every (1 << LUT_STEP_LOG2) camera pixels, the samples
+   are stored in fixed point and interpolated bilinearly.
+   camera coordinates keep LUT_FRAC_BITS of sub pixel.
+ */
+
+#define LUT_STEP_LOG2 3
+#define LUT_FRAC_BITS 8
+#define LUT_CELL_BITS (LUT_STEP_LOG2 + LUT_FRAC_BITS)
+#define LUT_VALUE_BITS 16
+#define LUT_INVALID INT32_MIN
+
+static int lut_create(iwb_state_t* state, unsigned int width, unsigned int height)
+{
+  /* one more node than cells on each axis, and the last
+     pixel may start a cell of its own
+   */
+
+  state->lut_width = ((width - 1) >> LUT_STEP_LOG2) + 2;
+  state->lut_height = ((height - 1) >> LUT_STEP_LOG2) + 2;
+  state->lut = malloc
+    (state->lut_width * state->lut_height * 2 * sizeof(int32_t));
+  if (state->lut == NULL) return -1;
+
+  state->is_lut_dirty = 1;
+
+  return 0;
+}
+
+static void lut_update(iwb_state_t* state)
+{
+  /* lock held */
+
+  const double scale = (double)(1 << LUT_VALUE_BITS);
+  int32_t* node = state->lut;
+  double cam[2];
+  double user[2];
+  unsigned int x;
+  unsigned int y;
+
+  for (y = 0; y < state->lut_height; ++y)
+  {
+    cam[1] = (double)(y << LUT_STEP_LOG2);
+
+    for (x = 0; x < state->lut_width; ++x, node += 2)
+    {
+      cam[0] = (double)(x << LUT_STEP_LOG2);
+
+      /* near the horizon line, or out of the fixed range */
+      if (cam_to_user(state, cam, user) ||
+          (fabs(user[0]) >= (double)(INT32_MAX >> LUT_VALUE_BITS)) ||
+          (fabs(user[1]) >= (double)(INT32_MAX >> LUT_VALUE_BITS)))
+      {
+        node[0] = LUT_INVALID;
+        node[1] = LUT_INVALID;
+        continue ;
+      }
+
+      node[0] = (int32_t)round_to_int(user[0] * scale);
+      node[1] = (int32_t)round_to_int(user[1] * scale);
+    }
+  }
+
+  state->is_lut_dirty = 0;
+}
+
+static int lut_lookup(const iwb_state_t* state, const double* cam, int* coords)
+{
+  /* lock held. returns -1 when the point is not covered,
+     the caller then computes it exactly.
+   */
+
+  const int32_t one = 1 << LUT_CELL_BITS;
+  const int64_t half = (int64_t)1 << (2 * LUT_CELL_BITS + LUT_VALUE_BITS - 1);
+  const unsigned int stride = state->lut_width * 2;
+  const int32_t* n00;
+  const int32_t* n10;
+  const int32_t* n01;
+  const int32_t* n11;
+  int32_t fx;
+  int32_t fy;
+  int32_t ax;
+  int32_t ay;
+  unsigned int gx;
+  unsigned int gy;
+  unsigned int i;
+  int64_t top;
+  int64_t bottom;
+
+  if ((cam[0] < 0) || (cam[1] < 0)) return -1;
+
+  fx = (int32_t)(cam[0] * (double)(1 << LUT_FRAC_BITS));
+  fy = (int32_t)(cam[1] * (double)(1 << LUT_FRAC_BITS));
+  gx = (unsigned int)(fx >> LUT_CELL_BITS);
+  gy = (unsigned int)(fy >> LUT_CELL_BITS);
+  if ((gx + 1 >= state->lut_width) || (gy + 1 >= state->lut_height))
+    return -1;
+
+  ax = fx & (one - 1);
+  ay = fy & (one - 1);
+
+  n00 = state->lut + gy * stride + gx * 2;
+  n10 = n00 + 2;
+  n01 = n00 + stride;
+  n11 = n01 + 2;
+
+  if ((n00[0] == LUT_INVALID) || (n10[0] == LUT_INVALID) ||
+      (n01[0] == LUT_INVALID) || (n11[0] == LUT_INVALID))
+    return -1;
+
+  for (i = 0; i < 2; ++i)
+  {
+    top = (int64_t)n00[i] * (one - ax) + (int64_t)n10[i] * ax;
+    bottom = (int64_t)n01[i] * (one - ax) + (int64_t)n11[i] * ax;
+    coords[i] = (int)((top * (one - ay) + bottom * ay + half) >>
+                      (2 * LUT_CELL_BITS + LUT_VALUE_BITS));
+  }
+
+  return 0;
+}
+
+static int map_coords(iwb_state_t* state, const double* cam, int* coords)
+{
+  double user[2];
+  int err = 0;
+
+  pthread_mutex_lock(&state->lock);
+
+  if (state->lut != NULL)
+  {
+    /* rebuilt on first use after a geometry change */
+    if (state->is_lut_dirty) lut_update(state);
+
+    if (lut_lookup(state, cam, coords) == 0)
+    {
+      pthread_mutex_unlock(&state->lock);
+      return 0;
+    }
+  }
+
+  err = cam_to_user(state, cam, user);
+
+  pthread_mutex_unlock(&state->lock);
+
+  if (err) return -1;
+
+  coords[0] = round_to_int(user[0]);
+  coords[1] = round_to_int(user[1]);
+
+  return 0;
+}
+
+/* ir background model
+   the frame is split in cells of 2^BACKGROUND_STEP_LOG2
+   pixels, each tracking the exponential average and the
+   variance of its brightest pixel, BACKGROUND_FRAC_BITS
+   fixed point. lit cells are averaged over more frames
+   (BACKGROUND_SLOW_LOG2) than dark ones, so that a moving
+   stylus does not leave a trail while a static hot spot
+   is absorbed, and do not change the variance, which is
+   the noise of the background only. during the first
+   BACKGROUND_WARMUP frames every cell is averaged fast,
+   the hot spots present at startup are gone within a
+   second.
+ */
+
+#define BACKGROUND_STEP_LOG2 2
+#define BACKGROUND_FRAC_BITS 8
+#define BACKGROUND_RATE_LOG2 4
+#define BACKGROUND_SLOW_LOG2 8
+#define BACKGROUND_WARMUP 32
+#define BACKGROUND_HELD 0x100
+
+static int background_create
+(
+ iwb_state_t* state,
+ unsigned int width,
+ unsigned int height
+)
+{
+  unsigned int ncells;
+
+  state->bg_width = ((width - 1) >> BACKGROUND_STEP_LOG2) + 1;
+  state->bg_height = ((height - 1) >> BACKGROUND_STEP_LOG2) + 1;
+  ncells = state->bg_width * state->bg_height;
+
+  state->background = malloc(ncells * 2 * sizeof(int32_t));
+  state->bg_threshold = malloc(ncells * sizeof(uint8_t));
+  state->bg_max = malloc(ncells * sizeof(uint16_t));
+  if ((state->background == NULL) ||
+      (state->bg_threshold == NULL) ||
+      (state->bg_max == NULL))
+    return -1;
+
+  /* dark background, anything brighter than min_contrast */
+  memset(state->background, 0, ncells * 2 * sizeof(int32_t));
+  memset(state->bg_threshold, state->conf.min_contrast, ncells);
+  state->bg_nframes = 0;
+
+  return 0;
+}
+
+static void background_destroy(iwb_state_t* state)
+{
+  if (state->background != NULL) free(state->background);
+  if (state->bg_threshold != NULL) free(state->bg_threshold);
+  if (state->bg_max != NULL) free(state->bg_max);
+
+  state->background = NULL;
+  state->bg_threshold = NULL;
+  state->bg_max = NULL;
+}
+
+static void background_threshold(iwb_state_t* state)
+{
+  /* ir to bin with the thresholds of the previous frame,
+     keeping the brightest pixel of every cell for the
+     update. a cell whose threshold reached 0xff is masked.
+   */
+
+  const IplImage* const ir = state->ir;
+  IplImage* const bin = state->bin;
+  const unsigned char* src;
+  unsigned char* dst;
+  const uint8_t* thresholds;
+  uint16_t* maxs;
+  unsigned int cx;
+  int x;
+  int y;
+
+  memset(state->bg_max, 0, state->bg_width * state->bg_height * sizeof(uint16_t));
+
+  for (y = 0; y < ir->height; ++y)
+  {
+    src = (const unsigned char*)ir->imageData + y * ir->widthStep;
+    dst = (unsigned char*)bin->imageData + y * bin->widthStep;
+    thresholds = state->bg_threshold +
+      (y >> BACKGROUND_STEP_LOG2) * state->bg_width;
+    maxs = state->bg_max + (y >> BACKGROUND_STEP_LOG2) * state->bg_width;
+
+    for (x = 0; x < ir->width; ++x)
+    {
+      cx = (unsigned int)x >> BACKGROUND_STEP_LOG2;
+      dst[x] = (src[x] > thresholds[cx]) ? 0xff : 0;
+      if (src[x] > maxs[cx]) maxs[cx] = src[x];
+    }
+  }
+}
+
+static void background_hold
+(
+ iwb_state_t* state,
+ const double* points,
+ unsigned int n
+)
+{
+  /* leave the cells around points out of the next update */
+
+  const double r = state->conf.marker_radius;
+  int x0, x1, y0, y1;
+  int x, y;
+  unsigned int i;
+
+  for (i = 0; i < n; ++i)
+  {
+    x0 = (int)floor(points[i * 2 + 0] - r) >> BACKGROUND_STEP_LOG2;
+    x1 = (int)floor(points[i * 2 + 0] + r) >> BACKGROUND_STEP_LOG2;
+    y0 = (int)floor(points[i * 2 + 1] - r) >> BACKGROUND_STEP_LOG2;
+    y1 = (int)floor(points[i * 2 + 1] + r) >> BACKGROUND_STEP_LOG2;
+
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 >= (int)state->bg_width) x1 = (int)state->bg_width - 1;
+    if (y1 >= (int)state->bg_height) y1 = (int)state->bg_height - 1;
+
+    for (y = y0; y <= y1; ++y)
+      for (x = x0; x <= x1; ++x)
+        state->bg_max[y * state->bg_width + x] = BACKGROUND_HELD;
+  }
+}
+
+static void background_update(iwb_state_t* state)
+{
+  const unsigned int ncells = state->bg_width * state->bg_height;
+  const unsigned int is_warmup = (state->bg_nframes < BACKGROUND_WARMUP);
+  int32_t* cell = state->background;
+  unsigned int lowest = 0xff;
+  unsigned int is_lit;
+  unsigned int rate;
+  unsigned int contrast;
+  unsigned int t;
+  unsigned int i;
+  int32_t d;
+
+  for (i = 0; i < ncells; ++i, cell += 2)
+  {
+    if (state->bg_max[i] != BACKGROUND_HELD)
+    {
+      is_lit = (state->bg_max[i] > state->bg_threshold[i]);
+      rate = BACKGROUND_RATE_LOG2;
+      if (is_lit && (is_warmup == 0)) rate = BACKGROUND_SLOW_LOG2;
+
+      d = ((int32_t)state->bg_max[i] << BACKGROUND_FRAC_BITS) - cell[0];
+      cell[0] += d >> rate;
+
+      /* the squared deviation keeps half the fraction */
+      if (is_lit == 0)
+      {
+        d >>= BACKGROUND_FRAC_BITS / 2;
+        cell[1] += (d * d - cell[1]) >> rate;
+      }
+
+      contrast = (unsigned int)
+      (
+       state->conf.noise_factor * sqrt((double)cell[1]) /
+       (double)(1 << (BACKGROUND_FRAC_BITS / 2))
+      );
+      if (contrast < state->conf.min_contrast)
+        contrast = state->conf.min_contrast;
+
+      t = (unsigned int)(cell[0] >> BACKGROUND_FRAC_BITS) + contrast;
+      state->bg_threshold[i] = (t > 0xff) ? 0xff : (uint8_t)t;
+    }
+
+    if (state->bg_threshold[i] < lowest) lowest = state->bg_threshold[i];
+  }
+
+  state->threshold = lowest;
+  ++state->bg_nframes;
+}
+
+static void update_markers(iwb_state_t*, double*, unsigned int*);
+
+static iwb_error_t grab_and_detect(iwb_state_t* state)
+{
+  double markers[16];
+  unsigned int nmarkers = 0;
+
+  IplImage* const frame = cvQueryFrame(state->capture);
+  if (frame == NULL) return IWB_ERR_CAPTURE;
+  state->frame = frame;
+
+  /* highgui does not give the driver timestamp, take the
+     time the frame was handed over
+   */
+  state->frame_time = get_monotonic_ns();
+  ++state->frame_seq;
+
+  /* ir extraction: the ir filter leaves the stylus as
+     the brightest spot, whatever the channel
+   */
+  if (frame->nChannels == 1) cvCopy(frame, state->ir, NULL);
+  else cvCvtColor(frame, state->ir, CV_BGR2GRAY);
+
+  if (state->conf.is_adaptive)
+  {
+    background_threshold(state);
+  }
+  else
+  {
+    cvThreshold
+      (state->ir, state->bin, state->conf.threshold, 0xff, CV_THRESH_BINARY);
+    state->threshold = state->conf.threshold;
+  }
+
+  iwb_blob_label
+  (
+   state->blob, state->bin,
+   state->conf.is_weighted ? state->ir : NULL, state->threshold,
+   state->conf.min_area, state->conf.max_area
+  );
+
+  /* the markers are not pointers */
+  if (state->conf.is_auto_calib) update_markers(state, markers, &nmarkers);
+
+  /* nor background, unlike the other static spots */
+  if (state->conf.is_adaptive)
+  {
+    background_hold(state, markers, nmarkers);
+    background_update(state);
+  }
+
+  state->npointers = iwb_blob_track
+  (
+   state->blob,
+   state->frame_seq, state->frame_time,
+   (double)state->conf.track_distance, state->conf.track_inactive,
+   state->pointers, IWB_MAX_POINTERS
+  );
+
+  state->has_frame = 1;
+
+  return IWB_ERR_SUCCESS;
+}
+
+static int map_pointer
+(
+ iwb_state_t* state,
+ const iwb_cam_pointer_t* cam,
+ iwb_pointer_t* pointer
+)
+{
+  if (map_coords(state, cam->coords, pointer->coords)) return -1;
+
+  pointer->id = cam->id;
+  pointer->state = cam->state;
+  pointer->area = cam->area;
+
+  return 0;
+}
+
+static const iwb_cam_pointer_t* find_primary(const iwb_state_t* state)
+{
+  /* the oldest pointer seen in this frame */
+
+  const iwb_cam_pointer_t* primary = NULL;
+  unsigned int i;
+
+  for (i = 0; i < state->npointers; ++i)
+  {
+    const iwb_cam_pointer_t* const p = &state->pointers[i];
+    if ((p->state != IWB_POINTER_DOWN) && (p->state != IWB_POINTER_MOVE))
+      continue ;
+    if ((primary == NULL) || (p->id < primary->id)) primary = p;
+  }
+
+  return primary;
+}
+
+
+/* async worker
+ */
+
+static void push_event
+(
+ iwb_state_t* state,
+ iwb_event_type_t type,
+ const iwb_pointer_t* p
+)
+{
+  iwb_event_t* e;
+  unsigned int head;
+  uint64_t one = 1;
+
+  if (state->conf.event_fn != NULL)
+  {
+    iwb_event_t event;
+    event.type = type;
+    event.id = p->id;
+    event.coords[0] = p->coords[0];
+    event.coords[1] = p->coords[1];
+    event.area = p->area;
+    event.timestamp = state->frame_time;
+    event.seq = state->frame_seq;
+    state->conf.event_fn(&event, state->conf.event_opaque);
+    return ;
+  }
+
+  /* the ring is full, the client is not reading */
+  head = state->ring_head;
+  if ((head - __atomic_load_n(&state->ring_tail, __ATOMIC_ACQUIRE)) ==
+      IWB_EVENT_RING_SIZE)
+  {
+    ++state->ring_overflows;
+    return ;
+  }
+
+  e = &state->ring[head % IWB_EVENT_RING_SIZE];
+  e->type = type;
+  e->id = p->id;
+  e->coords[0] = p->coords[0];
+  e->coords[1] = p->coords[1];
+  e->area = p->area;
+  e->timestamp = state->frame_time;
+  e->seq = state->frame_seq;
+  __atomic_store_n(&state->ring_head, head + 1, __ATOMIC_RELEASE);
+
+  if (write(state->event_fd, &one, sizeof(one)) != sizeof(one))
+  {
+    /* counter saturated, the fd is readable anyway */
+  }
+}
+
+static void* worker_entry(void* arg)
+{
+  iwb_state_t* const state = (iwb_state_t*)arg;
+
+  /* mapped positions of the previous frame, moves are
+     only reported when the mapped position changes
+   */
+  iwb_pointer_t last[IWB_MAX_POINTERS];
+  unsigned int nlast = 0;
+  iwb_pointer_t cur[IWB_MAX_POINTERS];
+  unsigned int ncur;
+  unsigned int i;
+  unsigned int j;
+  iwb_error_t err;
+
+  while (__atomic_load_n(&state->is_running, __ATOMIC_ACQUIRE))
+  {
+    err = grab_and_detect(state);
+    if (err != IWB_ERR_SUCCESS)
+    {
+      __atomic_store_n(&state->worker_error, err, __ATOMIC_RELEASE);
+      break ;
+    }
+
+    ncur = 0;
+    for (i = 0; i < state->npointers; ++i)
+    {
+      iwb_pointer_t* const p = &cur[ncur];
+      if (map_pointer(state, &state->pointers[i], p)) continue ;
+
+      switch (p->state)
+      {
+      case IWB_POINTER_DOWN:
+        push_event(state, IWB_EVENT_DOWN, p);
+        break ;
+
+      case IWB_POINTER_MOVE:
+        for (j = 0; (j < nlast) && (last[j].id != p->id); ++j) ;
+        if ((j == nlast) ||
+            (last[j].coords[0] != p->coords[0]) ||
+            (last[j].coords[1] != p->coords[1]))
+          push_event(state, IWB_EVENT_MOVE, p);
+        break ;
+
+      case IWB_POINTER_UP:
+        push_event(state, IWB_EVENT_UP, p);
+        continue ;
+
+      default:
+        /* occluded pointers stay down, where they were */
+        break ;
+      }
+
+      ++ncur;
+    }
+
+    for (i = 0; i < ncur; ++i) last[i] = cur[i];
+    nlast = ncur;
+  }
+
+  /* wake up the client so that it sees the error */
+  if (state->event_fd != -1)
+  {
+    const uint64_t one = 1;
+    if (write(state->event_fd, &one, sizeof(one)) != sizeof(one))
+    {
+      /* counter saturated, the fd is readable anyway */
+    }
+  }
+
+  return NULL;
+}
+
+
+/* exported
+ */
+
 iwb_error_t iwb_conf_load_default
 (
  iwb_state_t* state,
  iwb_conf_t* conf
 )
 {
-  return IWB_ERR_UNIMPL;
+  conf->cam_index = 0;
+  conf->frame_width = 640;
+  conf->frame_height = 480;
+
+  conf->threshold = 200;
+  conf->min_area = 4;
+  conf->max_area = 2000;
+
+  conf->is_adaptive = 0;
+  conf->noise_factor = 6;
+  conf->min_contrast = 64;
+
+  conf->is_weighted = 1;
+
+  conf->track_distance = 20;
+  conf->track_inactive = 3;
+
+  conf->use_lut = 0;
+
+  conf->calib_max_error = 8;
+  conf->calib_distortion = 1;
+
+  conf->is_auto_calib = 0;
+  memset(conf->marker_screen, 0, sizeof(conf->marker_screen));
+  conf->marker_period = 2000;
+  conf->marker_max_motion = 2;
+  conf->marker_radius = 6;
+
+  conf->calib_path[0] = 0;
+
+  conf->is_async = 0;
+  conf->event_fn = NULL;
+  conf->event_opaque = NULL;
+
+  conf->set_keys = 0;
+
+  return IWB_ERR_SUCCESS;
+}
+
+/* configuration keys, the conf field names. at most 32,
+   the bits of conf->set_keys.
+ */
+
+typedef enum conf_type
+{
+  CONF_UINT = 0,
+  CONF_INT,
+  CONF_DOUBLE,
+  CONF_STRING
+} conf_type_t;
+
+typedef struct conf_key
+{
+  const char* name;
+  conf_type_t type;
+  size_t off;
+  unsigned int count;
+} conf_key_t;
+
+#define CONF_KEY(__n, __t, __c) { #__n, __t, offsetof(iwb_conf_t, __n), __c }
+
+static const conf_key_t conf_keys[] =
+{
+  CONF_KEY(cam_index, CONF_INT, 1),
+  CONF_KEY(frame_width, CONF_UINT, 1),
+  CONF_KEY(frame_height, CONF_UINT, 1),
+  CONF_KEY(threshold, CONF_UINT, 1),
+  CONF_KEY(min_area, CONF_UINT, 1),
+  CONF_KEY(max_area, CONF_UINT, 1),
+  CONF_KEY(is_adaptive, CONF_UINT, 1),
+  CONF_KEY(noise_factor, CONF_DOUBLE, 1),
+  CONF_KEY(min_contrast, CONF_UINT, 1),
+  CONF_KEY(is_weighted, CONF_UINT, 1),
+  CONF_KEY(track_distance, CONF_UINT, 1),
+  CONF_KEY(track_inactive, CONF_UINT, 1),
+  CONF_KEY(use_lut, CONF_UINT, 1),
+  CONF_KEY(calib_max_error, CONF_DOUBLE, 1),
+  CONF_KEY(calib_distortion, CONF_UINT, 1),
+  CONF_KEY(is_auto_calib, CONF_UINT, 1),
+  CONF_KEY(marker_screen, CONF_INT, 8),
+  CONF_KEY(marker_period, CONF_UINT, 1),
+  CONF_KEY(marker_max_motion, CONF_DOUBLE, 1),
+  CONF_KEY(marker_radius, CONF_DOUBLE, 1),
+  CONF_KEY(calib_path, CONF_STRING, IWB_PATH_SIZE),
+  CONF_KEY(is_async, CONF_UINT, 1)
+};
+
+static const conf_key_t* find_conf_key
+(
+ const char* name,
+ size_t name_len
+)
+{
+  unsigned int i;
+
+  for (i = 0; i < sizeof(conf_keys) / sizeof(conf_keys[0]); ++i)
+  {
+    if (strlen(conf_keys[i].name) != name_len) continue ;
+    if (strncmp(conf_keys[i].name, name, name_len)) continue ;
+    return &conf_keys[i];
+  }
+
+  return NULL;
+}
+
+static uint32_t get_conf_key_bit(const conf_key_t* key)
+{
+  return (uint32_t)1 << (key - conf_keys);
+}
+
+static iwb_error_t set_conf_value
+(
+ iwb_conf_t* conf,
+ const char* name,
+ size_t name_len,
+ const char* value
+)
+{
+  const conf_key_t* const key = find_conf_key(name, name_len);
+  unsigned char* const p = (unsigned char*)conf;
+  char* end;
+  unsigned int i;
+
+  if (key == NULL) return IWB_ERR_INVALID;
+
+  if (key->type == CONF_STRING)
+  {
+    if (strlen(value) >= key->count) return IWB_ERR_INVALID;
+    strcpy((char*)(p + key->off), value);
+    conf->set_keys |= get_conf_key_bit(key);
+    return IWB_ERR_SUCCESS;
+  }
+
+  /* parsed aside, conf is left unchanged on error */
+  {
+    union { unsigned int u; int i; double d; } values[8];
+
+    for (i = 0; i < key->count; ++i)
+    {
+      if (key->type == CONF_UINT) values[i].u = (unsigned int)strtoul(value, &end, 0);
+      else if (key->type == CONF_INT) values[i].i = (int)strtol(value, &end, 0);
+      else values[i].d = strtod(value, &end);
+      if (end == value) return IWB_ERR_INVALID;
+      value = end;
+    }
+
+    while ((*value == ' ') || (*value == '\t')) ++value;
+    if (*value) return IWB_ERR_INVALID;
+
+    for (i = 0; i < key->count; ++i)
+    {
+      if (key->type == CONF_UINT) ((unsigned int*)(p + key->off))[i] = values[i].u;
+      else if (key->type == CONF_INT) ((int*)(p + key->off))[i] = values[i].i;
+      else ((double*)(p + key->off))[i] = values[i].d;
+    }
+  }
+
+  conf->set_keys |= get_conf_key_bit(key);
+
+  return IWB_ERR_SUCCESS;
+}
+
+static char* trim(char* s)
+{
+  char* e;
+
+  while ((*s == ' ') || (*s == '\t')) ++s;
+
+  e = s + strlen(s);
+  while ((e != s) && ((e[-1] == ' ') || (e[-1] == '\t') ||
+                      (e[-1] == '\n') || (e[-1] == '\r')))
+    --e;
+  *e = 0;
+
+  return s;
+}
+
+iwb_error_t iwb_conf_load_file
+(
+ iwb_state_t* state,
+ const char* path,
+ iwb_conf_t* conf
+)
+{
+  char line[512];
+  char* name;
+  char* value;
+  char* p;
+  FILE* file;
+  iwb_error_t err = IWB_ERR_SUCCESS;
+
+  file = fopen(path, "r");
+  if (file == NULL) return IWB_ERR_FILE;
+
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    p = strchr(line, '#');
+    if (p != NULL) *p = 0;
+
+    name = trim(line);
+    if (*name == 0) continue ;
+
+    p = strchr(name, '=');
+    if (p == NULL)
+    {
+      err = IWB_ERR_INVALID;
+      break ;
+    }
+    *p = 0;
+
+    name = trim(name);
+    value = trim(p + 1);
+
+    err = set_conf_value(conf, name, strlen(name), value);
+    if (err != IWB_ERR_SUCCESS) break ;
+  }
+
+  fclose(file);
+
+  return err;
+}
+
+iwb_error_t iwb_conf_load_av
+(
+ iwb_state_t* state,
+ int ac,
+ const char** av,
+ iwb_conf_t* conf
+)
+{
+  const char* name;
+  const char* value;
+  size_t len;
+  iwb_error_t err;
+  int i;
+
+  for (i = 0; i < ac; ++i)
+  {
+    if (strncmp(av[i], "--", 2)) return IWB_ERR_INVALID;
+    name = av[i] + 2;
+
+    value = strchr(name, '=');
+    if (value != NULL)
+    {
+      len = value - name;
+      ++value;
+    }
+    else
+    {
+      if (++i == ac) return IWB_ERR_INVALID;
+      len = strlen(name);
+      value = av[i];
+    }
+
+    err = set_conf_value(conf, name, len, value);
+    if (err != IWB_ERR_SUCCESS) return err;
+  }
+
+  return IWB_ERR_SUCCESS;
+}
+
+int iwb_conf_is_set
+(
+ const iwb_conf_t* conf,
+ const char* name
+)
+{
+  const conf_key_t* const key = find_conf_key(name, strlen(name));
+  if (key == NULL) return 0;
+  return (conf->set_keys & get_conf_key_bit(key)) != 0;
+}
+
+iwb_error_t iwb_state_init
+(
+ iwb_state_t* state,
+ iwb_conf_t* conf
+)
+{
+  CvSize size;
+  iwb_error_t err;
+
+  memset(state, 0, sizeof(iwb_state_t));
+  pthread_mutex_init(&state->lock, NULL);
+  state->event_fd = -1;
+
+  if (conf != NULL) state->conf = *conf;
+  else iwb_conf_load_default(state, &state->conf);
+
+  err = IWB_ERR_CAPTURE;
+  state->capture = cvCreateCameraCapture(state->conf.cam_index);
+  if (state->capture == NULL) goto on_error;
+
+  cvSetCaptureProperty
+    (state->capture, CV_CAP_PROP_FRAME_WIDTH, state->conf.frame_width);
+  cvSetCaptureProperty
+    (state->capture, CV_CAP_PROP_FRAME_HEIGHT, state->conf.frame_height);
+
+  /* the driver may not honor the requested size, use
+     the first frame to size the buffers
+   */
+  state->frame = cvQueryFrame(state->capture);
+  if (state->frame == NULL) goto on_error;
+
+  err = IWB_ERR_MEMORY;
+  size = cvGetSize(state->frame);
+  state->ir = cvCreateImage(size, IPL_DEPTH_8U, 1);
+  if (state->ir == NULL) goto on_error;
+  state->bin = cvCreateImage(size, IPL_DEPTH_8U, 1);
+  if (state->bin == NULL) goto on_error;
+  state->blob = iwb_blob_create(size.width, size.height);
+  if (state->blob == NULL) goto on_error;
+
+  set_identity(state->h);
+
+  if (state->conf.use_lut)
+  {
+    if (lut_create(state, size.width, size.height)) goto on_error;
+  }
+
+  if (state->conf.is_adaptive)
+  {
+    if (background_create(state, size.width, size.height)) goto on_error;
+  }
+
+  /* a missing or invalid store is not an error, the
+     calibration is then done again and saved
+   */
+  iwb_store_get_cam_id(state->conf.cam_index, state->cam_id, IWB_CAM_ID_SIZE);
+  if (state->conf.calib_path[0])
+    iwb_store_load(state, state->conf.calib_path);
+
+  if (state->conf.is_async)
+  {
+    if (state->conf.event_fn == NULL)
+    {
+      err = IWB_ERR_EVENT_FD;
+      state->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (state->event_fd == -1) goto on_error;
+    }
+
+    err = IWB_ERR_THREAD;
+    state->is_running = 1;
+    if (pthread_create(&state->worker, NULL, worker_entry, state))
+    {
+      state->is_running = 0;
+      goto on_error;
+    }
+  }
+
+  return IWB_ERR_SUCCESS;
+
+ on_error:
+  iwb_state_fini(state);
+  return err;
 }
 
-iwb_error_t iwb_conf_load_file
+iwb_error_t iwb_state_fini
 (
- iwb_state_t* state,
- const char* path,
- iwb_conf_t* conf
+ iwb_state_t* state
 )
 {
-  return IWB_ERR_UNIMPL;
+  if (state->is_running)
+  {
+    __atomic_store_n(&state->is_running, 0, __ATOMIC_RELEASE);
+    pthread_join(state->worker, NULL);
+  }
+
+  if (state->event_fd != -1) close(state->event_fd);
+  state->event_fd = -1;
+
+  if (state->lut != NULL) free(state->lut);
+  state->lut = NULL;
+
+  background_destroy(state);
+
+  if (state->blob != NULL) iwb_blob_destroy(state->blob);
+  if (state->bin != NULL) cvReleaseImage(&state->bin);
+  if (state->ir != NULL) cvReleaseImage(&state->ir);
+  if (state->capture != NULL) cvReleaseCapture(&state->capture);
+
+  state->blob = NULL;
+  state->frame = NULL;
+
+  pthread_mutex_destroy(&state->lock);
+
+  return IWB_ERR_SUCCESS;
 }
 
-iwb_error_t iwb_conf_load_av
+iwb_error_t iwb_get_next_frame
 (
- iwb_state_t* state,
- int ac,
- const char** av
+ iwb_state_t* state
 )
 {
-  return IWB_ERR_UNIMPL;
+  if (state->conf.is_async) return IWB_ERR_INVALID;
+  return grab_and_detect(state);
 }
 
-iwb_error_t iwb_state_init
+iwb_error_t iwb_poll_events
 (
  iwb_state_t* state,
- iwb_conf_t* conf
+ iwb_event_t* events,
+ unsigned int n,
+ unsigned int* count
 )
 {
-  return IWB_ERR_UNIMPL;
+  const unsigned int head =
+    __atomic_load_n(&state->ring_head, __ATOMIC_ACQUIRE);
+  unsigned int tail = state->ring_tail;
+
+  *count = 0;
+
+  if ((state->conf.is_async == 0) || (state->event_fd == -1))
+    return IWB_ERR_INVALID;
+
+  for (; (tail != head) && (*count < n); ++tail, ++*count)
+    events[*count] = state->ring[tail % IWB_EVENT_RING_SIZE];
+
+  __atomic_store_n(&state->ring_tail, tail, __ATOMIC_RELEASE);
+
+  /* the worker stopped on error */
+  if (*count == 0)
+    return __atomic_load_n(&state->worker_error, __ATOMIC_ACQUIRE);
+
+  return IWB_ERR_SUCCESS;
 }
 
-iwb_error_t iwb_state_fini
+int iwb_get_event_fd
 (
  iwb_state_t* state
 )
 {
-  return IWB_ERR_UNIMPL;
+  return state->event_fd;
 }
 
 iwb_error_t iwb_get_coords
@@ -72,7 +1139,61 @@ iwb_error_t iwb_get_coords
      . map using dims
    */
 
-  return IWB_ERR_UNIMPL;
+  const iwb_cam_pointer_t* primary;
+  iwb_error_t err;
+
+  if (state->conf.is_async) return IWB_ERR_INVALID;
+
+  if (state->has_frame == 0)
+  {
+    err = iwb_get_next_frame(state);
+    if (err != IWB_ERR_SUCCESS) return err;
+  }
+
+  /* calibration is done by the client (iwb_calib_update)
+     or, with conf.is_auto_calib, from the panel markers
+     as frames are grabbed
+   */
+
+  *is_pointer_on = 0;
+
+  primary = find_primary(state);
+  if (primary == NULL) return IWB_ERR_SUCCESS;
+
+  if (map_coords(state, primary->coords, coords))
+    return IWB_ERR_SUCCESS;
+
+  *is_pointer_on = 1;
+
+  return IWB_ERR_SUCCESS;
+}
+
+iwb_error_t iwb_get_pointers
+(
+ iwb_state_t* state,
+ iwb_pointer_t* pointers,
+ unsigned int n,
+ unsigned int* count
+)
+{
+  iwb_error_t err;
+  unsigned int i;
+
+  *count = 0;
+
+  if (state->conf.is_async) return IWB_ERR_INVALID;
+
+  if (state->has_frame == 0)
+  {
+    err = iwb_get_next_frame(state);
+    if (err != IWB_ERR_SUCCESS) return err;
+  }
+
+  for (i = 0; (i < state->npointers) && (*count < n); ++i)
+    if (map_pointer(state, &state->pointers[i], &pointers[*count]) == 0)
+      ++*count;
+
+  return IWB_ERR_SUCCESS;
 }
 
 iwb_error_t iwb_set_window_geometry
@@ -86,7 +1207,21 @@ iwb_error_t iwb_set_window_geometry
   /* set the window geometry for get_coords translation
    */
 
-  return IWB_ERR_UNIMPL;
+  if ((size_in_pixels[0] <= 0) || (size_in_pixels[1] <= 0))
+    return IWB_ERR_INVALID;
+
+  pthread_mutex_lock(&state->lock);
+  state->win_origin[0] = origin[0];
+  state->win_origin[1] = origin[1];
+  state->win_size[0] = size_in_pixels[0];
+  state->win_size[1] = size_in_pixels[1];
+  state->win_units[0] = size_in_user_units[0];
+  state->win_units[1] = size_in_user_units[1];
+  state->has_window = 1;
+  state->is_lut_dirty = 1;
+  pthread_mutex_unlock(&state->lock);
+
+  return IWB_ERR_SUCCESS;
 }
 
 iwb_error_t iwb_calib_reset
@@ -95,19 +1230,587 @@ iwb_error_t iwb_calib_reset
 )
 {
   /* delete the calibration points */
+  state->calib_npoints = 0;
+
   /* set the calibration to identity */
+  pthread_mutex_lock(&state->lock);
+  set_identity(state->h);
+  state->has_distortion = 0;
+  state->is_calibrated = 0;
+  state->has_marker_ref = 0;
+  state->is_lut_dirty = 1;
+  pthread_mutex_unlock(&state->lock);
 
-  return IWB_ERR_UNIMPL;
+  return IWB_ERR_SUCCESS;
 }
 
-iwb_errort iwb_calib_add_point
+iwb_error_t iwb_calib_add_point
 (
  iwb_state_t* state,
  int cam_coords[2],
  int screen_coords[2]
 )
 {
-  return IWB_ERR_UNIMPL;
+  const unsigned int i = state->calib_npoints;
+
+  if (i == IWB_CALIB_MAX_POINTS) return IWB_ERR_INVALID;
+
+  state->calib_cam[i * 2 + 0] = (double)cam_coords[0];
+  state->calib_cam[i * 2 + 1] = (double)cam_coords[1];
+  state->calib_screen[i * 2 + 0] = (double)screen_coords[0];
+  state->calib_screen[i * 2 + 1] = (double)screen_coords[1];
+  state->calib_error[i] = 0;
+  state->calib_is_inlier[i] = 0;
+  ++state->calib_npoints;
+
+  return IWB_ERR_SUCCESS;
+}
+
+/* calibration solver. the homography is fitted on
+   normalized points (hartley): both sets are centered
+   and scaled to a mean distance of sqrt(2), which keeps
+   the system well conditioned whatever the resolution.
+   the camera centroid maps to the origin and always to
+   a finite screen point, so h[8] = 1 loses nothing.
+ */
+
+#define CALIB_RANSAC_ITERS 256
+#define CALIB_LM_ITERS 50
+#define CALIB_DISTORTION_MIN_POINTS 9
+
+static void mat3_mul(const double* a, const double* b, double* c)
+{
+  unsigned int i;
+  unsigned int j;
+
+  for (i = 0; i < 3; ++i)
+    for (j = 0; j < 3; ++j)
+      c[i * 3 + j] = a[i * 3 + 0] * b[0 * 3 + j] +
+        a[i * 3 + 1] * b[1 * 3 + j] + a[i * 3 + 2] * b[2 * 3 + j];
+}
+
+static void get_transform(const double* t, unsigned int is_inverse, double* m)
+{
+  /* matrix of normalized = t[0] * point - (t[1], t[2]),
+     or of its inverse
+   */
+
+  const double s = is_inverse ? 1 / t[0] : t[0];
+  const double o = is_inverse ? 1 / t[0] : -1;
+
+  m[0] = s; m[1] = 0; m[2] = o * t[1];
+  m[3] = 0; m[4] = s; m[5] = o * t[2];
+  m[6] = 0; m[7] = 0; m[8] = 1;
+}
+
+static int change_basis
+(
+ const double* h,
+ const double* tin,
+ const double* tout,
+ unsigned int is_inverse,
+ double* hh
+)
+{
+  /* hh = Tout * h * inv(Tin), or inv(Tout) * h * Tin */
+
+  double a[9];
+  double b[9];
+  double m[9];
+  unsigned int i;
+
+  get_transform(tout, is_inverse, a);
+  get_transform(tin, !is_inverse, b);
+  mat3_mul(h, b, m);
+  mat3_mul(a, m, hh);
+
+  if (fabs(hh[8]) < 1e-12) return -1;
+  for (i = 0; i < 9; ++i) hh[i] /= hh[8];
+  hh[8] = 1;
+
+  return 0;
+}
+
+static void normalize_points
+(
+ const double* points,
+ const unsigned int* indices,
+ unsigned int n,
+ double* normalized,
+ double* t
+)
+{
+  /* t = { scale, x offset, y offset }, so that
+     normalized = scale * point - offset
+   */
+
+  double c[2] = { 0, 0 };
+  double d = 0;
+  unsigned int i;
+
+  for (i = 0; i < n; ++i)
+  {
+    c[0] += points[indices[i] * 2 + 0];
+    c[1] += points[indices[i] * 2 + 1];
+  }
+  c[0] /= n;
+  c[1] /= n;
+
+  for (i = 0; i < n; ++i)
+  {
+    const double dx = points[indices[i] * 2 + 0] - c[0];
+    const double dy = points[indices[i] * 2 + 1] - c[1];
+    d += sqrt(dx * dx + dy * dy);
+  }
+  d /= n;
+
+  t[0] = (d > 1e-12) ? sqrt(2) / d : 1;
+  t[1] = t[0] * c[0];
+  t[2] = t[0] * c[1];
+
+  for (i = 0; i < n; ++i)
+  {
+    normalized[i * 2 + 0] = t[0] * points[indices[i] * 2 + 0] - t[1];
+    normalized[i * 2 + 1] = t[0] * points[indices[i] * 2 + 1] - t[2];
+  }
+}
+
+static int fit_homography
+(
+ const double* cam,
+ const double* screen,
+ const unsigned int* indices,
+ unsigned int npoints,
+ double* h
+)
+{
+  /* same system as ui/main.c calibrate, 2 equations per
+     point, on normalized points. the matrices live on
+     the stack, no allocation.
+   */
+
+  double a_data[IWB_CALIB_MAX_POINTS * 2 * 8];
+  double b_data[IWB_CALIB_MAX_POINTS * 2];
+  double x_data[8];
+  double ncam[IWB_CALIB_MAX_POINTS * 2];
+  double nscreen[IWB_CALIB_MAX_POINTS * 2];
+  double tc[3];
+  double ts[3];
+  double hn[9];
+  CvMat a;
+  CvMat b;
+  CvMat x;
+  unsigned int i;
+
+  normalize_points(cam, indices, npoints, ncam, tc);
+  normalize_points(screen, indices, npoints, nscreen, ts);
+
+  for (i = 0; i < npoints; ++i)
+  {
+    const double imx = ncam[i * 2 + 0];
+    const double imy = ncam[i * 2 + 1];
+    const double obx = nscreen[i * 2 + 0];
+    const double oby = nscreen[i * 2 + 1];
+    double* const row0 = a_data + (i * 2 + 0) * 8;
+    double* const row1 = a_data + (i * 2 + 1) * 8;
+
+    /* first equation, xcor = ... */
+    row0[0] = imx;
+    row0[1] = imy;
+    row0[2] = 1;
+    row0[3] = 0;
+    row0[4] = 0;
+    row0[5] = 0;
+    row0[6] = -1 * obx * imx;
+    row0[7] = -1 * obx * imy;
+
+    /* second equation, ycor = ... */
+    row1[0] = 0;
+    row1[1] = 0;
+    row1[2] = 0;
+    row1[3] = imx;
+    row1[4] = imy;
+    row1[5] = 1;
+    row1[6] = -1 * oby * imx;
+    row1[7] = -1 * oby * imy;
+
+    b_data[i * 2 + 0] = obx;
+    b_data[i * 2 + 1] = oby;
+  }
+
+  a = cvMat(npoints * 2, 8, CV_64FC1, a_data);
+  b = cvMat(npoints * 2, 1, CV_64FC1, b_data);
+  x = cvMat(8, 1, CV_64FC1, x_data);
+
+  /* exact for 4 points, least squares above. fails on
+     degenerate sets (3 points on a line).
+   */
+  if (cvSolve(&a, &b, &x, (npoints == 4) ? CV_LU : CV_SVD) == 0)
+    return -1;
+
+  /* back to pixels: h = inv(Ts) * hn * Tc */
+  for (i = 0; i < 8; ++i) hn[i] = x_data[i];
+  hn[8] = 1;
+
+  return change_basis(hn, tc, ts, 1, h);
+}
+
+static double reprojection_error
+(
+ const double* h,
+ const iwb_distortion_t* d,
+ const double* cam,
+ const double* screen
+)
+{
+  /* distance in screen pixels. d may be NULL */
+
+  double u[2];
+  double p[2];
+
+  if (d != NULL)
+  {
+    undistort(d, cam, u);
+    cam = u;
+  }
+
+  if (apply_homography(h, cam, p)) return HUGE_VAL;
+
+  return sqrt((p[0] - screen[0]) * (p[0] - screen[0]) +
+              (p[1] - screen[1]) * (p[1] - screen[1]));
+}
+
+static unsigned int find_inliers
+(
+ const iwb_state_t* state,
+ unsigned int* inliers
+)
+{
+  /* ransac over minimal 4 point sets: keep the largest
+     set of points agreeing with one of them. the seed
+     is fixed, the same clicks give the same result.
+   */
+
+  const unsigned int npoints = state->calib_npoints;
+  unsigned int seed = 1;
+  unsigned int best = 0;
+  unsigned int sample[4];
+  unsigned int set[IWB_CALIB_MAX_POINTS];
+  unsigned int count;
+  unsigned int iter;
+  unsigned int i;
+  unsigned int j;
+  double h[9];
+
+  for (iter = 0; (iter < CALIB_RANSAC_ITERS) && (best < npoints); ++iter)
+  {
+    for (i = 0; i < 4; ++i)
+    {
+      do
+      {
+        sample[i] = (unsigned int)rand_r(&seed) % npoints;
+        for (j = 0; (j < i) && (sample[j] != sample[i]); ++j) ;
+      } while (j != i);
+    }
+
+    if (fit_homography(state->calib_cam, state->calib_screen, sample, 4, h))
+      continue ;
+
+    count = 0;
+    for (i = 0; i < npoints; ++i)
+    {
+      const double e = reprojection_error
+        (h, NULL, state->calib_cam + i * 2, state->calib_screen + i * 2);
+      if (e <= state->conf.calib_max_error) set[count++] = i;
+    }
+
+    if (count > best)
+    {
+      best = count;
+      memcpy(inliers, set, count * sizeof(unsigned int));
+    }
+  }
+
+  return best;
+}
+
+static int get_residuals
+(
+ const double* q,
+ const double* ncam,
+ const double* nscreen,
+ unsigned int npoints,
+ double* r
+)
+{
+  /* q: normalized homography (8) then distortion (4) */
+
+  double u[2];
+  double p[2];
+  double hn[9];
+  unsigned int i;
+
+  for (i = 0; i < 8; ++i) hn[i] = q[i];
+  hn[8] = 1;
+
+  for (i = 0; i < npoints; ++i)
+  {
+    u[0] = ncam[i * 2 + 0];
+    u[1] = ncam[i * 2 + 1];
+    undistort_normalized(q + 8, u);
+    if (apply_homography(hn, u, p)) return -1;
+    r[i * 2 + 0] = p[0] - nscreen[i * 2 + 0];
+    r[i * 2 + 1] = p[1] - nscreen[i * 2 + 1];
+  }
+
+  return 0;
+}
+
+static double get_cost(const double* r, unsigned int n)
+{
+  double cost = 0;
+  unsigned int i;
+  for (i = 0; i < n; ++i) cost += r[i] * r[i];
+  return cost;
+}
+
+static int fit_distortion
+(
+ const iwb_state_t* state,
+ const unsigned int* inliers,
+ unsigned int npoints,
+ double* h,
+ iwb_distortion_t* d
+)
+{
+  /* levenberg marquardt on the homography and the lens
+     distortion together, from the current h and d->k.
+     camera points are normalized by the lens center and
+     focal, screen points as in fit_homography, so that
+     all the parameters are about 1.
+   */
+
+#define NPARAMS 12
+
+  const unsigned int nrows = npoints * 2;
+  double a_data[(IWB_CALIB_MAX_POINTS * 2 + NPARAMS) * NPARAMS];
+  double b_data[IWB_CALIB_MAX_POINTS * 2 + NPARAMS];
+  double x_data[NPARAMS];
+  double r[IWB_CALIB_MAX_POINTS * 2];
+  double rr[IWB_CALIB_MAX_POINTS * 2];
+  double ncam[IWB_CALIB_MAX_POINTS * 2];
+  double nscreen[IWB_CALIB_MAX_POINTS * 2];
+  double q[NPARAMS];
+  double qq[NPARAMS];
+  double tc[3];
+  double ts[3];
+  double hn[9];
+  double lambda = 1e-3;
+  double cost;
+  double new_cost;
+  unsigned int iter;
+  unsigned int i;
+  unsigned int j;
+  CvMat a;
+  CvMat b;
+  CvMat x;
+
+  tc[0] = 1 / d->focal;
+  tc[1] = d->center[0] / d->focal;
+  tc[2] = d->center[1] / d->focal;
+
+  for (i = 0; i < npoints; ++i)
+  {
+    ncam[i * 2 + 0] = tc[0] * state->calib_cam[inliers[i] * 2 + 0] - tc[1];
+    ncam[i * 2 + 1] = tc[0] * state->calib_cam[inliers[i] * 2 + 1] - tc[2];
+  }
+  normalize_points(state->calib_screen, inliers, npoints, nscreen, ts);
+
+  /* hn = Ts * h * inv(Tc) */
+  if (change_basis(h, tc, ts, 0, hn)) return -1;
+  for (i = 0; i < 8; ++i) q[i] = hn[i];
+  for (i = 0; i < 4; ++i) q[8 + i] = d->k[i];
+
+  if (get_residuals(q, ncam, nscreen, npoints, r)) return -1;
+  cost = get_cost(r, nrows);
+
+  for (iter = 0; iter < CALIB_LM_ITERS; ++iter)
+  {
+    /* forward difference jacobian, then the damped
+       normal step as an augmented least squares
+     */
+
+    for (j = 0; j < NPARAMS; ++j)
+    {
+      const double eps = 1e-7;
+
+      memcpy(qq, q, sizeof(q));
+      qq[j] += eps;
+      if (get_residuals(qq, ncam, nscreen, npoints, rr)) return -1;
+      for (i = 0; i < nrows; ++i)
+        a_data[i * NPARAMS + j] = (rr[i] - r[i]) / eps;
+    }
+
+    for (i = 0; i < nrows; ++i) b_data[i] = -r[i];
+    for (i = 0; i < NPARAMS; ++i)
+    {
+      for (j = 0; j < NPARAMS; ++j)
+        a_data[(nrows + i) * NPARAMS + j] = (i == j) ? sqrt(lambda) : 0;
+      b_data[nrows + i] = 0;
+    }
+
+    a = cvMat(nrows + NPARAMS, NPARAMS, CV_64FC1, a_data);
+    b = cvMat(nrows + NPARAMS, 1, CV_64FC1, b_data);
+    x = cvMat(NPARAMS, 1, CV_64FC1, x_data);
+    if (cvSolve(&a, &b, &x, CV_SVD) == 0) return -1;
+
+    for (i = 0; i < NPARAMS; ++i) qq[i] = q[i] + x_data[i];
+
+    if ((get_residuals(qq, ncam, nscreen, npoints, rr) == 0) &&
+        ((new_cost = get_cost(rr, nrows)) < cost))
+    {
+      const unsigned int is_done = (cost - new_cost) < 1e-12 * cost;
+
+      memcpy(q, qq, sizeof(q));
+      memcpy(r, rr, nrows * sizeof(double));
+      cost = new_cost;
+      lambda /= 10;
+
+      if (is_done) break ;
+    }
+    else
+    {
+      lambda *= 10;
+      if (lambda > 1e8) break ;
+    }
+  }
+
+#undef NPARAMS
+
+  /* back to pixels: h = inv(Ts) * hn * Tc */
+  for (i = 0; i < 8; ++i) hn[i] = q[i];
+  hn[8] = 1;
+  if (change_basis(hn, tc, ts, 1, h)) return -1;
+
+  for (i = 0; i < 4; ++i) d->k[i] = q[8 + i];
+
+  return 0;
+}
+
+static int fit_model
+(
+ const iwb_state_t* state,
+ const unsigned int* inliers,
+ unsigned int npoints,
+ double* h,
+ iwb_distortion_t* d
+)
+{
+  /* homography and distortion, from a linear fit */
+
+  d->k[0] = 0;
+  d->k[1] = 0;
+  d->k[2] = 0;
+  d->k[3] = 0;
+
+  if (fit_homography(state->calib_cam, state->calib_screen, inliers, npoints, h))
+    return -1;
+
+  return fit_distortion(state, inliers, npoints, h, d);
+}
+
+static unsigned int find_distortion_inliers
+(
+ const iwb_state_t* state,
+ unsigned int* inliers,
+ double* h,
+ iwb_distortion_t* d
+)
+{
+  /* with a distorted image, the corners are far from any
+     homography and ransac would reject them. instead, fit
+     all the points and, while some point disagrees, drop
+     the one worst predicted by a fit without it: a bad
+     click in a corner pulls a fit including it and hides
+     among the good ones otherwise. then take back the
+     dropped points agreeing with the final fit, once.
+     returns 0 on failure.
+   */
+
+  const unsigned int npoints = state->calib_npoints;
+  unsigned int ninliers = npoints;
+  unsigned int is_grown = 0;
+  unsigned int count;
+  unsigned int worst;
+  unsigned int tmp;
+  unsigned int i;
+  double worst_error;
+  double hh[9];
+  iwb_distortion_t dd;
+  double e;
+
+  for (i = 0; i < npoints; ++i) inliers[i] = i;
+
+  while (1)
+  {
+    if (fit_model(state, inliers, ninliers, h, d)) return 0;
+
+    worst_error = 0;
+    for (i = 0; i < ninliers; ++i)
+    {
+      e = reprojection_error
+        (h, d, state->calib_cam + inliers[i] * 2, state->calib_screen + inliers[i] * 2);
+      if (e > worst_error) worst_error = e;
+    }
+
+    if (worst_error <= state->conf.calib_max_error)
+    {
+      count = 0;
+      for (i = 0; i < npoints; ++i)
+      {
+        e = reprojection_error
+          (h, d, state->calib_cam + i * 2, state->calib_screen + i * 2);
+        if (e <= state->conf.calib_max_error) inliers[count++] = i;
+      }
+
+      if (is_grown || (count <= ninliers)) break ;
+
+      is_grown = 1;
+      ninliers = count;
+      continue ;
+    }
+
+    if (ninliers == CALIB_DISTORTION_MIN_POINTS) return 0;
+
+    /* leave one out, the point left is moved last */
+    worst = 0;
+    worst_error = -1;
+    for (i = 0; i < ninliers; ++i)
+    {
+      tmp = inliers[i];
+      inliers[i] = inliers[ninliers - 1];
+      inliers[ninliers - 1] = tmp;
+
+      e = HUGE_VAL;
+      dd = *d;
+      if (fit_model(state, inliers, ninliers - 1, hh, &dd) == 0)
+        e = reprojection_error
+          (hh, &dd, state->calib_cam + tmp * 2, state->calib_screen + tmp * 2);
+
+      inliers[ninliers - 1] = inliers[i];
+      inliers[i] = tmp;
+
+      if (e > worst_error)
+      {
+        worst = i;
+        worst_error = e;
+      }
+    }
+
+    inliers[worst] = inliers[--ninliers];
+  }
+
+  return ninliers;
 }
 
 iwb_error_t iwb_calib_update
@@ -115,5 +1818,272 @@ iwb_error_t iwb_calib_update
  iwb_state_t* state
 )
 {
-  return IWB_ERR_UNIMPL;
+  const unsigned int npoints = state->calib_npoints;
+  unsigned int inliers[IWB_CALIB_MAX_POINTS];
+  unsigned int ninliers = npoints;
+  unsigned int is_consistent = 1;
+  unsigned int has_distortion = 0;
+  iwb_distortion_t d;
+  unsigned int i;
+  double h[9];
+
+  if (npoints < 4) return IWB_ERR_CALIB;
+
+  /* lens distortion, only from a dense enough grid. the
+     center is the one of the frame, the focal is unknown
+     and set to half the frame width, the parameters
+     absorb it.
+   */
+  if (state->conf.calib_distortion &&
+      (npoints >= CALIB_DISTORTION_MIN_POINTS) && (state->ir != NULL))
+  {
+    d.center[0] = (double)state->ir->width / 2;
+    d.center[1] = (double)state->ir->height / 2;
+    d.focal = (double)state->ir->width / 2;
+
+    ninliers = find_distortion_inliers(state, inliers, h, &d);
+    has_distortion = (ninliers != 0);
+  }
+
+  if (has_distortion == 0)
+  {
+    for (i = 0; i < npoints; ++i) inliers[i] = i;
+    ninliers = npoints;
+
+    /* a bad click can only be told from the others if
+       there are more points than unknowns
+     */
+    if (npoints > 4)
+    {
+      ninliers = find_inliers(state, inliers);
+      if (ninliers < 4)
+      {
+        /* no consensus, fit everything to report errors */
+        is_consistent = 0;
+        ninliers = npoints;
+        for (i = 0; i < npoints; ++i) inliers[i] = i;
+      }
+    }
+
+    /* least squares on the inliers */
+    if (fit_homography(state->calib_cam, state->calib_screen, inliers, ninliers, h))
+      return IWB_ERR_CALIB;
+  }
+
+  for (i = 0; i < npoints; ++i)
+  {
+    state->calib_error[i] = reprojection_error
+      (h, has_distortion ? &d : NULL,
+       state->calib_cam + i * 2, state->calib_screen + i * 2);
+    state->calib_is_inlier[i] =
+      (state->calib_error[i] <= state->conf.calib_max_error);
+  }
+
+  if (is_consistent == 0) return IWB_ERR_CALIB;
+
+  pthread_mutex_lock(&state->lock);
+  for (i = 0; i < 9; ++i) state->h[i] = h[i];
+  state->has_distortion = has_distortion;
+  if (has_distortion) state->distortion = d;
+  state->is_calibrated = 1;
+  state->has_marker_ref = 0;
+  state->is_lut_dirty = 1;
+  pthread_mutex_unlock(&state->lock);
+
+  return IWB_ERR_SUCCESS;
+}
+
+iwb_error_t iwb_calib_save
+(
+ iwb_state_t* state
+)
+{
+  if (state->conf.calib_path[0] == 0) return IWB_ERR_INVALID;
+  if (state->ir == NULL) return IWB_ERR_INVALID;
+
+  /* saved with an up to date table, nothing to do at load */
+  pthread_mutex_lock(&state->lock);
+  if ((state->lut != NULL) && state->is_lut_dirty) lut_update(state);
+  pthread_mutex_unlock(&state->lock);
+
+  if (iwb_store_save(state, state->conf.calib_path)) return IWB_ERR_FILE;
+
+  return IWB_ERR_SUCCESS;
+}
+
+iwb_error_t iwb_calib_get_errors
+(
+ iwb_state_t* state,
+ double* errors,
+ unsigned int* is_inlier,
+ unsigned int n,
+ unsigned int* count
+)
+{
+  unsigned int i;
+
+  *count = (state->calib_npoints < n) ? state->calib_npoints : n;
+
+  for (i = 0; i < *count; ++i)
+  {
+    errors[i] = state->calib_error[i];
+    if (is_inlier != NULL) is_inlier[i] = state->calib_is_inlier[i];
+  }
+
+  return IWB_ERR_SUCCESS;
+}
+
+
+/* automatic calibration from the panel markers. they are
+   looked for in every frame, a position seen in enough
+   consecutive frames is a candidate. every marker_period,
+   a candidate away from the reference (the positions the
+   calibration is valid for) means the camera moved.
+ */
+
+#define MARKER_STABLE_FRAMES 8
+
+static double get_marker_motion(const double* a, const double* b)
+{
+  /* largest displacement among the 4 markers */
+
+  double motion = 0;
+  double d;
+  unsigned int i;
+
+  for (i = 0; i < 4; ++i)
+  {
+    d = hypot(a[i * 2 + 0] - b[i * 2 + 0], a[i * 2 + 1] - b[i * 2 + 1]);
+    if (d > motion) motion = d;
+  }
+
+  return motion;
+}
+
+static void check_markers(iwb_state_t* state)
+{
+  /* lock held */
+
+  static const unsigned int indices[4] = { 0, 1, 2, 3 };
+
+  double cand[8];
+  double ref[8];
+  double screen[8];
+  double h[9];
+  double m[9];
+  unsigned int i;
+
+  if (state->marker_nstable < MARKER_STABLE_FRAMES) return ;
+
+  /* the first position is taken at once */
+  if (state->has_marker_ref &&
+      ((state->frame_time - state->marker_time) <
+       (uint64_t)state->conf.marker_period * 1000000ULL))
+    return ;
+  state->marker_time = state->frame_time;
+
+  if (state->has_marker_ref &&
+      (get_marker_motion(state->marker_candidate, state->marker_ref) <=
+       state->conf.marker_max_motion))
+    return ;
+
+  /* the homography applies to undistorted points */
+  for (i = 0; i < 4; ++i)
+  {
+    if (state->has_distortion)
+    {
+      undistort(&state->distortion, state->marker_candidate + i * 2, cand + i * 2);
+      undistort(&state->distortion, state->marker_ref + i * 2, ref + i * 2);
+    }
+    else
+    {
+      cand[i * 2 + 0] = state->marker_candidate[i * 2 + 0];
+      cand[i * 2 + 1] = state->marker_candidate[i * 2 + 1];
+      ref[i * 2 + 0] = state->marker_ref[i * 2 + 0];
+      ref[i * 2 + 1] = state->marker_ref[i * 2 + 1];
+    }
+    screen[i * 2 + 0] = (double)state->conf.marker_screen[i * 2 + 0];
+    screen[i * 2 + 1] = (double)state->conf.marker_screen[i * 2 + 1];
+  }
+
+  if (state->is_calibrated == 0)
+  {
+    /* no calibration, markers to their screen position */
+    if (fit_homography(cand, screen, indices, 4, h)) return ;
+    for (i = 0; i < 9; ++i) state->h[i] = h[i];
+    state->is_calibrated = 1;
+  }
+  else if (state->has_marker_ref)
+  {
+    /* the camera moved, keep the calibration and undo
+       the motion first: h = h * m, m from the new marker
+       positions to the reference ones. a calibration
+       from many points, and its distortion, is kept.
+     */
+    if (fit_homography(cand, ref, indices, 4, m)) return ;
+    mat3_mul(state->h, m, h);
+    if (fabs(h[8]) < 1e-12) return ;
+    for (i = 0; i < 9; ++i) state->h[i] = h[i] / h[8];
+  }
+
+  /* otherwise calibrated by the client, only the
+     reference is taken
+   */
+  memcpy(state->marker_ref, state->marker_candidate, sizeof(state->marker_ref));
+  state->has_marker_ref = 1;
+  state->is_lut_dirty = 1;
+  ++state->marker_nupdates;
+}
+
+static void update_markers
+(
+ iwb_state_t* state,
+ double* excluded,
+ unsigned int* nexcluded
+)
+{
+  /* excluded gets the marker positions, 8 at most */
+
+  double markers[8];
+
+  if (iwb_blob_find_markers(state->blob, markers) == 0)
+  {
+    if (state->marker_nstable &&
+        (get_marker_motion(markers, state->marker_candidate) <=
+         state->conf.marker_max_motion))
+    {
+      if (state->marker_nstable < MARKER_STABLE_FRAMES) ++state->marker_nstable;
+    }
+    else
+    {
+      memcpy(state->marker_candidate, markers, sizeof(markers));
+      state->marker_nstable = 1;
+    }
+  }
+  else
+  {
+    /* occluded, or the stylus is one of the extremes */
+    state->marker_nstable = 0;
+  }
+
+  /* the client may calibrate meanwhile */
+  pthread_mutex_lock(&state->lock);
+
+  /* the marker blobs, where they were and may be now */
+  *nexcluded = 0;
+  if (state->has_marker_ref)
+  {
+    memcpy(excluded, state->marker_ref, sizeof(state->marker_ref));
+    *nexcluded = 4;
+  }
+  if (state->marker_nstable)
+  {
+    memcpy(excluded + *nexcluded * 2, state->marker_candidate, sizeof(markers));
+    *nexcluded += 4;
+  }
+  iwb_blob_exclude(state->blob, excluded, *nexcluded, state->conf.marker_radius);
+
+  check_markers(state);
+
+  pthread_mutex_unlock(&state->lock);
 }
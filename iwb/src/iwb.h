@@ -2,24 +2,26 @@
 # define IWB_H_INCLUDED
 
 
+#include <stdint.h>
+#include <pthread.h>
 
-/* iwb internal state, opaque to client
+
+/* opencv and cvblob types, only used through pointers
  */
 
-typedef struct iwb_state
-{
-  /* TODO: video input opencv context */
-  /* TODO: calibration matrix */
-} iwb_state_t;
+struct CvCapture;
+struct _IplImage;
+struct iwb_blob;
 
 
-/* configuration, opaque to client
+/* limits
  */
 
-typedef struct iwb_conf
-{
-  /* TODO: video input */
-} iwb_conf_t;
+#define IWB_CALIB_MAX_POINTS 32
+#define IWB_EVENT_RING_SIZE 256
+#define IWB_MAX_POINTERS 16
+#define IWB_CAM_ID_SIZE 64
+#define IWB_PATH_SIZE 256
 
 
 /* error type
@@ -29,14 +31,318 @@ typedef enum iwb_error
 {
   IWB_ERR_SUCCESS = 0,
   IWB_ERR_UNIMPL,
+  IWB_ERR_INVALID,
+  IWB_ERR_CAPTURE,
+  IWB_ERR_CALIB,
+  IWB_ERR_FILE,
+  IWB_ERR_MEMORY,
+  IWB_ERR_EVENT_FD,
+  IWB_ERR_THREAD,
   IWB_ERR_MAX
 } iwb_error_t;
 
 
+/* pointers
+ */
+
+typedef enum iwb_pointer_state
+{
+  IWB_POINTER_DOWN = 0, /* appeared in this frame */
+  IWB_POINTER_MOVE,     /* seen in this frame and before */
+  IWB_POINTER_OCCLUDED, /* missing for a few frames, last position */
+  IWB_POINTER_UP        /* lifted, last position, reported once */
+} iwb_pointer_state_t;
+
+typedef struct iwb_pointer
+{
+  /* stable while the pointer is down */
+  unsigned int id;
+  iwb_pointer_state_t state;
+
+  /* same units as iwb_get_coords */
+  int coords[2];
+
+  /* pressure proxy: blob area in camera pixels, the spot
+     grows as the stylus is pressed or gets closer
+   */
+  unsigned int area;
+} iwb_pointer_t;
+
+/* same, camera coordinates. internal */
+typedef struct iwb_cam_pointer
+{
+  unsigned int id;
+  iwb_pointer_state_t state;
+  double coords[2];
+  unsigned int area;
+} iwb_cam_pointer_t;
+
+
+/* lens distortion, camera pixels
+ */
+
+typedef struct iwb_distortion
+{
+  /* normalized coordinates are (p - center) / focal */
+  double center[2];
+  double focal;
+
+  /* radial k1, k2 then tangential p1, p2 */
+  double k[4];
+} iwb_distortion_t;
+
+
+/* pointer events, async mode
+ */
+
+typedef enum iwb_event_type
+{
+  IWB_EVENT_DOWN = 0,
+  IWB_EVENT_MOVE,
+  IWB_EVENT_UP
+} iwb_event_type_t;
+
+typedef struct iwb_event
+{
+  iwb_event_type_t type;
+
+  /* pointer, see iwb_pointer_t */
+  unsigned int id;
+  int coords[2];
+  unsigned int area;
+
+  /* capture time, CLOCK_MONOTONIC nanoseconds */
+  uint64_t timestamp;
+
+  /* frame sequence number */
+  unsigned int seq;
+} iwb_event_t;
+
+/* called from the worker thread, must not block */
+typedef void (*iwb_event_fn_t)(const iwb_event_t*, void*);
+
+
+/* configuration, opaque to client
+ */
+
+typedef struct iwb_conf
+{
+  /* video input */
+  int cam_index;
+  unsigned int frame_width;
+  unsigned int frame_height;
+
+  /* stylus detection: pixels brighter than threshold,
+     blobs whose area is in [min_area, max_area].
+     threshold is not used when is_adaptive is set.
+   */
+  unsigned int threshold;
+  unsigned int min_area;
+  unsigned int max_area;
+
+  /* adaptive threshold, off by default. replaces
+     threshold when set: a pixel is lit if brighter than
+     the background around it by noise_factor times its
+     noise, min_contrast at least.
+     static hot spots (sunlight, projector, reflections)
+     become background after some seconds and no longer
+     show up as blobs. so does a stylus held still for
+     about 10 seconds.
+   */
+  unsigned int is_adaptive;
+  double noise_factor;
+  unsigned int min_contrast;
+
+  /* locate the stylus at the intensity weighted center
+     of its blob rather than the center of the thresholded
+     pixels: sub-pixel, and steady when the spot flickers
+     around the threshold
+   */
+  unsigned int is_weighted;
+
+  /* tracking: a blob continues a pointer if it is closer
+     than track_distance camera pixels. a pointer missing
+     for track_inactive frames is lifted.
+   */
+  unsigned int track_distance;
+  unsigned int track_inactive;
+
+  /* map camera to screen coordinates with a fixed point
+     lookup table instead of evaluating the calibration
+     for every point. see iwb_get_coords.
+   */
+  unsigned int use_lut;
+
+  /* calibration: a point further than calib_max_error
+     screen pixels from the fitted mapping is a bad click
+     and is left out of the fit
+   */
+  double calib_max_error;
+
+  /* estimate the lens distortion along with the mapping
+     when calibrating with 9 points or more
+   */
+  unsigned int calib_distortion;
+
+  /* automatic calibration: the 4 ir markers bounding the
+     board are detected, and mapped to marker_screen (top
+     left, top right, bottom right, bottom left) if there
+     is no calibration. their position is checked every
+     marker_period ms, if one moved by more than
+     marker_max_motion camera pixels the calibration is
+     corrected for the camera motion. blobs closer than
+     marker_radius to a marker are not pointers.
+   */
+  unsigned int is_auto_calib;
+  int marker_screen[8];
+  unsigned int marker_period;
+  double marker_max_motion;
+  double marker_radius;
+
+  /* calibration store, none if empty. the calibration
+     of the camera is loaded from it by iwb_state_init,
+     with the window geometry and the lookup table. the
+     stored detection settings (threshold, min_area,
+     max_area) only replace those not given in a file or
+     on the command line, see iwb_conf_is_set. see also
+     iwb_calib_save.
+   */
+  char calib_path[IWB_PATH_SIZE];
+
+  /* async mode: iwb_state_init starts a worker doing the
+     capture and vision work. events are passed to event_fn
+     if not NULL, or queued for iwb_poll_events otherwise.
+   */
+  unsigned int is_async;
+  iwb_event_fn_t event_fn;
+  void* event_opaque;
+
+  /* keys given to iwb_conf_load_file or iwb_conf_load_av,
+     one bit per key. cleared by iwb_conf_load_default.
+   */
+  uint32_t set_keys;
+} iwb_conf_t;
+
+
+/* iwb internal state, opaque to client
+ */
+
+typedef struct iwb_state
+{
+  iwb_conf_t conf;
+
+  /* calibration store key, see conf.calib_path */
+  char cam_id[IWB_CAM_ID_SIZE];
+
+  /* video input opencv context. the frame is owned
+     by the capture, other images are allocated once
+     in iwb_state_init.
+   */
+  struct CvCapture* capture;
+  struct _IplImage* frame;
+  struct _IplImage* ir;
+  struct _IplImage* bin;
+
+  /* stylus detection (cvblob). unlike the images, it
+     allocates every frame, see blob.h.
+   */
+  struct iwb_blob* blob;
+
+  /* last detection, camera coordinates */
+  unsigned int has_frame;
+  unsigned int npointers;
+  iwb_cam_pointer_t pointers[IWB_MAX_POINTERS];
+  uint64_t frame_time;
+  unsigned int frame_seq;
+
+  /* lowest threshold over the last frame */
+  unsigned int threshold;
+
+  /* ir background model, if conf.is_adaptive. per cell of
+     the frame, the mean and variance of the brightest pixel
+     then the threshold they give. see background_update.
+   */
+  int32_t* background;
+  uint8_t* bg_threshold;
+  uint16_t* bg_max;
+  unsigned int bg_width;
+  unsigned int bg_height;
+  unsigned int bg_nframes;
+
+  /* protects the calibration and window geometry, which
+     the client may change while the worker maps points
+   */
+  pthread_mutex_t lock;
+
+  /* async worker. the event ring is single producer (the
+     worker), single consumer (iwb_poll_events). event_fd
+     is an eventfd signaled on every queued event.
+   */
+  pthread_t worker;
+  unsigned int is_running;
+  iwb_error_t worker_error;
+  iwb_event_t ring[IWB_EVENT_RING_SIZE];
+  unsigned int ring_head;
+  unsigned int ring_tail;
+  unsigned int ring_overflows;
+  int event_fd;
+
+  /* calibration points and camera to screen homography,
+     h[8] is always 1. identity when not calibrated.
+   */
+  unsigned int calib_npoints;
+  double calib_cam[IWB_CALIB_MAX_POINTS * 2];
+  double calib_screen[IWB_CALIB_MAX_POINTS * 2];
+  double calib_error[IWB_CALIB_MAX_POINTS];
+  unsigned int calib_is_inlier[IWB_CALIB_MAX_POINTS];
+  double h[9];
+
+  /* applied to the detected points before h, if any */
+  unsigned int has_distortion;
+  iwb_distortion_t distortion;
+
+  /* set once h is computed, by the client or the markers */
+  unsigned int is_calibrated;
+
+  /* panel markers, camera pixels. marker_ref are the
+     positions h is valid for, marker_candidate the ones
+     seen in the last marker_nstable frames. marker_nupdates
+     counts the calibrations from the markers.
+   */
+  unsigned int has_marker_ref;
+  double marker_ref[8];
+  double marker_candidate[8];
+  unsigned int marker_nstable;
+  uint64_t marker_time;
+  unsigned int marker_nupdates;
+
+  /* camera to user coordinates table, if conf.use_lut.
+     nodes are (x, y) pairs sampled over the camera frame,
+     rebuilt on the next lookup once is_lut_dirty is set.
+   */
+  int32_t* lut;
+  unsigned int lut_width;
+  unsigned int lut_height;
+  unsigned int is_lut_dirty;
+
+  /* window geometry, screen to window user units */
+  unsigned int has_window;
+  int win_origin[2];
+  int win_size[2];
+  double win_units[2];
+} iwb_state_t;
+
+
 /* exported api
  */
 
 /* internal state initialization
+   conf may be NULL for the default configuration.
+   fails with IWB_ERR_CAPTURE if the camera cannot be
+   opened or gives no frame, IWB_ERR_MEMORY if a buffer
+   cannot be allocated, IWB_ERR_EVENT_FD or IWB_ERR_THREAD
+   if the async mode cannot be started. the state is then
+   released, iwb_state_fini must not be called.
  */
 
 iwb_error_t iwb_state_init
@@ -52,6 +358,11 @@ iwb_error_t iwb_state_fini
 
 
 /* configuration loading
+   load_default fills conf with the defaults, the others
+   only set the values given, as key = value lines in a
+   file ('#' starts a comment) or as --key=value or
+   --key value arguments. keys are the conf field names,
+   arrays are given as space separated values.
  */
 
 iwb_error_t iwb_conf_load_default
@@ -71,11 +382,24 @@ iwb_error_t iwb_conf_load_av
 (
  iwb_state_t* state,
  int ac,
- const char** av
+ const char** av,
+ iwb_conf_t* conf
+);
+
+/* non zero if the key was given to load_file or load_av
+   since load_default, even with the default value
+ */
+
+int iwb_conf_is_set
+(
+ const iwb_conf_t* conf,
+ const char* name
 );
 
 
 /* video frame grabbing
+   grabs a frame and detects the stylus in it.
+   sync mode only, the worker does it in async mode.
  */
 
 iwb_error_t iwb_get_next_frame
@@ -84,7 +408,39 @@ iwb_error_t iwb_get_next_frame
 );
 
 
+/* async mode, events queued when there is no callback.
+   get up to n events, *count is the number retrieved.
+   returns the worker error once it stopped and all the
+   events have been consumed.
+ */
+
+iwb_error_t iwb_poll_events
+(
+ iwb_state_t* state,
+ iwb_event_t* events,
+ unsigned int n,
+ unsigned int* count
+);
+
+/* eventfd to wait on (poll, select, or a toolkit main
+   loop), -1 if events go to a callback. read it to
+   clear it before polling the events.
+ */
+
+int iwb_get_event_fd
+(
+ iwb_state_t* state
+);
+
+
 /* get the pointer coordinates
+   in window user units if a window geometry is set,
+   in screen pixels otherwise. once the calibration
+   is reset, in camera pixels.
+   with several pointers down, the oldest one.
+   with conf.use_lut, the mapping is interpolated from
+   a table sampled every 8 camera pixels, within a
+   fraction of a screen pixel of the exact one.
  */
 
 iwb_error_t iwb_get_coords
@@ -95,6 +451,20 @@ iwb_error_t iwb_get_coords
 );
 
 
+/* get every pointer of the current frame, up to n.
+   *count is the number retrieved. coords as above.
+   sync mode only.
+ */
+
+iwb_error_t iwb_get_pointers
+(
+ iwb_state_t* state,
+ iwb_pointer_t* pointers,
+ unsigned int n,
+ unsigned int* count
+);
+
+
 iwb_error_t iwb_set_window_geometry
 (
  iwb_state_t* s,
@@ -104,13 +474,17 @@ iwb_error_t iwb_set_window_geometry
 );
 
 
+/* with conf.is_auto_calib, a reset calibration is
+   computed again from the markers
+ */
+
 iwb_error_t iwb_calib_reset
 (
  iwb_state_t* state
 );
 
 
-iwb_errort iwb_calib_add_point
+iwb_error_t iwb_calib_add_point
 (
  iwb_state_t* state,
  int cam_coords[2],
@@ -118,11 +492,48 @@ iwb_errort iwb_calib_add_point
 );
 
 
+/* compute the homography from the points added so far.
+   4 points at least, more are fitted in the least
+   squares sense after rejecting the bad ones (see
+   conf.calib_max_error). 9 or 16 points spread over
+   the screen give a better fit in the corners, and
+   are needed for the lens distortion to be estimated
+   (see conf.calib_distortion).
+   fails if no 4 points agree, the calibration is then
+   left unchanged.
+ */
+
 iwb_error_t iwb_calib_update
 (
  iwb_state_t* state
 );
 
 
+/* save the current calibration to conf.calib_path,
+   replacing the previous one of the camera
+ */
+
+iwb_error_t iwb_calib_save
+(
+ iwb_state_t* state
+);
+
+
+/* per point reprojection error, in screen pixels, and
+   whether the point was used. valid after an update,
+   in the order the points were added. is_inlier may
+   be NULL.
+ */
+
+iwb_error_t iwb_calib_get_errors
+(
+ iwb_state_t* state,
+ double* errors,
+ unsigned int* is_inlier,
+ unsigned int n,
+ unsigned int* count
+);
+
+
 
 #endif /* ! IWB_H_INCLUDED */
@@ -1,67 +1,338 @@
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "iwb.h"
+#include "uinput.h"
 
 
 /* unit testing
  */
 
-static void do_iwb_calib(iwb_state_t* state)
+static int wait_pointer(iwb_state_t* state, int is_on, int cam_coords[2])
 {
-  /* calibration procedure example */
+  int pointer_on;
 
-  iwb_reset_matrix(state);
+  do
+  {
+    if (iwb_get_next_frame(state) != IWB_ERR_SUCCESS) return -1;
+    iwb_get_coords(state, cam_coords, &pointer_on);
+  } while (pointer_on != is_on);
+
+  return 0;
+}
+
+static int do_iwb_calib(iwb_state_t* state, const int dims[2])
+{
+  /* calibration procedure example. the calibration is
+     reset first so that get_coords gives camera coords.
+   */
 
-  /* Lop over 4 calibration points. */
+  int i;
 
-  for (int i = 0; i < 4; i++)
+  iwb_calib_reset(state);
+
+  /* Loop over 4 calibration points, the screen corners. */
+
+  for (i = 0; i < 4; i++)
   {
-    int screen_coords[2] = {}; /* (i-ème coin de l'écran) */
+    int screen_coords[2];
     int cam_coords[2];
-    int pointer_on;
-    display_calibration_target(screen_coords);
-    ask_user_to_click_on_target();
+
+    screen_coords[0] = (i == 1 || i == 2) ? dims[0] - 1 : 0;
+    screen_coords[1] = (i >= 2) ? dims[1] - 1 : 0;
+    printf("point the stylus at %d,%d\n", screen_coords[0], screen_coords[1]);
+
     /* Wait for the user to release the button... */
-    do {
-      iwb_get_next_frame(state);
-      iwb_get_coords(state, &pointer_on, cam_coords);
-    } while (pointer_on);
+    if (wait_pointer(state, 0, cam_coords)) return -1;
     /* ...and then to click again. */
-    do {
-      iwb_get_next_frame(state);
-      iwb_get_coords(state, &pointer_on, cam_coords);
-    } while (!pointer_on);
-    iwb_add_calibration_point(state, cam_coords, screen_coords);
+    if (wait_pointer(state, 1, cam_coords)) return -1;
+
+    iwb_calib_add_point(state, cam_coords, screen_coords);
   }
-  iwb_update_calib_matrix(state);
+
+  return iwb_calib_update(state) == IWB_ERR_SUCCESS ? 0 : -1;
+}
+
+/* uinput readback: a down, move, occluded, up sequence
+   of two pointers is written to the device and read back
+   from its evdev node. the state seen by an evdev client
+   after every frame is checked, the kernel only passing
+   the values that changed.
+ */
+
+typedef struct uinput_frame
+{
+  iwb_pointer_t pointers[2];
+  unsigned int npointers;
+
+  /* expected: reports, BTN_TOUCH, tracking id of slots 0, 1 */
+  unsigned int nreports;
+  int touch;
+  int tracking_ids[2];
+} uinput_frame_t;
+
+#define UINPUT_NFRAMES 5
+
+static const uinput_frame_t uinput_frames[2][UINPUT_NFRAMES] =
+{
+  /* tablet, the pen follows pointer 1. occluded, the pen
+     stays where it was and nothing is reported.
+   */
+  {
+    { { { 1, IWB_POINTER_DOWN, { 100, 100 }, 10 } }, 1, 1, 1, { -1, -1 } },
+    { { { 1, IWB_POINTER_MOVE, { 110, 105 }, 12 },
+        { 2, IWB_POINTER_DOWN, { 300, 200 }, 10 } }, 2, 1, 1, { -1, -1 } },
+    { { { 1, IWB_POINTER_OCCLUDED, { 110, 105 }, 12 },
+        { 2, IWB_POINTER_MOVE, { 310, 210 }, 10 } }, 2, 0, 1, { -1, -1 } },
+    { { { 1, IWB_POINTER_UP, { 110, 105 }, 12 },
+        { 2, IWB_POINTER_MOVE, { 320, 220 }, 10 } }, 2, 1, 0, { -1, -1 } },
+    { { { 2, IWB_POINTER_UP, { 320, 220 }, 10 } }, 1, 0, 0, { -1, -1 } }
+  },
+
+  /* touch, a contact per pointer */
+  {
+    { { { 1, IWB_POINTER_DOWN, { 100, 100 }, 10 } }, 1, 1, 1, { 1, -1 } },
+    { { { 1, IWB_POINTER_MOVE, { 110, 105 }, 12 },
+        { 2, IWB_POINTER_DOWN, { 300, 200 }, 10 } }, 2, 1, 1, { 1, 2 } },
+    { { { 1, IWB_POINTER_OCCLUDED, { 110, 105 }, 12 },
+        { 2, IWB_POINTER_MOVE, { 310, 210 }, 10 } }, 2, 1, 1, { 1, 2 } },
+    { { { 1, IWB_POINTER_UP, { 110, 105 }, 12 },
+        { 2, IWB_POINTER_MOVE, { 320, 220 }, 10 } }, 2, 1, 1, { -1, 2 } },
+    { { { 2, IWB_POINTER_UP, { 320, 220 }, 10 } }, 1, 1, 0, { -1, -1 } }
+  }
+};
+
+static int open_evdev(iwb_uinput_t* uinput)
+{
+  /* the node shows up once udev, or devtmpfs, made it */
+
+  char path[64];
+  unsigned int i;
+  int fd;
+
+  for (i = 0; i < 100; ++i)
+  {
+    if (iwb_uinput_get_devnode(uinput, path, sizeof(path)) == 0)
+    {
+      fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+      if (fd != -1) return fd;
+    }
+    usleep(10000);
+  }
+
+  return -1;
+}
+
+static int read_frame
+(
+ int fd,
+ unsigned int* nreports,
+ int* touch,
+ int* slot,
+ int tracking_ids[IWB_MAX_POINTERS]
+)
+{
+  /* apply the pending events to the client state */
+
+  struct input_event e;
+  ssize_t n;
+
+  *nreports = 0;
+
+  while ((n = read(fd, &e, sizeof(e))) == (ssize_t)sizeof(e))
+  {
+    if ((e.type == EV_SYN) && (e.code == SYN_REPORT))
+      ++*nreports;
+    else if ((e.type == EV_KEY) && (e.code == BTN_TOUCH))
+      *touch = e.value;
+    else if ((e.type == EV_ABS) && (e.code == ABS_MT_SLOT))
+      *slot = e.value;
+    else if ((e.type == EV_ABS) && (e.code == ABS_MT_TRACKING_ID))
+    {
+      if ((*slot < 0) || (*slot >= IWB_MAX_POINTERS)) return -1;
+      tracking_ids[*slot] = e.value;
+    }
+  }
+
+  return ((n == -1) && (errno == EAGAIN)) ? 0 : -1;
+}
+
+static int check_uinput(iwb_uinput_mode_t mode, const int dims[2])
+{
+  const uinput_frame_t* const frames = uinput_frames[mode];
+  iwb_uinput_t uinput;
+  unsigned int nreports;
+  int tracking_ids[IWB_MAX_POINTERS];
+  int touch = 0;
+  int slot = 0;
+  int err = -1;
+  int fd;
+  unsigned int i;
+
+  for (i = 0; i < IWB_MAX_POINTERS; ++i) tracking_ids[i] = -1;
+
+  if (iwb_uinput_open(&uinput, mode, dims, 100))
+  {
+    printf("uinput not available, skipped\n");
+    return 0;
+  }
+
+  fd = open_evdev(&uinput);
+  if (fd == -1)
+  {
+    printf("evdev node not found\n");
+    goto on_error;
+  }
+
+  for (i = 0; i < UINPUT_NFRAMES; ++i)
+  {
+    const uinput_frame_t* const f = &frames[i];
+
+    if (iwb_uinput_write(&uinput, f->pointers, f->npointers)) goto on_error;
+    if (read_frame(fd, &nreports, &touch, &slot, tracking_ids)) goto on_error;
+
+    if ((nreports != f->nreports) ||
+        (touch != f->touch) ||
+        (tracking_ids[0] != f->tracking_ids[0]) ||
+        (tracking_ids[1] != f->tracking_ids[1]))
+    {
+      printf
+      (
+       "frame %u: %u reports, touch %d, ids %d %d\n", i,
+       nreports, touch, tracking_ids[0], tracking_ids[1]
+      );
+      goto on_error;
+    }
+  }
+
+  err = 0;
+
+ on_error:
+  if (fd != -1) close(fd);
+  iwb_uinput_close(&uinput);
+  printf
+  (
+   "%s: %s\n",
+   (mode == IWB_UINPUT_TABLET) ? "tablet" : "touch", err ? "failed" : "ok"
+  );
+  return err;
 }
 
 int main(int ac, char** av)
 {
   iwb_state_t state;
   iwb_conf_t conf;
-  iwb_error_t err;
   int is_on;
   int coords[2];
   int dims[2];
-
-  iwb_load_conf(&conf, av[0]);
-
-  iwb_init_with_conf(&state, &conf);
-
-  do_iwb_calibration(&state);
+  int is_auto = 0;
+  int is_uinput = 0;
+  iwb_uinput_mode_t mode = IWB_UINPUT_TABLET;
+  iwb_uinput_t uinput;
+  iwb_pointer_t pointers[IWB_MAX_POINTERS];
+  unsigned int npointers;
 
   /* TODO: initialize dims from X11 */
   dims[0] = 640;
   dims[1] = 480;
 
-  while (1)
+  iwb_conf_load_default(&state, &conf);
+  conf.use_lut = 1;
+
+  /* main [--markers] [--tablet | --touch] [--key value]...
+     with the iwb_conf_t keys, --calib_path file to keep
+     the calibration. --tablet and --touch send the
+     pointers to a uinput device instead of printing them.
+     main --check-uinput reads both modes back, no camera
+     needed.
+   */
+  if ((ac == 2) && (strcmp(av[1], "--check-uinput") == 0))
+  {
+    if (check_uinput(IWB_UINPUT_TABLET, dims)) return -1;
+    return check_uinput(IWB_UINPUT_TOUCH, dims);
+  }
+
+  for (; ac > 1; --ac, ++av)
+  {
+    if (strcmp(av[1], "--markers") == 0)
+    {
+      is_auto = 1;
+    }
+    else if (strcmp(av[1], "--tablet") == 0)
+    {
+      is_uinput = 1;
+      mode = IWB_UINPUT_TABLET;
+    }
+    else if (strcmp(av[1], "--touch") == 0)
+    {
+      is_uinput = 1;
+      mode = IWB_UINPUT_TOUCH;
+    }
+    else
+    {
+      break ;
+    }
+  }
+
+  if (iwb_conf_load_av(&state, ac - 1, (const char**)av + 1, &conf))
   {
-    iwb_get_next_frame(&state);
-    iwb_get_coords(&state, dims, coords, &is_on);
+    printf("invalid option\n");
+    return -1;
+  }
+
+  /* the panel markers are at the screen corners */
+  if (is_auto)
+  {
+    conf.is_auto_calib = 1;
+    conf.marker_screen[2] = dims[0] - 1;
+    conf.marker_screen[4] = dims[0] - 1;
+    conf.marker_screen[5] = dims[1] - 1;
+    conf.marker_screen[7] = dims[1] - 1;
+  }
+
+  if (iwb_state_init(&state, &conf) != IWB_ERR_SUCCESS)
+  {
+    printf("iwb_state_init failed\n");
+    return -1;
+  }
+
+  /* calibrated by the markers, or loaded from the store */
+  if ((is_auto == 0) && (state.is_calibrated == 0))
+  {
+    if (do_iwb_calib(&state, dims))
+    {
+      printf("calibration failed\n");
+      iwb_state_fini(&state);
+      return -1;
+    }
+
+    if (conf.calib_path[0]) iwb_calib_save(&state);
+  }
+
+  if (is_uinput && iwb_uinput_open(&uinput, mode, dims, conf.max_area))
+  {
+    printf("uinput not available\n");
+    iwb_state_fini(&state);
+    return -1;
+  }
+
+  while (iwb_get_next_frame(&state) == IWB_ERR_SUCCESS)
+  {
+    if (is_uinput)
+    {
+      iwb_get_pointers(&state, pointers, IWB_MAX_POINTERS, &npointers);
+      iwb_uinput_write(&uinput, pointers, npointers);
+      continue ;
+    }
+
+    iwb_get_coords(&state, coords, &is_on);
     printf("%d,%d,%d\n", is_on, coords[0], coords[1]);
   }
 
-  iwb_fini(&state);
+  if (is_uinput) iwb_uinput_close(&uinput);
+  iwb_state_fini(&state);
 
   return 0;
 }
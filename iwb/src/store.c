@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+#include <opencv2/core/types_c.h>
+#include "iwb.h"
+#include "store.h"
+
+
+/* file format, native byte order. a header then the
+   records, each followed by its lut. the record size in
+   the header changes with the layout, files written with
+   another one are ignored.
+ */
+
+#define STORE_MAGIC "IWBC"
+#define STORE_VERSION 1
+
+typedef struct store_header
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t nrecords;
+} store_header_t;
+
+typedef struct store_record
+{
+  /* record and lut */
+  uint32_t size;
+
+  /* key */
+  char cam_id[IWB_CAM_ID_SIZE];
+  uint32_t frame_width;
+  uint32_t frame_height;
+
+  /* detection settings */
+  uint32_t threshold;
+  uint32_t min_area;
+  uint32_t max_area;
+
+  /* calibration */
+  uint32_t has_distortion;
+  uint32_t has_window;
+  uint32_t has_marker_ref;
+  int32_t win_origin[2];
+  int32_t win_size[2];
+  uint32_t lut_width;
+  uint32_t lut_height;
+  double h[9];
+  iwb_distortion_t distortion;
+  double win_units[2];
+  double marker_ref[8];
+
+  /* followed by lut_width * lut_height * 2 int32_t */
+} store_record_t;
+
+
+/* helpers
+ */
+
+static size_t get_lut_size(const store_record_t* r)
+{
+  return (size_t)r->lut_width * r->lut_height * 2 * sizeof(int32_t);
+}
+
+static int is_key_equal(const store_record_t* r, const iwb_state_t* state)
+{
+  return
+    (strncmp(r->cam_id, state->cam_id, IWB_CAM_ID_SIZE) == 0) &&
+    (r->frame_width == (uint32_t)state->ir->width) &&
+    (r->frame_height == (uint32_t)state->ir->height);
+}
+
+static int map_file
+(
+ const char* path,
+ const unsigned char** data,
+ size_t* size
+)
+{
+  /* returns 0 if there is no file */
+
+  const store_header_t* header;
+  struct stat st;
+  void* p;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1) return 0;
+
+  if ((fstat(fd, &st) == -1) || ((size_t)st.st_size < sizeof(store_header_t)))
+  {
+    close(fd);
+    return -1;
+  }
+
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return -1;
+
+  header = (const store_header_t*)p;
+  if ((memcmp(header->magic, STORE_MAGIC, 4) != 0) ||
+      (header->version != STORE_VERSION) ||
+      (header->record_size != sizeof(store_record_t)))
+  {
+    munmap(p, st.st_size);
+    return -1;
+  }
+
+  *data = (const unsigned char*)p;
+  *size = st.st_size;
+
+  return 1;
+}
+
+static const store_record_t* next_record
+(
+ const unsigned char* data,
+ size_t size,
+ size_t* off
+)
+{
+  /* NULL at the end, or on a truncated record */
+
+  const store_record_t* r;
+
+  if (*off + sizeof(store_record_t) > size) return NULL;
+
+  r = (const store_record_t*)(data + *off);
+  if ((r->size < sizeof(store_record_t) + get_lut_size(r)) ||
+      (r->size > size - *off))
+    return NULL;
+
+  *off += r->size;
+
+  return r;
+}
+
+
+/* exported
+ */
+
+void iwb_store_get_cam_id
+(
+ int index,
+ char* id,
+ size_t size
+)
+{
+  struct v4l2_capability cap;
+  char path[32];
+  int fd;
+
+  snprintf(path, sizeof(path), "/dev/video%d", index);
+  snprintf(id, size, "video%d", index);
+
+  fd = open(path, O_RDONLY | O_NONBLOCK);
+  if (fd == -1) return ;
+
+  /* the bus tells identical cameras apart */
+  memset(&cap, 0, sizeof(cap));
+  if (ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0)
+    snprintf(id, size, "%.32s@%.32s", cap.card, cap.bus_info);
+
+  close(fd);
+}
+
+int iwb_store_load
+(
+ iwb_state_t* state,
+ const char* path
+)
+{
+  const unsigned char* data;
+  const store_record_t* r;
+  size_t size;
+  size_t off;
+  int err;
+
+  err = map_file(path, &data, &size);
+  if (err <= 0) return err;
+
+  off = sizeof(store_header_t);
+  while ((r = next_record(data, size, &off)) != NULL)
+    if (is_key_equal(r, state)) break ;
+
+  if (r == NULL)
+  {
+    munmap((void*)data, size);
+    return 0;
+  }
+
+  /* settings given explicitly take precedence over the
+     stored ones, even when equal to the default
+   */
+  if (iwb_conf_is_set(&state->conf, "threshold") == 0)
+    state->conf.threshold = r->threshold;
+  if (iwb_conf_is_set(&state->conf, "min_area") == 0)
+    state->conf.min_area = r->min_area;
+  if (iwb_conf_is_set(&state->conf, "max_area") == 0)
+    state->conf.max_area = r->max_area;
+
+  pthread_mutex_lock(&state->lock);
+
+  memcpy(state->h, r->h, sizeof(state->h));
+  state->has_distortion = r->has_distortion;
+  state->distortion = r->distortion;
+  state->is_calibrated = 1;
+
+  state->has_window = r->has_window;
+  state->win_origin[0] = r->win_origin[0];
+  state->win_origin[1] = r->win_origin[1];
+  state->win_size[0] = r->win_size[0];
+  state->win_size[1] = r->win_size[1];
+  state->win_units[0] = r->win_units[0];
+  state->win_units[1] = r->win_units[1];
+
+  state->has_marker_ref = r->has_marker_ref;
+  memcpy(state->marker_ref, r->marker_ref, sizeof(state->marker_ref));
+
+  /* the table saved is ready, or it is rebuilt */
+  state->is_lut_dirty = 1;
+  if ((state->lut != NULL) && (r->lut_width != 0) &&
+      (r->lut_width == state->lut_width) &&
+      (r->lut_height == state->lut_height))
+  {
+    memcpy(state->lut, r + 1, get_lut_size(r));
+    state->is_lut_dirty = 0;
+  }
+
+  pthread_mutex_unlock(&state->lock);
+
+  munmap((void*)data, size);
+
+  return 1;
+}
+
+int iwb_store_save
+(
+ iwb_state_t* state,
+ const char* path
+)
+{
+  const unsigned char* data = NULL;
+  const store_record_t* r;
+  store_header_t header;
+  store_record_t* record;
+  char tmp_path[PATH_MAX];
+  size_t lut_size = 0;
+  size_t size = 0;
+  size_t off;
+  FILE* file;
+  int is_error = 0;
+
+  /* snapshot the calibration, the worker may update it */
+
+  pthread_mutex_lock(&state->lock);
+
+  if ((state->lut != NULL) && (state->is_lut_dirty == 0))
+    lut_size = (size_t)state->lut_width * state->lut_height * 2 * sizeof(int32_t);
+
+  record = malloc(sizeof(store_record_t) + lut_size);
+  if (record == NULL)
+  {
+    pthread_mutex_unlock(&state->lock);
+    return -1;
+  }
+
+  memset(record, 0, sizeof(store_record_t));
+  record->size = sizeof(store_record_t) + lut_size;
+  strncpy(record->cam_id, state->cam_id, IWB_CAM_ID_SIZE - 1);
+  record->frame_width = state->ir->width;
+  record->frame_height = state->ir->height;
+  record->threshold = state->conf.threshold;
+  record->min_area = state->conf.min_area;
+  record->max_area = state->conf.max_area;
+  memcpy(record->h, state->h, sizeof(record->h));
+  record->has_distortion = state->has_distortion;
+  record->distortion = state->distortion;
+  record->has_window = state->has_window;
+  record->win_origin[0] = state->win_origin[0];
+  record->win_origin[1] = state->win_origin[1];
+  record->win_size[0] = state->win_size[0];
+  record->win_size[1] = state->win_size[1];
+  record->win_units[0] = state->win_units[0];
+  record->win_units[1] = state->win_units[1];
+  record->has_marker_ref = state->has_marker_ref;
+  memcpy(record->marker_ref, state->marker_ref, sizeof(record->marker_ref));
+
+  if (lut_size)
+  {
+    record->lut_width = state->lut_width;
+    record->lut_height = state->lut_height;
+    memcpy(record + 1, state->lut, lut_size);
+  }
+
+  pthread_mutex_unlock(&state->lock);
+
+  /* written aside then renamed, a reader never sees a
+     partial file
+   */
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  file = fopen(tmp_path, "wb");
+  if (file == NULL)
+  {
+    free(record);
+    return -1;
+  }
+
+  if (map_file(path, &data, &size) <= 0) data = NULL;
+
+  memcpy(header.magic, STORE_MAGIC, 4);
+  header.version = STORE_VERSION;
+  header.record_size = sizeof(store_record_t);
+  header.nrecords = 1;
+
+  if (data != NULL)
+  {
+    off = sizeof(store_header_t);
+    while ((r = next_record(data, size, &off)) != NULL)
+      if (is_key_equal(r, state) == 0) ++header.nrecords;
+  }
+
+  is_error |= (fwrite(&header, sizeof(header), 1, file) != 1);
+
+  if (data != NULL)
+  {
+    off = sizeof(store_header_t);
+    while ((r = next_record(data, size, &off)) != NULL)
+      if (is_key_equal(r, state) == 0)
+        is_error |= (fwrite(r, r->size, 1, file) != 1);
+    munmap((void*)data, size);
+  }
+
+  is_error |= (fwrite(record, record->size, 1, file) != 1);
+  free(record);
+
+  is_error |= (fflush(file) != 0);
+  is_error |= (fsync(fileno(file)) != 0);
+  is_error |= (fclose(file) != 0);
+
+  if (is_error || rename(tmp_path, path))
+  {
+    unlink(tmp_path);
+    return -1;
+  }
+
+  return 0;
+}
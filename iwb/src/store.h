@@ -0,0 +1,53 @@
+#ifndef STORE_H_INCLUDED
+# define STORE_H_INCLUDED
+
+
+/* calibration store. one file holds the calibration of
+   several cameras, keyed by camera identity and frame
+   size. records are read in place from a mapping of the
+   file, an update rewrites the file.
+ */
+
+#include <stddef.h>
+#include "iwb.h"
+
+
+/* identity of the camera at index, as the v4l2 card name
+   and bus. the index is used if the device cannot be
+   queried.
+ */
+
+void iwb_store_get_cam_id
+(
+ int index,
+ char* id,
+ size_t size
+);
+
+/* load the record matching state->cam_id and the frame
+   size into state. the calibration is always loaded, the
+   detection settings (threshold, min_area, max_area) only
+   where the conf was not given them, see iwb_conf_is_set.
+   returns 1 if loaded, 0 if there is no such record or
+   no file, -1 if the file is invalid.
+ */
+
+int iwb_store_load
+(
+ iwb_state_t* state,
+ const char* path
+);
+
+/* replace the record of the camera, others are kept.
+   the lut is saved if it is up to date. returns -1 on
+   error, the previous file is then left unchanged.
+ */
+
+int iwb_store_save
+(
+ iwb_state_t* state,
+ const char* path
+);
+
+
+#endif /* ! STORE_H_INCLUDED */
@@ -2,6 +2,8 @@
 /* opencv2 documentation */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <opencv2/core/core_c.h>
 #include <opencv2/core/types_c.h>
@@ -145,8 +147,10 @@ typedef struct ui_state
   const char* name;
   IplImage* image;
 
-  /* video capture */
+  /* video capture, camera or replayed file */
   CvCapture* capture;
+  unsigned int is_replay;
+  int frame_delay;
 
   /* frame dimensions */
   CvSize lsize;
@@ -218,14 +222,28 @@ static int ui_init
 (
  ui_state_t* ui,
  unsigned int wb_width, unsigned int wb_height,
- unsigned int cam_index
+ unsigned int cam_index, const char* replay_path
 )
 {
   CvSize im_size;
-
-  ui->capture = cvCreateCameraCapture(cam_index);
+  double fps;
+
+  /* a recorded video replaces the camera, no hardware needed */
+  ui->is_replay = (replay_path != NULL);
+  if (ui->is_replay)
+    ui->capture = cvCreateFileCapture(replay_path);
+  else
+    ui->capture = cvCreateCameraCapture(cam_index);
   if (ui->capture == NULL) return -1;
 
+  /* cameras pace themselves, files are played at their frame rate */
+  ui->frame_delay = 1;
+  if (ui->is_replay)
+  {
+    fps = cvGetCaptureProperty(ui->capture, CV_CAP_PROP_FPS);
+    if (fps > 1) ui->frame_delay = (int)(1000 / fps);
+  }
+
   ui->lsize.width = (int)cvGetCaptureProperty
     (ui->capture, CV_CAP_PROP_FRAME_WIDTH);
   ui->lsize.height = (int)cvGetCaptureProperty
@@ -281,14 +299,20 @@ static int ui_run_common(ui_state_t* ui)
   ui->is_done = 0;
   while (ui->is_done == 0)
   {
-    /* refresh left frame */
+    /* refresh left frame, loop over replayed files */
     cap_image = cvQueryFrame(ui->capture);
+    if ((cap_image == NULL) && ui->is_replay)
+    {
+      cvSetCaptureProperty(ui->capture, CV_CAP_PROP_POS_FRAMES, 0);
+      cap_image = cvQueryFrame(ui->capture);
+    }
+    if (cap_image == NULL) return -1;
     cvSetImageROI(ui->image, left_roi);
     cvCopy(cap_image, ui->image, NULL);
     cvResetImageROI(ui->image);
 
     /* poll for event */
-    if ((cvWaitKey(1) & 0xff) == 27) return -1;
+    if ((cvWaitKey(ui->frame_delay) & 0xff) == 27) return -1;
 
     /* redraw calibration points */
     for (i = 0; i < ui->cur_npoints; ++i)
@@ -384,13 +408,38 @@ static int ui_run_whiteboard(ui_state_t* ui)
 
 int main(int ac, char** av)
 {
-  static const unsigned int wb_width = 400;
-  static const unsigned int wb_height = 400;
-  static const unsigned int cam_index = 1; /* second webcam */
+  unsigned int wb_width = 400;
+  unsigned int wb_height = 400;
+  unsigned int cam_index = 1; /* second webcam */
+
+  /* optional recorded video to replay instead of the camera */
+  const char* replay_path = NULL;
 
   ui_state_t ui;
+  int i;
+
+  /* main [--cam index] [--board widthxheight] [video] */
+  for (i = 1; i < ac; ++i)
+  {
+    if ((strcmp(av[i], "--cam") == 0) && (i + 1 < ac))
+    {
+      cam_index = (unsigned int)atoi(av[++i]);
+    }
+    else if ((strcmp(av[i], "--board") == 0) && (i + 1 < ac))
+    {
+      if (sscanf(av[++i], "%ux%u", &wb_width, &wb_height) != 2)
+      {
+        printf("invalid board size: %s\n", av[i]);
+        return -1;
+      }
+    }
+    else
+    {
+      replay_path = av[i];
+    }
+  }
 
-  if (ui_init(&ui, wb_width, wb_height, cam_index))
+  if (ui_init(&ui, wb_width, wb_height, cam_index, replay_path))
   {
     printf("ui_init failed\n");
     return -1;
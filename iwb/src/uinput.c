@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include "iwb.h"
+#include "uinput.h"
+
+
+/* helpers
+ */
+
+static int clamp(int x, int hi)
+{
+  if (x < 0) return 0;
+  if (x > hi) return hi;
+  return x;
+}
+
+static void push_event
+(
+ iwb_uinput_t* uinput,
+ uint16_t type,
+ uint16_t code,
+ int32_t value
+)
+{
+  /* the kernel stamps the events when they are written */
+
+  struct input_event* const e = &uinput->events[uinput->nevents++];
+
+  memset(e, 0, sizeof(struct input_event));
+  e->type = type;
+  e->code = code;
+  e->value = value;
+}
+
+static int flush_events(iwb_uinput_t* uinput)
+{
+  /* the whole frame in a single write */
+
+  const size_t size = uinput->nevents * sizeof(struct input_event);
+  ssize_t n;
+
+  if (uinput->nevents == 0) return 0;
+
+  push_event(uinput, EV_SYN, SYN_REPORT, 0);
+  n = write(uinput->fd, uinput->events, size + sizeof(struct input_event));
+  uinput->nevents = 0;
+
+  return (n == (ssize_t)(size + sizeof(struct input_event))) ? 0 : -1;
+}
+
+static void push_position
+(
+ iwb_uinput_t* uinput,
+ uint16_t code_x,
+ uint16_t code_y,
+ uint16_t code_pressure,
+ const iwb_pointer_t* p
+)
+{
+  push_event(uinput, EV_ABS, code_x, clamp(p->coords[0], uinput->size[0] - 1));
+  push_event(uinput, EV_ABS, code_y, clamp(p->coords[1], uinput->size[1] - 1));
+  push_event
+    (uinput, EV_ABS, code_pressure, clamp((int)p->area, (int)uinput->max_area));
+}
+
+static const iwb_pointer_t* find_oldest
+(
+ const iwb_pointer_t* pointers,
+ unsigned int n
+)
+{
+  /* lowest id in contact, as iwb_get_coords */
+
+  const iwb_pointer_t* oldest = NULL;
+  unsigned int i;
+
+  for (i = 0; i < n; ++i)
+  {
+    if ((pointers[i].state != IWB_POINTER_DOWN) &&
+        (pointers[i].state != IWB_POINTER_MOVE))
+      continue ;
+    if ((oldest == NULL) || (pointers[i].id < oldest->id))
+      oldest = &pointers[i];
+  }
+
+  return oldest;
+}
+
+static const iwb_pointer_t* find_pointer
+(
+ const iwb_pointer_t* pointers,
+ unsigned int n,
+ unsigned int id
+)
+{
+  unsigned int i;
+
+  for (i = 0; i < n; ++i)
+    if (pointers[i].id == id) return &pointers[i];
+
+  return NULL;
+}
+
+
+/* device creation
+ */
+
+static int set_abs
+(
+ int fd,
+ uint16_t code,
+ int32_t minimum,
+ int32_t maximum
+)
+{
+  struct uinput_abs_setup abs;
+
+  memset(&abs, 0, sizeof(abs));
+  abs.code = code;
+  abs.absinfo.minimum = minimum;
+  abs.absinfo.maximum = maximum;
+
+  if (ioctl(fd, UI_SET_ABSBIT, code)) return -1;
+  return ioctl(fd, UI_ABS_SETUP, &abs) ? -1 : 0;
+}
+
+static int setup_device(iwb_uinput_t* uinput)
+{
+  const int fd = uinput->fd;
+  const int32_t max_x = uinput->size[0] - 1;
+  const int32_t max_y = uinput->size[1] - 1;
+  const int32_t max_pressure = (int32_t)uinput->max_area;
+  struct uinput_setup setup;
+
+  /* the device maps to the screen */
+  if (ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_DIRECT)) return -1;
+
+  if (ioctl(fd, UI_SET_EVBIT, EV_KEY)) return -1;
+  if (ioctl(fd, UI_SET_EVBIT, EV_ABS)) return -1;
+  if (ioctl(fd, UI_SET_KEYBIT, BTN_TOUCH)) return -1;
+
+  /* single pointer axes, the oldest contact in touch mode */
+  if (set_abs(fd, ABS_X, 0, max_x)) return -1;
+  if (set_abs(fd, ABS_Y, 0, max_y)) return -1;
+  if (set_abs(fd, ABS_PRESSURE, 0, max_pressure)) return -1;
+
+  if (uinput->mode == IWB_UINPUT_TABLET)
+  {
+    if (ioctl(fd, UI_SET_KEYBIT, BTN_TOOL_PEN)) return -1;
+  }
+  else
+  {
+    if (set_abs(fd, ABS_MT_SLOT, 0, IWB_MAX_POINTERS - 1)) return -1;
+    if (set_abs(fd, ABS_MT_TRACKING_ID, 0, 0xffff)) return -1;
+    if (set_abs(fd, ABS_MT_POSITION_X, 0, max_x)) return -1;
+    if (set_abs(fd, ABS_MT_POSITION_Y, 0, max_y)) return -1;
+    if (set_abs(fd, ABS_MT_PRESSURE, 0, max_pressure)) return -1;
+  }
+
+  memset(&setup, 0, sizeof(setup));
+  setup.id.bustype = BUS_VIRTUAL;
+  snprintf
+  (
+   setup.name, sizeof(setup.name), "%s",
+   (uinput->mode == IWB_UINPUT_TABLET) ? "iwb tablet" : "iwb touch"
+  );
+
+  if (ioctl(fd, UI_DEV_SETUP, &setup)) return -1;
+  return ioctl(fd, UI_DEV_CREATE) ? -1 : 0;
+}
+
+
+/* frame writing
+ */
+
+static void write_tablet
+(
+ iwb_uinput_t* uinput,
+ const iwb_pointer_t* pointers,
+ unsigned int n
+)
+{
+  /* the pen follows one pointer from down to up, then
+     the oldest one still in contact on the next frame
+   */
+
+  const iwb_pointer_t* p;
+
+  if (uinput->is_down)
+  {
+    p = find_pointer(pointers, n, uinput->down_id);
+
+    /* occluded, the pen stays where it was */
+    if ((p != NULL) && (p->state == IWB_POINTER_OCCLUDED)) return ;
+
+    if ((p != NULL) && (p->state != IWB_POINTER_UP))
+    {
+      push_position(uinput, ABS_X, ABS_Y, ABS_PRESSURE, p);
+      return ;
+    }
+
+    /* lifted, or dropped by the tracker */
+    push_event(uinput, EV_KEY, BTN_TOUCH, 0);
+    push_event(uinput, EV_ABS, ABS_PRESSURE, 0);
+    push_event(uinput, EV_KEY, BTN_TOOL_PEN, 0);
+    uinput->is_down = 0;
+    return ;
+  }
+
+  p = find_oldest(pointers, n);
+  if (p == NULL) return ;
+
+  push_event(uinput, EV_KEY, BTN_TOOL_PEN, 1);
+  push_position(uinput, ABS_X, ABS_Y, ABS_PRESSURE, p);
+  push_event(uinput, EV_KEY, BTN_TOUCH, 1);
+  uinput->is_down = 1;
+  uinput->down_id = p->id;
+}
+
+static void write_touch
+(
+ iwb_uinput_t* uinput,
+ const iwb_pointer_t* pointers,
+ unsigned int n
+)
+{
+  /* a slot per pointer in contact. a pointer missing
+     from the frame is lifted, so is an up one. slots
+     are given to new pointers in order, the ones beyond
+     IWB_MAX_POINTERS contacts are not reported.
+   */
+
+  const iwb_pointer_t* p;
+  const iwb_pointer_t* oldest = NULL;
+  unsigned int is_down = 0;
+  unsigned int slot;
+  unsigned int i;
+
+  for (slot = 0; slot < IWB_MAX_POINTERS; ++slot)
+  {
+    if (uinput->is_used[slot] == 0) continue ;
+
+    p = find_pointer(pointers, n, uinput->ids[slot]);
+    if ((p != NULL) && (p->state != IWB_POINTER_UP)) continue ;
+
+    push_event(uinput, EV_ABS, ABS_MT_SLOT, (int32_t)slot);
+    push_event(uinput, EV_ABS, ABS_MT_TRACKING_ID, -1);
+    uinput->is_used[slot] = 0;
+  }
+
+  for (i = 0; i < n; ++i)
+  {
+    p = &pointers[i];
+
+    if (p->state == IWB_POINTER_UP) continue ;
+
+    for (slot = 0; slot < IWB_MAX_POINTERS; ++slot)
+      if (uinput->is_used[slot] && (uinput->ids[slot] == p->id)) break ;
+
+    /* occluded, the contact stays where it was */
+    if (p->state == IWB_POINTER_OCCLUDED)
+    {
+      if ((slot != IWB_MAX_POINTERS) &&
+          ((oldest == NULL) || (p->id < oldest->id)))
+        oldest = p;
+      continue ;
+    }
+
+    if (slot == IWB_MAX_POINTERS)
+    {
+      /* new contact */
+      for (slot = 0; slot < IWB_MAX_POINTERS; ++slot)
+        if (uinput->is_used[slot] == 0) break ;
+      if (slot == IWB_MAX_POINTERS) continue ;
+
+      uinput->is_used[slot] = 1;
+      uinput->ids[slot] = p->id;
+      push_event(uinput, EV_ABS, ABS_MT_SLOT, (int32_t)slot);
+      push_event(uinput, EV_ABS, ABS_MT_TRACKING_ID, (int32_t)(p->id & 0xffff));
+    }
+    else
+    {
+      push_event(uinput, EV_ABS, ABS_MT_SLOT, (int32_t)slot);
+    }
+
+    push_position
+      (uinput, ABS_MT_POSITION_X, ABS_MT_POSITION_Y, ABS_MT_PRESSURE, p);
+
+    if ((oldest == NULL) || (p->id < oldest->id)) oldest = p;
+  }
+
+  /* single touch emulation, for the clients without mt */
+  for (slot = 0; slot < IWB_MAX_POINTERS; ++slot)
+    is_down |= uinput->is_used[slot];
+
+  if ((oldest != NULL) && (oldest->state != IWB_POINTER_OCCLUDED))
+    push_position(uinput, ABS_X, ABS_Y, ABS_PRESSURE, oldest);
+
+  if (is_down != uinput->is_down)
+  {
+    push_event(uinput, EV_KEY, BTN_TOUCH, (int32_t)is_down);
+    uinput->is_down = is_down;
+  }
+}
+
+
+/* exported
+ */
+
+int iwb_uinput_open
+(
+ iwb_uinput_t* uinput,
+ iwb_uinput_mode_t mode,
+ const int size[2],
+ unsigned int max_area
+)
+{
+  memset(uinput, 0, sizeof(iwb_uinput_t));
+  uinput->mode = mode;
+  uinput->size[0] = size[0];
+  uinput->size[1] = size[1];
+  uinput->max_area = max_area;
+
+  uinput->fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  if (uinput->fd == -1) return -1;
+
+  if (setup_device(uinput))
+  {
+    close(uinput->fd);
+    uinput->fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+void iwb_uinput_close
+(
+ iwb_uinput_t* uinput
+)
+{
+  if (uinput->fd == -1) return ;
+
+  ioctl(uinput->fd, UI_DEV_DESTROY);
+  close(uinput->fd);
+  uinput->fd = -1;
+}
+
+int iwb_uinput_write
+(
+ iwb_uinput_t* uinput,
+ const iwb_pointer_t* pointers,
+ unsigned int n
+)
+{
+  uinput->nevents = 0;
+
+  if (uinput->mode == IWB_UINPUT_TABLET) write_tablet(uinput, pointers, n);
+  else write_touch(uinput, pointers, n);
+
+  /* nothing changed, no report */
+  return flush_events(uinput);
+}
+
+int iwb_uinput_get_devnode
+(
+ iwb_uinput_t* uinput,
+ char* path,
+ size_t size
+)
+{
+  /* the event handler is a child of the sysfs device */
+
+  char sysname[64];
+  char dirname[128];
+  struct dirent* de;
+  DIR* dir;
+  int err = -1;
+
+  if (ioctl(uinput->fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0)
+    return -1;
+
+  snprintf(dirname, sizeof(dirname), "/sys/devices/virtual/input/%s", sysname);
+  dir = opendir(dirname);
+  if (dir == NULL) return -1;
+
+  while ((de = readdir(dir)) != NULL)
+  {
+    if (strncmp(de->d_name, "event", 5)) continue ;
+    snprintf(path, size, "/dev/input/%s", de->d_name);
+    err = 0;
+    break ;
+  }
+
+  closedir(dir);
+
+  return err;
+}
@@ -0,0 +1,98 @@
+#ifndef UINPUT_H_INCLUDED
+# define UINPUT_H_INCLUDED
+
+
+/* pointer output through a uinput device, instead of
+   faking x events. the kernel input stack (evdev, then
+   libinput or the x driver) sees a direct input device
+   covering the screen. a frame of pointers is written
+   at once, terminated by a SYN_REPORT.
+ */
+
+#include <stddef.h>
+#include <linux/input.h>
+#include "iwb.h"
+
+
+/* a frame is a few events per slot, and the report */
+
+#define IWB_UINPUT_MAX_EVENTS (IWB_MAX_POINTERS * 8 + 8)
+
+
+typedef enum iwb_uinput_mode
+{
+  /* pen tablet following the oldest pointer */
+  IWB_UINPUT_TABLET = 0,
+
+  /* multitouch screen (protocol b), a contact per pointer */
+  IWB_UINPUT_TOUCH
+} iwb_uinput_mode_t;
+
+typedef struct iwb_uinput
+{
+  /* /dev/uinput, -1 once closed */
+  int fd;
+  iwb_uinput_mode_t mode;
+
+  /* axis ranges, coordinates as iwb_get_pointers */
+  int size[2];
+  unsigned int max_area;
+
+  /* touch mode, pointer id of the contact in each slot */
+  unsigned int is_used[IWB_MAX_POINTERS];
+  unsigned int ids[IWB_MAX_POINTERS];
+
+  /* tablet mode, pointer in contact */
+  unsigned int is_down;
+  unsigned int down_id;
+
+  /* frame being written */
+  struct input_event events[IWB_UINPUT_MAX_EVENTS];
+  unsigned int nevents;
+} iwb_uinput_t;
+
+
+/* create the device. size is the screen size, in the
+   units of the pointers (see iwb_get_coords), max_area
+   the largest pointer area, the full pressure.
+   returns -1 if uinput is not available.
+ */
+
+int iwb_uinput_open
+(
+ iwb_uinput_t* uinput,
+ iwb_uinput_mode_t mode,
+ const int size[2],
+ unsigned int max_area
+);
+
+void iwb_uinput_close
+(
+ iwb_uinput_t* uinput
+);
+
+/* write the pointers of a frame, see iwb_get_pointers.
+   down and up pointers begin and end contacts, occluded
+   ones stay in contact where they were.
+ */
+
+int iwb_uinput_write
+(
+ iwb_uinput_t* uinput,
+ const iwb_pointer_t* pointers,
+ unsigned int n
+);
+
+/* event device node of the created device, for an
+   evdev client to read it back (/dev/input/eventN)
+ */
+
+int iwb_uinput_get_devnode
+(
+ iwb_uinput_t* uinput,
+ char* path,
+ size_t size
+);
+
+
+#endif /* ! UINPUT_H_INCLUDED */